@@ -0,0 +1,334 @@
+#pragma once
+
+#include <pthread.h>
+#include <math.h>
+#include <string.h>
+
+#include "font_atlas.h"
+#include "thread_pool.h"
+#include "text_renderer.h"
+
+//builds an atlas on a background thread so the first frame doesn't wait for every glyph.
+//the worker rasterizes a few glyphs at a time, queued text first, and shelf packs each one into
+//a shared atlas. the render thread copies that atlas out as a snapshot whenever it changed and
+//draws from the copy, so only the copy is ever touched outside the lock.
+//every subpixel phase of a character is built together, since a snapshot doesn't keep glyphs
+//added to it lazily. the fallback chain is only used with the lock held, so it must not be used
+//anywhere else until the build is destroyed
+
+enum AsyncGlyphState{
+    ASYNC_GLYPH_PENDING,
+    ASYNC_GLYPH_RASTERIZING,
+    ASYNC_GLYPH_READY,
+    //no face could rasterize it
+    ASYNC_GLYPH_MISSING
+};
+
+struct AsyncAtlasGlyph{
+    unsigned short charCode;
+    AsyncGlyphState state;
+    //the most recently queued glyphs are built first, 0 is never queued
+    unsigned int priority;
+};
+
+struct AsyncFontAtlas{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t workCond;
+    pthread_cond_t doneCond;
+    unsigned char* fontData;
+    FontAtlasSettings settings;
+    FontAtlas atlas;
+    //bumped for every glyph that is finished, so it also counts them
+    unsigned int version;
+    AsyncAtlasGlyph* glyphs;
+    unsigned int totalGlyphs;
+    unsigned int glyphCapacity;
+    unsigned int totalPending;
+    unsigned int nextPriority;
+    bool cancelled;
+};
+
+//fits roughly the requested glyphs at an average em size, most atlases then grow only in height
+static unsigned int getAsyncAtlasWidth(unsigned char* fontData, FontAtlasSettings* settings, unsigned int totalGlyphs){
+    float em = (float)getUnitsPerEm(fontData) / (float)settings->divisions;
+    unsigned int phases = settings->subpixelPhases ? settings->subpixelPhases : 1;
+    unsigned int width = (unsigned int)(sqrtf((float)(totalGlyphs * phases)) * em * 0.75f) + 1;
+    return width > (unsigned int)em + 1 ? width : (unsigned int)em + 1;
+}
+
+static int findAsyncAtlasGlyph(AsyncFontAtlas* aa, unsigned short charCode){
+    for(unsigned int i = 0; i < aa->totalGlyphs; i++){
+        if(aa->glyphs[i].charCode == charCode){
+            return i;
+        }
+    }
+    return -1;
+}
+
+//called with the lock held
+static void addAsyncAtlasGlyph(AsyncFontAtlas* aa, unsigned short charCode, unsigned int priority){
+    if(aa->totalGlyphs == aa->glyphCapacity){
+        unsigned int capacity = aa->glyphCapacity ? aa->glyphCapacity * 2 : 128;
+        AsyncAtlasGlyph* glyphs = new AsyncAtlasGlyph[capacity];
+        for(unsigned int i = 0; i < aa->totalGlyphs; i++){
+            glyphs[i] = aa->glyphs[i];
+        }
+        if(aa->glyphs) delete[] aa->glyphs;
+        aa->glyphs = glyphs;
+        aa->glyphCapacity = capacity;
+    }
+    AsyncAtlasGlyph* g = &aa->glyphs[aa->totalGlyphs++];
+    g->charCode = charCode;
+    g->state = ASYNC_GLYPH_PENDING;
+    g->priority = priority;
+    aa->totalPending++;
+}
+
+struct AsyncGlyphBitmap{
+    unsigned char* bytes;
+    unsigned int width;
+    unsigned int height;
+    float xShift;
+    float yShift;
+};
+
+struct AsyncRasterJob{
+    unsigned char** fonts;
+    unsigned int* divisions;
+    unsigned short* charCodes;
+    unsigned int subpixelPhases;
+    bool glyphIndices;
+    bool fixedPointRaster;
+    AtlasAllocator* allocator;
+    AsyncGlyphBitmap* bitmaps;
+};
+
+static void rasterizeAsyncAtlasGlyph(void* data, unsigned int i){
+    AsyncRasterJob* job = (AsyncRasterJob*)data;
+    unsigned int c = i / job->subpixelPhases;
+    unsigned int phase = i % job->subpixelPhases;
+    AsyncGlyphBitmap* b = &job->bitmaps[i];
+    float xOffset = ((float)phase * (float)job->divisions[c]) / (float)job->subpixelPhases;
+    b->bytes = getAtlasGlyphBitmap(job->fonts[c], job->charCodes[c], job->glyphIndices, job->fixedPointRaster, &b->width, &b->height, &b->xShift, &b->yShift, job->divisions[c], xOffset, 0, job->allocator);
+}
+
+static void* asyncFontAtlasWorker(void* arg){
+    AsyncFontAtlas* aa = (AsyncFontAtlas*)arg;
+    unsigned int phases = aa->atlas.subpixelPhases;
+    //one glyph per thread keeps the build responsive to newly queued text
+    unsigned int batch = aa->settings.threadPool ? aa->settings.threadPool->totalThreads + 1 : 1;
+    unsigned int* picked = new unsigned int[batch];
+    unsigned char** fonts = new unsigned char*[batch];
+    unsigned int* divisions = new unsigned int[batch];
+    unsigned short* charCodes = new unsigned short[batch];
+    AsyncGlyphBitmap* bitmaps = new AsyncGlyphBitmap[batch * phases];
+
+    pthread_mutex_lock(&aa->mutex);
+    while(true){
+        while(!aa->cancelled && aa->totalPending == 0){
+            pthread_cond_broadcast(&aa->doneCond);
+            pthread_cond_wait(&aa->workCond, &aa->mutex);
+        }
+        if(aa->cancelled){
+            break;
+        }
+
+        unsigned int total = 0;
+        while(total < batch && total < aa->totalPending){
+            int best = -1;
+            for(unsigned int i = 0; i < aa->totalGlyphs; i++){
+                if(aa->glyphs[i].state == ASYNC_GLYPH_PENDING && (best < 0 || aa->glyphs[i].priority > aa->glyphs[best].priority)){
+                    best = i;
+                }
+            }
+            aa->glyphs[best].state = ASYNC_GLYPH_RASTERIZING;
+            picked[total] = best;
+            charCodes[total] = aa->glyphs[best].charCode;
+            fonts[total] = getAtlasGlyphFont(aa->settings.glyphIndices ? 0 : aa->settings.fallback, aa->fontData, charCodes[total], aa->settings.divisions, &divisions[total]);
+            total++;
+        }
+        aa->totalPending -= total;
+        pthread_mutex_unlock(&aa->mutex);
+
+        AsyncRasterJob job;
+        job.fonts = fonts;
+        job.divisions = divisions;
+        job.charCodes = charCodes;
+        job.subpixelPhases = phases;
+        job.glyphIndices = aa->settings.glyphIndices;
+        job.fixedPointRaster = aa->settings.fixedPointRaster;
+        job.allocator = aa->settings.allocator;
+        job.bitmaps = bitmaps;
+        runParallel(aa->settings.threadPool, rasterizeAsyncAtlasGlyph, &job, total * phases);
+
+        pthread_mutex_lock(&aa->mutex);
+        for(unsigned int i = 0; i < total; i++){
+            bool ready = true;
+            for(unsigned int p = 0; p < phases; p++){
+                AsyncGlyphBitmap* b = &bitmaps[(i * phases) + p];
+                if(b->bytes){
+                    addGlyphToFontAtlas(&aa->atlas, charCodes[i], p, b->bytes, b->width, b->height, b->xShift, b->yShift);
+                    freeBitmapMemory(b->bytes, aa->settings.allocator);
+                }else{
+                    ready = false;
+                }
+            }
+            aa->glyphs[picked[i]].state = ready ? ASYNC_GLYPH_READY : ASYNC_GLYPH_MISSING;
+            aa->version++;
+        }
+    }
+    pthread_mutex_unlock(&aa->mutex);
+
+    delete[] picked;
+    delete[] fonts;
+    delete[] divisions;
+    delete[] charCodes;
+    delete[] bitmaps;
+    return 0;
+}
+
+//returns at once, the glyphs are built in the order given until text is queued.
+//the font data, pool and fallback chain in settings have to outlive the build
+void startAsyncFontAtlas(AsyncFontAtlas* aa, unsigned char* fontData, unsigned int totalCharacters, unsigned short* charCodes, FontAtlasSettings* settings = 0){
+    aa->settings = settings ? *settings : getDefaultFontAtlasSettings();
+    //building runs next to the frame, so timing stats would race with whoever reads them
+    aa->settings.stats = 0;
+    aa->fontData = fontData;
+    aa->version = 0;
+    aa->glyphs = 0;
+    aa->totalGlyphs = 0;
+    aa->glyphCapacity = 0;
+    aa->totalPending = 0;
+    aa->nextPriority = 1;
+    aa->cancelled = false;
+    initFontAtlas(&aa->atlas, fontData, getAsyncAtlasWidth(fontData, &aa->settings, totalCharacters), &aa->settings);
+    for(unsigned int i = 0; i < totalCharacters; i++){
+        if(findAsyncAtlasGlyph(aa, charCodes[i]) < 0){
+            addAsyncAtlasGlyph(aa, charCodes[i], 0);
+        }
+    }
+    //equal priorities go in request order
+    for(unsigned int i = 0; i < aa->totalGlyphs; i++){
+        aa->glyphs[i].priority = aa->totalGlyphs - i;
+    }
+    aa->nextPriority = aa->totalGlyphs + 1;
+
+    pthread_mutex_init(&aa->mutex, 0);
+    pthread_cond_init(&aa->workCond, 0);
+    pthread_cond_init(&aa->doneCond, 0);
+    pthread_create(&aa->thread, 0, asyncFontAtlasWorker, aa);
+}
+
+//moves the characters of text to the front of the queue, adding any that weren't requested.
+//earlier characters of the text are built first
+void queueAsyncFontAtlasText(AsyncFontAtlas* aa, const char* text){
+    unsigned int length = 0;
+    for(const char* t = text; *t != '\0'; length++){
+        decodeUtf8(&t);
+    }
+    pthread_mutex_lock(&aa->mutex);
+    unsigned int priority = aa->nextPriority + length;
+    aa->nextPriority = priority + 1;
+    bool added = false;
+    while(*text != '\0'){
+        unsigned int c = decodeUtf8(&text);
+        priority--;
+        if(c > 0xffff){
+            continue;
+        }
+        int i = findAsyncAtlasGlyph(aa, c);
+        if(i < 0){
+            addAsyncAtlasGlyph(aa, c, priority);
+            added = true;
+        }else if(aa->glyphs[i].state == ASYNC_GLYPH_PENDING && aa->glyphs[i].priority < priority){
+            aa->glyphs[i].priority = priority;
+        }
+    }
+    if(added){
+        pthread_cond_signal(&aa->workCond);
+    }
+    pthread_mutex_unlock(&aa->mutex);
+}
+
+AsyncGlyphState getAsyncFontAtlasGlyphState(AsyncFontAtlas* aa, unsigned short charCode){
+    pthread_mutex_lock(&aa->mutex);
+    int i = findAsyncAtlasGlyph(aa, charCode);
+    AsyncGlyphState state = i >= 0 ? aa->glyphs[i].state : ASYNC_GLYPH_MISSING;
+    pthread_mutex_unlock(&aa->mutex);
+    return state;
+}
+
+//true once every character of text is in the atlas or known to be missing, so it will lay out
+//the same in every later snapshot
+bool isAsyncFontAtlasTextReady(AsyncFontAtlas* aa, const char* text){
+    bool ready = true;
+    pthread_mutex_lock(&aa->mutex);
+    while(ready && *text != '\0'){
+        unsigned int c = decodeUtf8(&text);
+        int i = c <= 0xffff ? findAsyncAtlasGlyph(aa, c) : -1;
+        ready = i < 0 || aa->glyphs[i].state == ASYNC_GLYPH_READY || aa->glyphs[i].state == ASYNC_GLYPH_MISSING;
+    }
+    pthread_mutex_unlock(&aa->mutex);
+    return ready;
+}
+
+//finished counts ready and missing glyphs
+void getAsyncFontAtlasProgress(AsyncFontAtlas* aa, unsigned int* finished, unsigned int* total){
+    pthread_mutex_lock(&aa->mutex);
+    *finished = aa->version;
+    *total = aa->totalGlyphs;
+    pthread_mutex_unlock(&aa->mutex);
+}
+
+//copies the atlas into snapshot if it changed since version, which is updated. snapshot must
+//start zeroed and is replaced each time, free it with clearFontAtlas once done. its dirty regions
+//are the texels changed since the last snapshot, plus any the caller didn't clear
+bool updateAsyncFontAtlasSnapshot(AsyncFontAtlas* aa, FontAtlas* snapshot, unsigned int* version){
+    pthread_mutex_lock(&aa->mutex);
+    if(aa->version == *version && snapshot->bitmap){
+        pthread_mutex_unlock(&aa->mutex);
+        return false;
+    }
+    AtlasRegion unsent[FONT_ATLAS_MAX_DIRTY_REGIONS];
+    unsigned int totalUnsent = snapshot->totalDirtyRegions;
+    for(unsigned int i = 0; i < totalUnsent; i++){
+        unsent[i] = snapshot->dirtyRegions[i];
+    }
+    if(snapshot->bitmap || snapshot->characterCodes){
+        clearFontAtlas(snapshot);
+    }
+    copyFontAtlas(snapshot, &aa->atlas);
+    clearFontAtlasDirtyRegions(&aa->atlas);
+    for(unsigned int i = 0; i < totalUnsent; i++){
+        markFontAtlasRegionDirty(snapshot, unsent[i].x, unsent[i].y, unsent[i].width, unsent[i].height);
+    }
+    *version = aa->version;
+    pthread_mutex_unlock(&aa->mutex);
+    return true;
+}
+
+void waitForAsyncFontAtlas(AsyncFontAtlas* aa){
+    pthread_mutex_lock(&aa->mutex);
+    while(aa->version < aa->totalGlyphs){
+        pthread_cond_wait(&aa->doneCond, &aa->mutex);
+    }
+    pthread_mutex_unlock(&aa->mutex);
+}
+
+//stops after the glyphs being rasterized, anything still queued is dropped
+void destroyAsyncFontAtlas(AsyncFontAtlas* aa){
+    pthread_mutex_lock(&aa->mutex);
+    aa->cancelled = true;
+    pthread_cond_broadcast(&aa->workCond);
+    pthread_mutex_unlock(&aa->mutex);
+    pthread_join(aa->thread, 0);
+
+    clearFontAtlas(&aa->atlas);
+    if(aa->glyphs) delete[] aa->glyphs;
+    aa->glyphs = 0;
+    aa->totalGlyphs = 0;
+    pthread_mutex_destroy(&aa->mutex);
+    pthread_cond_destroy(&aa->workCond);
+    pthread_cond_destroy(&aa->doneCond);
+}
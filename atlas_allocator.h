@@ -0,0 +1,125 @@
+#pragma once
+
+#include <new>
+
+//memory for atlases and the glyphs decoded into them comes from an allocator, so it can be
+//counted per atlas or taken from a pool. a null allocator is the heap. atlases are built on the
+//thread pool's workers, so allocate and release may be called from several threads at once
+struct AtlasAllocator{
+    void* (*allocate)(void* user, unsigned long size);
+    //memory comes back without its size, allocators that need it keep it themselves
+    void (*release)(void* user, void* memory);
+    void* user;
+};
+
+static void* allocateHeapAtlasMemory(void* user, unsigned long size){
+    return new unsigned char[size ? size : 1];
+}
+
+static void releaseHeapAtlasMemory(void* user, void* memory){
+    delete[] (unsigned char*)memory;
+}
+
+//new[] and delete[] underneath, so code that frees bitmaps itself keeps working with it
+AtlasAllocator* getHeapAtlasAllocator(){
+    static AtlasAllocator heap = {allocateHeapAtlasMemory, releaseHeapAtlasMemory, 0};
+    return &heap;
+}
+
+void* allocateAtlasMemory(AtlasAllocator* allocator, unsigned long size){
+    if(!allocator){
+        allocator = getHeapAtlasAllocator();
+    }
+    return allocator->allocate(allocator->user, size);
+}
+
+void releaseAtlasMemory(AtlasAllocator* allocator, void* memory){
+    if(!memory){
+        return;
+    }
+    if(!allocator){
+        allocator = getHeapAtlasAllocator();
+    }
+    allocator->release(allocator->user, memory);
+}
+
+//arrays are left uninitialized like new[] of plain types
+template<typename T>
+T* allocateAtlasArray(AtlasAllocator* allocator, unsigned long count){
+    return (T*)allocateAtlasMemory(allocator, count * sizeof(T));
+}
+
+template<typename T>
+T* newAtlasObject(AtlasAllocator* allocator){
+    return new (allocateAtlasMemory(allocator, sizeof(T))) T();
+}
+
+template<typename T>
+void deleteAtlasObject(AtlasAllocator* allocator, T* object){
+    if(object){
+        object->~T();
+        releaseAtlasMemory(allocator, object);
+    }
+}
+
+//counts what passes through to parent. every block carries its size in a header in front of it,
+//16 bytes so the memory handed out keeps the parent's alignment
+struct TrackingAllocator{
+    AtlasAllocator allocator;
+    AtlasAllocator* parent;
+    unsigned long liveBytes;
+    unsigned long peakBytes;
+    unsigned long liveAllocations;
+    unsigned long totalAllocations;
+    unsigned long totalBytes;
+};
+
+static const unsigned long TRACKING_ALLOCATOR_HEADER = 16;
+
+static void* allocateTrackedAtlasMemory(void* user, unsigned long size){
+    TrackingAllocator* ta = (TrackingAllocator*)user;
+    unsigned char* block = (unsigned char*)allocateAtlasMemory(ta->parent, size + TRACKING_ALLOCATOR_HEADER);
+    if(!block){
+        return 0;
+    }
+    *(unsigned long*)block = size;
+    unsigned long live = __sync_add_and_fetch(&ta->liveBytes, size);
+    __sync_fetch_and_add(&ta->liveAllocations, 1);
+    __sync_fetch_and_add(&ta->totalAllocations, 1);
+    __sync_fetch_and_add(&ta->totalBytes, size);
+    unsigned long peak = ta->peakBytes;
+    while(live > peak){
+        if(__sync_bool_compare_and_swap(&ta->peakBytes, peak, live)){
+            break;
+        }
+        peak = ta->peakBytes;
+    }
+    return block + TRACKING_ALLOCATOR_HEADER;
+}
+
+static void releaseTrackedAtlasMemory(void* user, void* memory){
+    TrackingAllocator* ta = (TrackingAllocator*)user;
+    unsigned char* block = (unsigned char*)memory - TRACKING_ALLOCATOR_HEADER;
+    __sync_fetch_and_sub(&ta->liveBytes, *(unsigned long*)block);
+    __sync_fetch_and_sub(&ta->liveAllocations, 1);
+    releaseAtlasMemory(ta->parent, block);
+}
+
+//parent 0 takes the memory from the heap. pass &ta->allocator wherever an allocator goes, one
+//tracker per atlas gives its live and peak bytes. the tracker must outlive the memory it handed out
+void initTrackingAllocator(TrackingAllocator* ta, AtlasAllocator* parent = 0){
+    ta->allocator.allocate = allocateTrackedAtlasMemory;
+    ta->allocator.release = releaseTrackedAtlasMemory;
+    ta->allocator.user = ta;
+    ta->parent = parent;
+    ta->liveBytes = 0;
+    ta->peakBytes = 0;
+    ta->liveAllocations = 0;
+    ta->totalAllocations = 0;
+    ta->totalBytes = 0;
+}
+
+//starts a new peak from what is live now, to measure one phase like a rebuild on its own
+void resetTrackingAllocatorPeak(TrackingAllocator* ta){
+    ta->peakBytes = ta->liveBytes;
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <string.h>
+
+#include "font_atlas.h"
+#include "thread_pool.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//bc4 stores each 4x4 block of a single channel image in 8 bytes: two endpoints followed by
+//sixteen 3 bit palette indices, least significant bits first. blocks follow the row order of
+//the source buffer, so the atlas keeps its bottom row first exactly like the uncompressed upload
+
+static const unsigned int BC4_BLOCK_BYTES = 8;
+
+enum Bc4Quality{
+    //min and max endpoints, eight value palette only
+    BC4_QUALITY_FAST,
+    //also tries the six value palette with exact 0 and 255, which suits antialiased glyph edges
+    BC4_QUALITY_NORMAL,
+    //also searches endpoints a few steps inside the block range
+    BC4_QUALITY_HIGH
+};
+
+struct CompressedBitmap{
+    unsigned int width;
+    unsigned int height;
+    unsigned int blocksWide;
+    unsigned int blocksHigh;
+    unsigned char* blocks;
+};
+
+void initCompressedBitmap(CompressedBitmap* cb, unsigned int width, unsigned int height){
+    cb->width = width;
+    cb->height = height;
+    cb->blocksWide = (width + 3) / 4;
+    cb->blocksHigh = (height + 3) / 4;
+    cb->blocks = new unsigned char[cb->blocksWide * cb->blocksHigh * BC4_BLOCK_BYTES];
+    memset(cb->blocks, 0, cb->blocksWide * cb->blocksHigh * BC4_BLOCK_BYTES);
+}
+
+void freeCompressedBitmap(CompressedBitmap* cb){
+    if(cb->blocks) delete[] cb->blocks;
+    cb->blocks = 0;
+    cb->width = 0;
+    cb->height = 0;
+    cb->blocksWide = 0;
+    cb->blocksHigh = 0;
+}
+
+unsigned int getCompressedBitmapSize(CompressedBitmap* cb){
+    return cb->blocksWide * cb->blocksHigh * BC4_BLOCK_BYTES;
+}
+
+static void getBc4Palette(unsigned char red0, unsigned char red1, unsigned char* palette){
+    palette[0] = red0;
+    palette[1] = red1;
+    if(red0 > red1){
+        for(int i = 1; i < 7; i++){
+            palette[i + 1] = (((7 - i) * red0) + (i * red1) + 3) / 7;
+        }
+    }else{
+        for(int i = 1; i < 5; i++){
+            palette[i + 1] = (((5 - i) * red0) + (i * red1) + 2) / 5;
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+//picks the nearest palette entry for every texel, ties going to the lower index, and returns the squared error
+static unsigned int findBc4Indices(unsigned char* texels, unsigned char* palette, unsigned char* indices){
+#if defined(__SSE2__)
+    __m128i t = _mm_loadu_si128((__m128i*)texels);
+    __m128i best = _mm_set1_epi8((char)0xff);
+    __m128i bestIndex = _mm_setzero_si128();
+    __m128i allOnes = _mm_set1_epi8((char)0xff);
+    for(int i = 0; i < 8; i++){
+        __m128i p = _mm_set1_epi8((char)palette[i]);
+        __m128i d = _mm_or_si128(_mm_subs_epu8(t, p), _mm_subs_epu8(p, t));
+        __m128i closer = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_max_epu8(d, best), d), allOnes);
+        best = _mm_min_epu8(best, d);
+        bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex), _mm_and_si128(closer, _mm_set1_epi8((char)i)));
+    }
+    _mm_storeu_si128((__m128i*)indices, bestIndex);
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(best, zero);
+    __m128i hi = _mm_unpackhi_epi8(best, zero);
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (unsigned int)_mm_cvtsi128_si32(sum);
+#else
+    unsigned int error = 0;
+    for(int j = 0; j < 16; j++){
+        unsigned int best = 255;
+        unsigned char bestIndex = 0;
+        for(int i = 0; i < 8; i++){
+            unsigned int d = texels[j] > palette[i] ? texels[j] - palette[i] : palette[i] - texels[j];
+            if(d < best){
+                best = d;
+                bestIndex = i;
+            }
+        }
+        indices[j] = bestIndex;
+        error += best * best;
+    }
+    return error;
+#endif
+}
+
+static unsigned int tryBc4Endpoints(unsigned char* texels, unsigned char red0, unsigned char red1, unsigned char* indices){
+    unsigned char palette[8];
+    getBc4Palette(red0, red1, palette);
+    return findBc4Indices(texels, palette, indices);
+}
+
+static void getBc4Range(unsigned char* texels, unsigned char* minValue, unsigned char* maxValue){
+#if defined(__SSE2__)
+    __m128i t = _mm_loadu_si128((__m128i*)texels);
+    __m128i lo = t;
+    __m128i hi = t;
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 8));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 8));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 2));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 2));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 1));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 1));
+    *minValue = (unsigned char)_mm_cvtsi128_si32(lo);
+    *maxValue = (unsigned char)_mm_cvtsi128_si32(hi);
+#else
+    *minValue = 255;
+    *maxValue = 0;
+    for(int i = 0; i < 16; i++){
+        if(texels[i] < *minValue) *minValue = texels[i];
+        if(texels[i] > *maxValue) *maxValue = texels[i];
+    }
+#endif
+}
+
+//range of the texels the six value palette can't hit exactly, 255 and 0 when there are none
+static void getBc4InnerRange(unsigned char* texels, unsigned char* minValue, unsigned char* maxValue){
+    *minValue = 255;
+    *maxValue = 0;
+    for(int i = 0; i < 16; i++){
+        if(texels[i] == 0 || texels[i] == 255){
+            continue;
+        }
+        if(texels[i] < *minValue) *minValue = texels[i];
+        if(texels[i] > *maxValue) *maxValue = texels[i];
+    }
+}
+
+void encodeBc4Block(unsigned char* texels, unsigned char* block, Bc4Quality quality){
+    unsigned char minValue, maxValue;
+    getBc4Range(texels, &minValue, &maxValue);
+
+    unsigned char bestRed0 = maxValue;
+    unsigned char bestRed1 = minValue;
+    unsigned char bestIndices[16];
+    unsigned char indices[16];
+    unsigned int bestError;
+    if(minValue == maxValue){
+        memset(bestIndices, 0, 16);
+        bestError = 0;
+    }else{
+        bestError = tryBc4Endpoints(texels, maxValue, minValue, bestIndices);
+    }
+
+    if(bestError > 0 && quality >= BC4_QUALITY_NORMAL){
+        unsigned char innerMin, innerMax;
+        getBc4InnerRange(texels, &innerMin, &innerMax);
+        if(innerMin > innerMax){
+            innerMin = innerMax = 0;
+        }
+        unsigned int error = tryBc4Endpoints(texels, innerMin, innerMax, indices);
+        if(error < bestError){
+            bestError = error;
+            bestRed0 = innerMin;
+            bestRed1 = innerMax;
+            memcpy(bestIndices, indices, 16);
+        }
+
+        if(bestError > 0 && quality >= BC4_QUALITY_HIGH){
+            static const int STEPS = 4;
+            for(int i = 0; i <= STEPS && bestError > 0; i++){
+                for(int j = 0; j <= STEPS && bestError > 0; j++){
+                    if(maxValue - i > minValue + j){
+                        unsigned char red0 = maxValue - i;
+                        unsigned char red1 = minValue + j;
+                        error = tryBc4Endpoints(texels, red0, red1, indices);
+                        if(error < bestError){
+                            bestError = error;
+                            bestRed0 = red0;
+                            bestRed1 = red1;
+                            memcpy(bestIndices, indices, 16);
+                        }
+                    }
+                    if(innerMin + i < innerMax - j){
+                        unsigned char red0 = innerMin + i;
+                        unsigned char red1 = innerMax - j;
+                        error = tryBc4Endpoints(texels, red0, red1, indices);
+                        if(error < bestError){
+                            bestError = error;
+                            bestRed0 = red0;
+                            bestRed1 = red1;
+                            memcpy(bestIndices, indices, 16);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    block[0] = bestRed0;
+    block[1] = bestRed1;
+    unsigned long bits = 0;
+    for(int i = 0; i < 16; i++){
+        bits |= (unsigned long)bestIndices[i] << (3 * i);
+    }
+    for(int i = 0; i < 6; i++){
+        block[i + 2] = (unsigned char)(bits >> (8 * i));
+    }
+}
+
+void decodeBc4Block(unsigned char* block, unsigned char* texels){
+    unsigned char palette[8];
+    getBc4Palette(block[0], block[1], palette);
+    unsigned long bits = 0;
+    for(int i = 0; i < 6; i++){
+        bits |= (unsigned long)block[i + 2] << (8 * i);
+    }
+    for(int i = 0; i < 16; i++){
+        texels[i] = palette[(bits >> (3 * i)) & 7];
+    }
+}
+
+struct Bc4EncodeJob{
+    CompressedBitmap* cb;
+    unsigned char* bitmap;
+    unsigned int blockLeft;
+    unsigned int blockRight;
+    unsigned int blockBottom;
+    Bc4Quality quality;
+};
+
+//one block row per task, edge blocks repeat the last row and column of the image
+static void encodeBc4BlockRow(void* data, unsigned int index){
+    Bc4EncodeJob* job = (Bc4EncodeJob*)data;
+    CompressedBitmap* cb = job->cb;
+    unsigned int by = job->blockBottom + index;
+    unsigned char texels[16];
+    for(unsigned int bx = job->blockLeft; bx < job->blockRight; bx++){
+        for(unsigned int j = 0; j < 4; j++){
+            unsigned int y = (by * 4) + j;
+            if(y >= cb->height) y = cb->height - 1;
+            unsigned char* row = &job->bitmap[y * cb->width];
+            if((bx * 4) + 4 <= cb->width){
+                memcpy(&texels[j * 4], &row[bx * 4], 4);
+            }else{
+                for(unsigned int i = 0; i < 4; i++){
+                    unsigned int x = (bx * 4) + i;
+                    texels[(j * 4) + i] = row[x < cb->width ? x : cb->width - 1];
+                }
+            }
+        }
+        encodeBc4Block(texels, &cb->blocks[((by * cb->blocksWide) + bx) * BC4_BLOCK_BYTES], job->quality);
+    }
+}
+
+//re-encodes every block touching the rectangle, so dirty glyphs don't cost a whole atlas
+void compressBc4Region(CompressedBitmap* cb, unsigned char* bitmap, unsigned int x, unsigned int y, unsigned int width, unsigned int height, Bc4Quality quality, ThreadPool* pool){
+    if(width == 0 || height == 0 || x >= cb->width || y >= cb->height){
+        return;
+    }
+    if(x + width > cb->width) width = cb->width - x;
+    if(y + height > cb->height) height = cb->height - y;
+
+    Bc4EncodeJob job;
+    job.cb = cb;
+    job.bitmap = bitmap;
+    job.blockLeft = x / 4;
+    job.blockRight = (x + width + 3) / 4;
+    job.blockBottom = y / 4;
+    job.quality = quality;
+    runParallel(pool, encodeBc4BlockRow, &job, ((y + height + 3) / 4) - job.blockBottom);
+}
+
+void compressBc4(CompressedBitmap* cb, unsigned char* bitmap, unsigned int width, unsigned int height, Bc4Quality quality, ThreadPool* pool){
+    initCompressedBitmap(cb, width, height);
+    compressBc4Region(cb, bitmap, 0, 0, width, height, quality, pool);
+}
+
+void compressFontAtlasBc4(CompressedBitmap* cb, FontAtlas* fa, Bc4Quality quality, ThreadPool* pool){
+    compressBc4(cb, fa->bitmap, fa->totalBitmapWidth, fa->totalBitmapHeight, quality, pool);
+}
+
+//writes width * height texels, dropping the padding of partial edge blocks
+void decompressBc4(CompressedBitmap* cb, unsigned char* bitmap){
+    unsigned char texels[16];
+    for(unsigned int by = 0; by < cb->blocksHigh; by++){
+        for(unsigned int bx = 0; bx < cb->blocksWide; bx++){
+            decodeBc4Block(&cb->blocks[((by * cb->blocksWide) + bx) * BC4_BLOCK_BYTES], texels);
+            for(unsigned int j = 0; j < 4 && (by * 4) + j < cb->height; j++){
+                for(unsigned int i = 0; i < 4 && (bx * 4) + i < cb->width; i++){
+                    bitmap[(((by * 4) + j) * cb->width) + (bx * 4) + i] = texels[(j * 4) + i];
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <math.h>
+#include <string.h>
+
+#include "font_atlas.h"
+#include "atlas_allocator.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//every level is filtered one glyph at a time from the level above it. texels outside the
+//glyph's own rectangle read as empty, so neighbours never bleed into each other as long as
+//the atlas was packed with a gutter of at least 1 << (levels - 2) pixels
+
+static const unsigned int KAISER_TAPS = 8;
+
+struct MipRect{
+    unsigned int left;
+    unsigned int right;
+    unsigned int bottom;
+    unsigned int top;
+};
+
+static MipRect getGlyphMipRect(FontAtlas* fa, unsigned int glyph, unsigned int level){
+    MipRect r;
+    r.left = fa->xOffsets[glyph];
+    r.right = fa->xOffsets[glyph] + fa->widths[glyph];
+    r.bottom = fa->yOffsets[glyph];
+    r.top = fa->yOffsets[glyph] + fa->heights[glyph];
+    for(unsigned int i = 0; i < level; i++){
+        r.left >>= 1;
+        r.bottom >>= 1;
+        r.right = (r.right + 1) >> 1;
+        r.top = (r.top + 1) >> 1;
+    }
+    return r;
+}
+
+static unsigned char* getMipLevelBitmap(FontAtlas* fa, unsigned int level){
+    return level == 0 ? fa->bitmap : fa->mipBitmaps[level];
+}
+
+static unsigned int getMipLevelWidth(FontAtlas* fa, unsigned int level){
+    return level == 0 ? fa->totalBitmapWidth : fa->mipWidths[level];
+}
+
+static unsigned int getMipLevelHeight(FontAtlas* fa, unsigned int level){
+    return level == 0 ? fa->totalBitmapHeight : fa->mipHeights[level];
+}
+
+//weights of a kaiser windowed sinc halving the resolution, applied to texels 2x - 3 .. 2x + 4
+static void getKaiserWeights(float* weights){
+    static const float ALPHA = 4.0f;
+    float total = 0;
+    for(int i = 0; i < KAISER_TAPS; i++){
+        float x = (float)i - 3.5f;
+        float t = x / 4.0f;
+        float sinc = sinf(M_PI * x * 0.5f) / (M_PI * x * 0.5f);
+
+        //zeroth order modified bessel function for the window
+        float arg = ALPHA * sqrtf(1.0f - (t * t));
+        float i0 = 1, term = 1, i0a = 1, terma = 1;
+        for(int k = 1; k < 12; k++){
+            term *= (arg / (2.0f * k)) * (arg / (2.0f * k));
+            terma *= (ALPHA / (2.0f * k)) * (ALPHA / (2.0f * k));
+            i0 += term;
+            i0a += terma;
+        }
+        weights[i] = sinc * (i0 / i0a);
+        total += weights[i];
+    }
+    for(int i = 0; i < KAISER_TAPS; i++){
+        weights[i] /= total;
+    }
+}
+
+static void boxFilterGlyphLevel(FontAtlas* fa, unsigned int glyph, unsigned int level, unsigned char* zeroRow){
+    MipRect src = getGlyphMipRect(fa, glyph, level - 1);
+    MipRect dst = getGlyphMipRect(fa, glyph, level);
+    unsigned char* srcBitmap = getMipLevelBitmap(fa, level - 1);
+    unsigned int srcWidth = getMipLevelWidth(fa, level - 1);
+    unsigned char* dstBitmap = getMipLevelBitmap(fa, level);
+    unsigned int dstWidth = getMipLevelWidth(fa, level);
+
+    for(unsigned int y = dst.bottom; y < dst.top; y++){
+        unsigned int sy = y * 2;
+        unsigned char* row0 = sy >= src.bottom && sy < src.top ? &srcBitmap[sy * srcWidth] : zeroRow;
+        unsigned char* row1 = sy + 1 >= src.bottom && sy + 1 < src.top ? &srcBitmap[(sy + 1) * srcWidth] : zeroRow;
+        unsigned char* out = &dstBitmap[y * dstWidth];
+
+        unsigned int x = dst.left;
+        if(x * 2 < src.left){
+            unsigned int sum = row0[(x * 2) + 1] + row1[(x * 2) + 1];
+            out[x++] = (sum + 2) >> 2;
+        }
+        unsigned int interiorEnd = src.right / 2;
+#if defined(__SSE2__)
+        __m128i zero = _mm_setzero_si128();
+        __m128i ones = _mm_set1_epi16(1);
+        __m128i bias = _mm_set1_epi32(2);
+        for(; x + 8 <= interiorEnd; x += 8){
+            __m128i a = _mm_loadu_si128((__m128i*)&row0[x * 2]);
+            __m128i b = _mm_loadu_si128((__m128i*)&row1[x * 2]);
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            lo = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(lo, ones), bias), 2);
+            hi = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(hi, ones), bias), 2);
+            __m128i packed = _mm_packs_epi32(lo, hi);
+            _mm_storel_epi64((__m128i*)&out[x], _mm_packus_epi16(packed, zero));
+        }
+#endif
+        for(; x < interiorEnd; x++){
+            unsigned int sum = row0[x * 2] + row0[(x * 2) + 1] + row1[x * 2] + row1[(x * 2) + 1];
+            out[x] = (sum + 2) >> 2;
+        }
+        if(x < dst.right){
+            unsigned int sum = row0[x * 2] + row1[x * 2];
+            out[x] = (sum + 2) >> 2;
+        }
+    }
+}
+
+static void kaiserFilterGlyphLevel(FontAtlas* fa, unsigned int glyph, unsigned int level, float* weights){
+    MipRect src = getGlyphMipRect(fa, glyph, level - 1);
+    MipRect dst = getGlyphMipRect(fa, glyph, level);
+    unsigned char* srcBitmap = getMipLevelBitmap(fa, level - 1);
+    unsigned int srcWidth = getMipLevelWidth(fa, level - 1);
+    unsigned char* dstBitmap = getMipLevelBitmap(fa, level);
+    unsigned int dstWidth = getMipLevelWidth(fa, level);
+
+    //horizontal pass over every source row the vertical taps can reach, padded with empty rows
+    unsigned int outWidth = dst.right - dst.left;
+    unsigned int rowStart = dst.bottom * 2;
+    unsigned int totalRows = ((dst.top - dst.bottom) * 2) + KAISER_TAPS;
+    unsigned int stride = (outWidth + 3) & ~3u;
+    float* temp = allocateAtlasArray<float>(fa->allocator, totalRows * stride);
+    memset(temp, 0, sizeof(float) * totalRows * stride);
+
+    for(unsigned int r = 0; r < totalRows; r++){
+        int sy = (int)(rowStart + r) - 3;
+        if(sy < (int)src.bottom || sy >= (int)src.top){
+            continue;
+        }
+        unsigned char* row = &srcBitmap[sy * srcWidth];
+        float* out = &temp[r * stride];
+        for(unsigned int x = 0; x < outWidth; x++){
+            int sx = (int)((dst.left + x) * 2) - 3;
+            float sum = 0;
+            for(int k = 0; k < KAISER_TAPS; k++){
+                if(sx + k >= (int)src.left && sx + k < (int)src.right){
+                    sum += weights[k] * row[sx + k];
+                }
+            }
+            out[x] = sum;
+        }
+    }
+
+    for(unsigned int y = dst.bottom; y < dst.top; y++){
+        unsigned char* out = &dstBitmap[(y * dstWidth) + dst.left];
+        float* base = &temp[(y - dst.bottom) * 2 * stride];
+        unsigned int x = 0;
+#if defined(__SSE2__)
+        __m128 lowest = _mm_setzero_ps();
+        __m128 highest = _mm_set1_ps(255.0f);
+        __m128 half = _mm_set1_ps(0.5f);
+        for(; x + 4 <= outWidth; x += 4){
+            __m128 sum = _mm_setzero_ps();
+            for(int k = 0; k < KAISER_TAPS; k++){
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(&base[(k * stride) + x])));
+            }
+            sum = _mm_min_ps(_mm_max_ps(_mm_add_ps(sum, half), lowest), highest);
+            __m128i v = _mm_cvttps_epi32(sum);
+            v = _mm_packs_epi32(v, v);
+            v = _mm_packus_epi16(v, v);
+            int packed = _mm_cvtsi128_si32(v);
+            memcpy(&out[x], &packed, 4);
+        }
+#endif
+        for(; x < outWidth; x++){
+            float sum = 0;
+            for(int k = 0; k < KAISER_TAPS; k++){
+                sum += weights[k] * base[(k * stride) + x];
+            }
+            sum += 0.5f;
+            out[x] = sum < 0 ? 0 : (sum > 255 ? 255 : (unsigned char)sum);
+        }
+    }
+
+    releaseAtlasMemory(fa->allocator, temp);
+}
+
+static void filterGlyphMipChain(FontAtlas* fa, unsigned int glyph, unsigned char* zeroRow, float* weights){
+    if(fa->widths[glyph] == 0 || fa->heights[glyph] == 0){
+        return;
+    }
+    for(unsigned int level = 1; level < fa->totalMipLevels; level++){
+        if(fa->mipFilter == MIPMAP_FILTER_KAISER){
+            kaiserFilterGlyphLevel(fa, glyph, level, weights);
+        }else{
+            boxFilterGlyphLevel(fa, glyph, level, zeroRow);
+        }
+    }
+}
+
+void freeFontAtlasMipmaps(FontAtlas* fa){
+    for(unsigned int i = 1; fa->mipBitmaps && i < fa->totalMipLevels; i++){
+        releaseAtlasMemory(fa->allocator, fa->mipBitmaps[i]);
+    }
+    releaseAtlasMemory(fa->allocator, fa->mipBitmaps);
+    releaseAtlasMemory(fa->allocator, fa->mipWidths);
+    releaseAtlasMemory(fa->allocator, fa->mipHeights);
+    fa->mipBitmaps = 0;
+    fa->mipWidths = 0;
+    fa->mipHeights = 0;
+    fa->totalMipLevels = 1;
+}
+
+//levels counts the base bitmap, and the chain stops early once a level would be 1x1
+void generateFontAtlasMipmaps(FontAtlas* fa, unsigned int levels, MipmapFilter filter){
+    freeFontAtlasMipmaps(fa);
+
+    unsigned int w = fa->totalBitmapWidth;
+    unsigned int h = fa->totalBitmapHeight;
+    unsigned int totalLevels = 1;
+    while(totalLevels < levels && (w > 1 || h > 1)){
+        w = w > 1 ? (w + 1) >> 1 : 1;
+        h = h > 1 ? (h + 1) >> 1 : 1;
+        totalLevels++;
+    }
+
+    fa->mipFilter = filter;
+    fa->totalMipLevels = totalLevels;
+    fa->mipBitmaps = allocateAtlasArray<unsigned char*>(fa->allocator, totalLevels);
+    fa->mipWidths = allocateAtlasArray<unsigned int>(fa->allocator, totalLevels);
+    fa->mipHeights = allocateAtlasArray<unsigned int>(fa->allocator, totalLevels);
+    fa->mipBitmaps[0] = 0;
+    fa->mipWidths[0] = fa->totalBitmapWidth;
+    fa->mipHeights[0] = fa->totalBitmapHeight;
+    for(unsigned int i = 1; i < totalLevels; i++){
+        fa->mipWidths[i] = fa->mipWidths[i - 1] > 1 ? (fa->mipWidths[i - 1] + 1) >> 1 : 1;
+        fa->mipHeights[i] = fa->mipHeights[i - 1] > 1 ? (fa->mipHeights[i - 1] + 1) >> 1 : 1;
+        fa->mipBitmaps[i] = allocateAtlasArray<unsigned char>(fa->allocator, fa->mipWidths[i] * fa->mipHeights[i]);
+        memset(fa->mipBitmaps[i], 0, fa->mipWidths[i] * fa->mipHeights[i]);
+    }
+
+    unsigned char* zeroRow = allocateAtlasArray<unsigned char>(fa->allocator, fa->totalBitmapWidth + 16);
+    memset(zeroRow, 0, fa->totalBitmapWidth + 16);
+    float weights[KAISER_TAPS];
+    getKaiserWeights(weights);
+    for(unsigned int i = 0; i < fa->totalCharacters; i++){
+        filterGlyphMipChain(fa, i, zeroRow, weights);
+    }
+    releaseAtlasMemory(fa->allocator, zeroRow);
+    markFontAtlasDirty(fa);
+}
+
+//refilters only the glyphs overlapping the dirty rectangle of the base level
+void updateFontAtlasMipmaps(FontAtlas* fa, unsigned int x, unsigned int y, unsigned int width, unsigned int height){
+    if(fa->totalMipLevels <= 1){
+        return;
+    }
+    if(fa->mipWidths[0] != fa->totalBitmapWidth || fa->mipHeights[0] != fa->totalBitmapHeight){
+        generateFontAtlasMipmaps(fa, fa->totalMipLevels, fa->mipFilter);
+        return;
+    }
+
+    unsigned char* zeroRow = allocateAtlasArray<unsigned char>(fa->allocator, fa->totalBitmapWidth + 16);
+    memset(zeroRow, 0, fa->totalBitmapWidth + 16);
+    float weights[KAISER_TAPS];
+    getKaiserWeights(weights);
+    for(unsigned int i = 0; i < fa->totalCharacters; i++){
+        if(fa->xOffsets[i] < x + width && fa->xOffsets[i] + fa->widths[i] > x &&
+           fa->yOffsets[i] < y + height && fa->yOffsets[i] + fa->heights[i] > y){
+            filterGlyphMipChain(fa, i, zeroRow, weights);
+        }
+    }
+    releaseAtlasMemory(fa->allocator, zeroRow);
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+//recording is compiled in only when TEXT_RENDERER_STATS is defined, otherwise
+//the ATLAS_STATS_* macros expand to nothing and a stats pointer is simply ignored
+
+enum AtlasBuildStage{
+    ATLAS_STAGE_PARSE,
+    ATLAS_STAGE_FLATTEN,
+    ATLAS_STAGE_RASTERIZE,
+    ATLAS_STAGE_SORT,
+    ATLAS_STAGE_PACK,
+    ATLAS_STAGE_BLIT,
+    ATLAS_STAGE_COUNT
+};
+
+static const char* ATLAS_STAGE_NAMES[ATLAS_STAGE_COUNT] = {
+    "parse",
+    "flatten",
+    "rasterize",
+    "sort",
+    "pack",
+    "blit"
+};
+
+struct AtlasTraceEvent{
+    unsigned int stage;
+    unsigned int thread;
+    unsigned int characterCode;
+    unsigned long start;
+    unsigned long end;
+};
+
+struct AtlasBuildStats{
+    //per glyph stages run on several threads, so their times are summed across threads
+    unsigned long stageNanoseconds[ATLAS_STAGE_COUNT];
+    unsigned long wallNanoseconds;
+    unsigned long totalGlyphs;
+    unsigned long totalEdges;
+    unsigned long totalPixels;
+    unsigned long totalSamples;
+    unsigned long allocatedBytes;
+    unsigned long packedArea;
+    unsigned long atlasArea;
+    //glyphs whose bitmap matched one already packed, and the texels that saved
+    unsigned long sharedGlyphs;
+    unsigned long sharedArea;
+    unsigned long maxGlyphEdges;
+    unsigned int maxEdgesCharacterCode;
+    unsigned long maxGlyphNanoseconds;
+    unsigned int slowestCharacterCode;
+    unsigned long origin;
+    AtlasTraceEvent* events;
+    unsigned int totalEvents;
+    unsigned int eventCapacity;
+};
+
+unsigned long getStatsNanoseconds(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((unsigned long)ts.tv_sec * 1000000000ul) + ts.tv_nsec;
+}
+
+static unsigned int getStatsThreadId(){
+    static unsigned int nextThreadId = 0;
+    static __thread unsigned int threadId = 0;
+    if(threadId == 0){
+        threadId = __sync_add_and_fetch(&nextThreadId, 1);
+    }
+    return threadId;
+}
+
+//maxTraceEvents of 0 keeps the counters but skips the chrome trace
+void initAtlasBuildStats(AtlasBuildStats* stats, unsigned int maxTraceEvents){
+    memset(stats, 0, sizeof(AtlasBuildStats));
+    stats->origin = getStatsNanoseconds();
+    stats->eventCapacity = maxTraceEvents;
+    stats->events = maxTraceEvents ? new AtlasTraceEvent[maxTraceEvents] : 0;
+}
+
+void freeAtlasBuildStats(AtlasBuildStats* stats){
+    if(stats->events){
+        delete[] stats->events;
+        stats->events = 0;
+    }
+    stats->totalEvents = 0;
+    stats->eventCapacity = 0;
+}
+
+float getAtlasPackingEfficiency(AtlasBuildStats* stats){
+    return stats->atlasArea ? (float)stats->packedArea / (float)stats->atlasArea : 0;
+}
+
+void recordAtlasStage(AtlasBuildStats* stats, unsigned int stage, unsigned long start, unsigned int characterCode){
+    if(!stats){
+        return;
+    }
+    unsigned long end = getStatsNanoseconds();
+    __sync_fetch_and_add(&stats->stageNanoseconds[stage], end - start);
+
+    if(stats->events){
+        unsigned int i = __sync_fetch_and_add(&stats->totalEvents, 1);
+        if(i < stats->eventCapacity){
+            AtlasTraceEvent* e = &stats->events[i];
+            e->stage = stage;
+            e->thread = getStatsThreadId();
+            e->characterCode = characterCode;
+            e->start = start;
+            e->end = end;
+        }
+    }
+}
+
+void recordAtlasGlyph(AtlasBuildStats* stats, unsigned int characterCode, unsigned long edges, unsigned long pixels, unsigned long samples, unsigned long bytes, unsigned long start){
+    if(!stats){
+        return;
+    }
+    unsigned long elapsed = getStatsNanoseconds() - start;
+    __sync_fetch_and_add(&stats->totalGlyphs, 1);
+    __sync_fetch_and_add(&stats->totalEdges, edges);
+    __sync_fetch_and_add(&stats->totalPixels, pixels);
+    __sync_fetch_and_add(&stats->totalSamples, samples);
+    __sync_fetch_and_add(&stats->allocatedBytes, bytes);
+
+    //outliers are rare, so a plain compare and swap loop is enough
+    unsigned long current = stats->maxGlyphEdges;
+    while(edges > current){
+        if(__sync_bool_compare_and_swap(&stats->maxGlyphEdges, current, edges)){
+            stats->maxEdgesCharacterCode = characterCode;
+            break;
+        }
+        current = stats->maxGlyphEdges;
+    }
+    current = stats->maxGlyphNanoseconds;
+    while(elapsed > current){
+        if(__sync_bool_compare_and_swap(&stats->maxGlyphNanoseconds, current, elapsed)){
+            stats->slowestCharacterCode = characterCode;
+            break;
+        }
+        current = stats->maxGlyphNanoseconds;
+    }
+}
+
+void writeAtlasBuildStatsJSON(AtlasBuildStats* stats, FILE* file){
+    fprintf(file, "{\n  \"stages_ns\": {");
+    for(int i = 0; i < ATLAS_STAGE_COUNT; i++){
+        fprintf(file, "%s\"%s\": %lu", i ? ", " : "", ATLAS_STAGE_NAMES[i], stats->stageNanoseconds[i]);
+    }
+    fprintf(file, "},\n");
+    fprintf(file, "  \"wall_ns\": %lu,\n", stats->wallNanoseconds);
+    fprintf(file, "  \"glyphs\": %lu,\n", stats->totalGlyphs);
+    fprintf(file, "  \"edges\": %lu,\n", stats->totalEdges);
+    fprintf(file, "  \"pixels\": %lu,\n", stats->totalPixels);
+    fprintf(file, "  \"samples\": %lu,\n", stats->totalSamples);
+    fprintf(file, "  \"allocated_bytes\": %lu,\n", stats->allocatedBytes);
+    fprintf(file, "  \"packed_area\": %lu,\n", stats->packedArea);
+    fprintf(file, "  \"atlas_area\": %lu,\n", stats->atlasArea);
+    fprintf(file, "  \"packing_efficiency\": %.4f,\n", getAtlasPackingEfficiency(stats));
+    fprintf(file, "  \"shared_glyphs\": %lu,\n", stats->sharedGlyphs);
+    fprintf(file, "  \"shared_area\": %lu,\n", stats->sharedArea);
+    fprintf(file, "  \"max_glyph_edges\": {\"char\": %u, \"edges\": %lu},\n", stats->maxEdgesCharacterCode, stats->maxGlyphEdges);
+    fprintf(file, "  \"slowest_glyph\": {\"char\": %u, \"ns\": %lu}\n", stats->slowestCharacterCode, stats->maxGlyphNanoseconds);
+    fprintf(file, "}\n");
+}
+
+//chrome://tracing and Perfetto both read this format
+void writeAtlasBuildTrace(AtlasBuildStats* stats, FILE* file){
+    unsigned int total = stats->totalEvents < stats->eventCapacity ? stats->totalEvents : stats->eventCapacity;
+    fprintf(file, "{\"traceEvents\": [");
+    for(unsigned int i = 0; i < total; i++){
+        AtlasTraceEvent* e = &stats->events[i];
+        fprintf(file, "%s\n  {\"name\": \"%s\", \"cat\": \"atlas\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"char\": %u}}",
+                i ? "," : "", ATLAS_STAGE_NAMES[e->stage], e->thread,
+                (e->start - stats->origin) / 1000.0, (e->end - e->start) / 1000.0, e->characterCode);
+    }
+    fprintf(file, "\n]}\n");
+}
+
+#ifdef TEXT_RENDERER_STATS
+#define ATLAS_STATS_START(name) unsigned long name = getStatsNanoseconds()
+#define ATLAS_STATS_STAGE(stats, stage, start, characterCode) recordAtlasStage(stats, stage, start, characterCode)
+#define ATLAS_STATS_GLYPH(stats, characterCode, edges, pixels, samples, bytes, start) recordAtlasGlyph(stats, characterCode, edges, pixels, samples, bytes, start)
+#define ATLAS_STATS_SET(stats, field, value) do{ if(stats){ (stats)->field = (value); } }while(0)
+#else
+#define ATLAS_STATS_START(name)
+#define ATLAS_STATS_STAGE(stats, stage, start, characterCode)
+#define ATLAS_STATS_GLYPH(stats, characterCode, edges, pixels, samples, bytes, start)
+#define ATLAS_STATS_SET(stats, field, value)
+#endif
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <string.h>
+
+#include "atlas_allocator.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//row copies into 8 bit coverage bitmaps, shared by the atlas builders. every row is converted or
+//copied in one go with the row addresses stepped by their pitch, so assembling a large atlas
+//costs about as much as moving its bytes
+
+enum BlitFormat{
+    //1 bit per pixel, most significant bit first, set bits become 255
+    BLIT_FORMAT_A1,
+    BLIT_FORMAT_A8,
+    //3 bytes per pixel, reduced to their luminance
+    BLIT_FORMAT_RGB8
+};
+
+//what happens to the padding around a blitted image
+enum BlitEdge{
+    BLIT_EDGE_NONE,
+    BLIT_EDGE_CLEAR,
+    //the image's outermost pixels are repeated out to the edge of the padding
+    BLIT_EDGE_EXTRUDE
+};
+
+struct BlitImage{
+    const unsigned char* bytes;
+    unsigned int width;
+    unsigned int height;
+    unsigned int rowPitch;
+    BlitFormat format;
+};
+
+static unsigned int getBlitRowBytes(unsigned int width, BlitFormat format){
+    if(format == BLIT_FORMAT_A1){
+        return (width + 7) / 8;
+    }else if(format == BLIT_FORMAT_RGB8){
+        return width * 3;
+    }
+    return width;
+}
+
+//rowPitch 0 means rows are packed with no spacing
+BlitImage genBlitImage(const unsigned char* bytes, unsigned int width, unsigned int height, BlitFormat format = BLIT_FORMAT_A8, unsigned int rowPitch = 0){
+    BlitImage image;
+    image.bytes = bytes;
+    image.width = width;
+    image.height = height;
+    image.format = format;
+    image.rowPitch = rowPitch ? rowPitch : getBlitRowBytes(width, format);
+    return image;
+}
+
+//cleared so the space between images never holds leftovers that filtering would pick up
+unsigned char* allocateBlitTarget(unsigned int width, unsigned int height, AtlasAllocator* allocator = 0){
+    unsigned long size = (unsigned long)width * height;
+    unsigned char* bytes = allocateAtlasArray<unsigned char>(allocator, size);
+    memset(bytes, 0, size);
+    return bytes;
+}
+
+static void expandBlitRowA1(unsigned char* dst, const unsigned char* src, unsigned int width){
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    const __m128i bitMask = _mm_setr_epi8((char)128, 64, 32, 16, 8, 4, 2, 1, (char)128, 64, 32, 16, 8, 4, 2, 1);
+    for(; i + 16 <= width; i += 16){
+        const unsigned char* s = &src[i / 8];
+        __m128i bits = _mm_unpacklo_epi64(_mm_set1_epi8((char)s[0]), _mm_set1_epi8((char)s[1]));
+        __m128i set = _mm_cmpeq_epi8(_mm_and_si128(bits, bitMask), bitMask);
+        _mm_storeu_si128((__m128i*)&dst[i], set);
+    }
+#endif
+    for(; i < width; i++){
+        dst[i] = (src[i / 8] >> (7 - (i % 8))) & 1 ? 255 : 0;
+    }
+}
+
+static void reduceBlitRowRgb8(unsigned char* dst, const unsigned char* src, unsigned int width){
+    for(unsigned int i = 0; i < width; i++){
+        const unsigned char* p = &src[i * 3];
+        dst[i] = (unsigned char)(((77 * p[0]) + (150 * p[1]) + (29 * p[2]) + 128) >> 8);
+    }
+}
+
+//width pixels of src in any format written as 8 bit coverage
+void convertBlitRow(unsigned char* dst, const unsigned char* src, unsigned int width, BlitFormat format){
+    if(format == BLIT_FORMAT_A1){
+        expandBlitRowA1(dst, src, width);
+    }else if(format == BLIT_FORMAT_RGB8){
+        reduceBlitRowRgb8(dst, src, width);
+    }else{
+        memcpy(dst, src, width);
+    }
+}
+
+//writes src with its first row at row y and first pixel at column x of dst, whose rows are
+//dstRowPitch bytes apart. the padding is the band of that many pixels around the image, which
+//must lie inside dst, it is left alone, cleared or filled with the image's edges
+void blitImage(unsigned char* dst, unsigned int dstRowPitch, unsigned int x, unsigned int y, BlitImage* src, unsigned int padding = 0, BlitEdge edge = BLIT_EDGE_NONE){
+    if(src->width == 0 || src->height == 0){
+        return;
+    }
+    if(edge == BLIT_EDGE_NONE){
+        padding = 0;
+    }
+    unsigned int paddedWidth = src->width + (2 * padding);
+    unsigned char* row = dst + ((unsigned long)y * dstRowPitch) + x;
+    const unsigned char* srcRow = src->bytes;
+    for(unsigned int i = 0; i < src->height; i++){
+        convertBlitRow(row, srcRow, src->width, src->format);
+        if(padding){
+            unsigned char left = edge == BLIT_EDGE_EXTRUDE ? row[0] : 0;
+            unsigned char right = edge == BLIT_EDGE_EXTRUDE ? row[src->width - 1] : 0;
+            memset(row - padding, left, padding);
+            memset(row + src->width, right, padding);
+        }
+        row += dstRowPitch;
+        srcRow += src->rowPitch;
+    }
+    if(padding == 0){
+        return;
+    }
+
+    //rows above and below take the whole padded width so the corners are covered too
+    unsigned char* first = dst + ((unsigned long)y * dstRowPitch) + x - padding;
+    unsigned char* last = first + ((unsigned long)(src->height - 1) * dstRowPitch);
+    for(unsigned int i = 1; i <= padding; i++){
+        unsigned char* below = first - ((unsigned long)i * dstRowPitch);
+        unsigned char* above = last + ((unsigned long)i * dstRowPitch);
+        if(edge == BLIT_EDGE_EXTRUDE){
+            memcpy(below, first, paddedWidth);
+            memcpy(above, last, paddedWidth);
+        }else{
+            memset(below, 0, paddedWidth);
+            memset(above, 0, paddedWidth);
+        }
+    }
+}
+
+//copies width by height pixels between two 8 bit bitmaps with their own pitches
+void blitRegion(unsigned char* dst, unsigned int dstRowPitch, const unsigned char* src, unsigned int srcRowPitch, unsigned int width, unsigned int height){
+    BlitImage image = genBlitImage(src, width, height, BLIT_FORMAT_A8, srcRowPitch);
+    blitImage(dst, dstRowPitch, 0, 0, &image);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "bitmap_blit.h"
+
 struct Bitmap {
     unsigned int width;
     unsigned int height;
@@ -46,7 +48,7 @@ struct RectangleList {
     
     RectangleList(){
         totalRects = 0;
-        rects = new Rectangle[0];
+        rects = 0;
     }
 
     void add(Rectangle r){
@@ -191,21 +193,37 @@ void clearNodeTree(RectNode* node){
 }
 
 void clearBitmapAtlas(BitmapAtlas* ba){
-    if(ba->bitmapData) delete ba->bitmapData;
-    if(ba->widths) delete ba->widths;
-    if(ba->widths) delete ba->heights;
-    if(ba->xOffsets) delete ba->xOffsets;
-    if(ba->yOffsets) delete ba->yOffsets;
+    if(ba->bitmapData) delete[] ba->bitmapData;
+    if(ba->widths) delete[] ba->widths;
+    if(ba->heights) delete[] ba->heights;
+    if(ba->xOffsets) delete[] ba->xOffsets;
+    if(ba->yOffsets) delete[] ba->yOffsets;
+    ba->bitmapData = 0;
+    ba->widths = 0;
+    ba->heights = 0;
+    ba->xOffsets = 0;
+    ba->yOffsets = 0;
 }
 
-BitmapAtlas createBitmapAtlas(Bitmap* bitmaps, unsigned int totalBitmaps){
+//padding pixels are kept around every bitmap, cleared or extruded from its edges so filtering
+//never picks up a neighbour
+BitmapAtlas createBitmapAtlas(Bitmap* bitmaps, unsigned int totalBitmaps, unsigned int padding = 0, BlitEdge edge = BLIT_EDGE_CLEAR){
     static const unsigned int MAX_SIZE = 375;
+    //packed at their padded size, the bytes still point at the unpadded pixels
+    for(int i = 0; i < totalBitmaps; i++){
+        bitmaps[i].width += 2 * padding;
+        bitmaps[i].height += 2 * padding;
+    }
     sortBitmapsByDescendingArea(bitmaps, totalBitmaps);
     RectNode* node = new RectNode;
     node->rect = Rectangle(0, MAX_SIZE, 0, MAX_SIZE);
     for(int i = 0; i < totalBitmaps; i++){
         node->add(bitmaps[i]);
     }
+    for(int i = 0; i < totalBitmaps; i++){
+        bitmaps[i].width -= 2 * padding;
+        bitmaps[i].height -= 2 * padding;
+    }
     RectangleList rects;
     flattenNodeTree(node, &rects);
     clearNodeTree(node);
@@ -219,10 +237,10 @@ BitmapAtlas createBitmapAtlas(Bitmap* bitmaps, unsigned int totalBitmaps){
     unsigned int totalWidth = 0;
     unsigned int totalHeight = 0;
     for(int i = 0; i < rects.totalRects; i++){
-        ba.widths[i] = rects.get(i).width;
-        ba.heights[i] = rects.get(i).height;
-        ba.xOffsets[i] = rects.get(i).left;
-        ba.yOffsets[i] = rects.get(i).bottom;
+        ba.widths[i] = rects.get(i).width - (2 * padding);
+        ba.heights[i] = rects.get(i).height - (2 * padding);
+        ba.xOffsets[i] = rects.get(i).left + padding;
+        ba.yOffsets[i] = rects.get(i).bottom + padding;
         if(rects.get(i).right > totalWidth){
             totalWidth = rects.get(i).right;
         }
@@ -231,16 +249,12 @@ BitmapAtlas createBitmapAtlas(Bitmap* bitmaps, unsigned int totalBitmaps){
         }
     }
 
-    unsigned char* bitmapData = new unsigned char[totalWidth * totalHeight];
+    unsigned char* bitmapData = allocateBlitTarget(totalWidth, totalHeight);
     for(int i = 0; i < rects.totalRects; i++){
-        Rectangle r = rects.get(i);
-        Bitmap b = rects.get(i).bitmap;
-        for(int j = r.bottom; j < r.top; j++){
-            for(int k = r.left; k < r.right; k++){
-                bitmapData[(j * totalWidth) + k] = b.bytes[((j - r.bottom) * b.width) + (k - r.left)];
-            }
-        }
+        BlitImage image = genBlitImage(rects.get(i).bitmap.bytes, ba.widths[i], ba.heights[i]);
+        blitImage(bitmapData, totalWidth, ba.xOffsets[i], ba.yOffsets[i], &image, padding, edge);
     }
+    rects.clear();
 
     ba.bitmapData = bitmapData;
     ba.totalWidth = totalWidth;
@@ -258,25 +272,12 @@ Bitmap combine2Bitmaps(Bitmap b1, Bitmap b2){
         result.height = b2.height;
     }
 
-    result.bytes = new unsigned char[result.width * result.height];
-
-    for(int i = 0; i < result.height; i++){
-        for(int j = 0; j < result.width; j++){
-            if(j < b1.width){
-                if(i < b1.height){
-                    result.bytes[(i * result.width) + j] = b1.bytes[(i * b1.width) + j];
-                }else{
-                    result.bytes[(i * result.width) + j] = 0;
-                }
-            }else{
-                if(i < b2.height){
-                    result.bytes[(i * result.width) + j] = b2.bytes[(i * b2.width) + (j - b1.width)];
-                }else{
-                    result.bytes[(i * result.width) + j] = 0;
-                }
-            }
-        }
-    }
+    //the rows below the shorter bitmap stay cleared
+    result.bytes = allocateBlitTarget(result.width, result.height);
+    BlitImage image1 = genBlitImage(b1.bytes, b1.width, b1.height);
+    BlitImage image2 = genBlitImage(b2.bytes, b2.width, b2.height);
+    blitImage(result.bytes, result.width, 0, 0, &image1);
+    blitImage(result.bytes, result.width, b1.width, 0, &image2);
     
     return result;
-}
\ No newline at end of file
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "font_atlas.h"
+#include "text_renderer.h"
+#include "text_layout.h"
+
+//layout index for documents too long to lay out in full, like log views. only the byte offset
+//where each hard line starts and the number of rows above it are kept, rows being the lines a
+//hard line wraps into. rows are whole numbers so positions stay exact for millions of lines,
+//and a scroll offset maps to its line with a binary search. glyph quads are generated only for
+//the rows in view plus an overscan, wrapping those lines again as they are drawn. scroll
+//offsets are doubles since a float can't address single pixels that far down
+
+struct DocumentLayout{
+    const char* text;
+    unsigned int textLength;
+    float boxWidth;
+    //advances and line metrics, and the flow used to wrap a single line
+    TextLayout measure;
+    LayoutParagraph scratch;
+    //lineStarts[totalLines] and rowStarts[totalLines] are the end of the document
+    unsigned int* lineStarts;
+    unsigned int* rowStarts;
+    unsigned int totalLines;
+    unsigned int lineCapacity;
+    unsigned int remeasuredLines;
+};
+
+//boxWidth 0 disables wrapping, so every line is one row
+void initDocumentLayout(DocumentLayout* dl, FontAtlas* fa, float scale, float boxWidth){
+    initTextLayout(&dl->measure, fa, scale);
+    dl->measure.boxWidth = boxWidth;
+    dl->text = 0;
+    dl->textLength = 0;
+    dl->boxWidth = boxWidth;
+    dl->scratch.lines = 0;
+    dl->scratch.totalLines = 0;
+    dl->scratch.lineCapacity = 0;
+    dl->lineStarts = 0;
+    dl->rowStarts = 0;
+    dl->lineCapacity = 0;
+    dl->totalLines = 0;
+    dl->remeasuredLines = 0;
+}
+
+void clearDocumentLayout(DocumentLayout* dl){
+    if(dl->lineStarts) delete[] dl->lineStarts;
+    if(dl->rowStarts) delete[] dl->rowStarts;
+    if(dl->scratch.lines) delete[] dl->scratch.lines;
+    dl->lineStarts = 0;
+    dl->rowStarts = 0;
+    dl->scratch.lines = 0;
+    dl->scratch.lineCapacity = 0;
+    dl->totalLines = 0;
+    dl->lineCapacity = 0;
+}
+
+//bytes of line i before its break, which is one of CR, LF, CRLF or the end of the text
+static unsigned int getDocumentLineLength(DocumentLayout* dl, unsigned int i){
+    unsigned int start = dl->lineStarts[i];
+    unsigned int end = dl->lineStarts[i + 1];
+    if(end > start && i + 1 < dl->totalLines){
+        end--;
+        if(end > start && dl->text[end] == '\n' && dl->text[end - 1] == '\r'){
+            end--;
+        }
+    }
+    return end - start;
+}
+
+//wraps one line into dl->scratch, only done when it is wider than the box
+static void flowDocumentLine(DocumentLayout* dl, unsigned int start, unsigned int length){
+    dl->measure.text = dl->text;
+    dl->measure.textLength = dl->textLength;
+    dl->scratch.start = start;
+    dl->scratch.length = length;
+    dl->scratch.breakLength = 0;
+    dl->measure.totalLines = dl->scratch.totalLines;
+    flowLayoutParagraph(&dl->measure, &dl->scratch);
+}
+
+static unsigned int getDocumentLineRows(DocumentLayout* dl, unsigned int start, unsigned int length){
+    dl->remeasuredLines++;
+    if(dl->boxWidth <= 0){
+        return 1;
+    }
+    float width = 0;
+    const char* s = dl->text + start;
+    unsigned int i = 0;
+    while(i < length){
+        int slot;
+        float adv;
+        nextLayoutCharacter(&dl->measure, s, length, &i, &slot, &adv);
+        width += adv;
+        if(width > dl->boxWidth){
+            flowDocumentLine(dl, start, length);
+            return dl->scratch.totalLines;
+        }
+    }
+    return 1;
+}
+
+static void pushDocumentLine(DocumentLayout* dl, unsigned int start, unsigned int end, unsigned int next){
+    if(dl->totalLines == dl->lineCapacity){
+        unsigned int capacity = dl->lineCapacity ? dl->lineCapacity * 2 : 64;
+        unsigned int* lineStarts = new unsigned int[capacity + 1];
+        unsigned int* rowStarts = new unsigned int[capacity + 1];
+        lineStarts[0] = 0;
+        rowStarts[0] = 0;
+        for(unsigned int i = 0; dl->lineStarts && i <= dl->totalLines; i++){
+            lineStarts[i] = dl->lineStarts[i];
+            rowStarts[i] = dl->rowStarts[i];
+        }
+        if(dl->lineStarts) delete[] dl->lineStarts;
+        if(dl->rowStarts) delete[] dl->rowStarts;
+        dl->lineStarts = lineStarts;
+        dl->rowStarts = rowStarts;
+        dl->lineCapacity = capacity;
+    }
+    unsigned int i = dl->totalLines++;
+    dl->lineStarts[i] = start;
+    dl->lineStarts[i + 1] = next;
+    dl->rowStarts[i + 1] = dl->rowStarts[i] + getDocumentLineRows(dl, start, end - start);
+}
+
+//text is the whole buffer after bytes were added at its end, it may have moved.
+//only the last line, which has no break yet, and the new text are scanned
+void appendDocumentText(DocumentLayout* dl, const char* text, unsigned int textLength){
+    dl->text = text;
+    dl->remeasuredLines = 0;
+    unsigned int from = 0;
+    if(dl->totalLines){
+        dl->totalLines--;
+        from = dl->lineStarts[dl->totalLines];
+        //a CR that ended the text may have just been joined by its LF
+        if(dl->totalLines && text[from - 1] == '\r' && from < textLength && text[from] == '\n'){
+            dl->totalLines--;
+            from = dl->lineStarts[dl->totalLines];
+        }
+    }
+    dl->textLength = textLength;
+
+    unsigned int start = from;
+    unsigned int i = from;
+    while(i < textLength){
+        unsigned char c = text[i];
+        if(c == '\n' || c == '\r'){
+            unsigned int next = i + 1;
+            if(c == '\r' && next < textLength && text[next] == '\n'){
+                next++;
+            }
+            pushDocumentLine(dl, start, i, next);
+            start = next;
+            i = next;
+        }else{
+            i++;
+        }
+    }
+    pushDocumentLine(dl, start, textLength, textLength);
+}
+
+void setDocumentText(DocumentLayout* dl, const char* text, unsigned int textLength){
+    dl->totalLines = 0;
+    appendDocumentText(dl, text, textLength);
+}
+
+//every line has to be measured again, but unlike a full layout nothing is kept but its row count
+void setDocumentLayoutWidth(DocumentLayout* dl, float boxWidth){
+    dl->boxWidth = boxWidth;
+    dl->measure.boxWidth = boxWidth;
+    dl->remeasuredLines = 0;
+    for(unsigned int i = 0; i < dl->totalLines; i++){
+        dl->rowStarts[i + 1] = dl->rowStarts[i] + getDocumentLineRows(dl, dl->lineStarts[i], getDocumentLineLength(dl, i));
+    }
+}
+
+double getDocumentLayoutHeight(DocumentLayout* dl){
+    return dl->rowStarts[dl->totalLines] * (double)dl->measure.lineHeight;
+}
+
+//line holding a row, found with a binary search over the row counts
+unsigned int findDocumentRowLine(DocumentLayout* dl, unsigned int row){
+    unsigned int lo = 0;
+    unsigned int hi = dl->totalLines;
+    while(hi - lo > 1){
+        unsigned int mid = lo + ((hi - lo) / 2);
+        if(dl->rowStarts[mid] <= row){
+            lo = mid;
+        }else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+//line under a distance from the top of the document
+unsigned int findDocumentLine(DocumentLayout* dl, double scrollOffset){
+    double row = scrollOffset / dl->measure.lineHeight;
+    return findDocumentRowLine(dl, row > 0 ? (unsigned int)row : 0);
+}
+
+//rows touching the view, widened by overscan rows each way. returns the bytes in their lines so
+//callers can size the vertex buffer, at most 24 floats per byte
+unsigned int getDocumentVisibleRows(DocumentLayout* dl, double scrollOffset, float viewHeight, unsigned int overscan, unsigned int* firstRow, unsigned int* endRow){
+    unsigned int totalRows = dl->rowStarts[dl->totalLines];
+    double top = scrollOffset / dl->measure.lineHeight;
+    double bottom = ceil((scrollOffset + viewHeight) / dl->measure.lineHeight);
+    unsigned int first = top > 0 ? (unsigned int)top : 0;
+    unsigned int end = bottom > 0 ? (unsigned int)bottom : 0;
+    first = first > overscan ? first - overscan : 0;
+    end = end + overscan < totalRows ? end + overscan : totalRows;
+    if(first > end){
+        first = end;
+    }
+    *firstRow = first;
+    *endRow = end;
+    if(first == end){
+        return 0;
+    }
+    unsigned int firstLine = findDocumentRowLine(dl, first);
+    unsigned int lastLine = findDocumentRowLine(dl, end - 1);
+    return dl->lineStarts[lastLine + 1] - dl->lineStarts[firstLine];
+}
+
+//x and y are the top left corner of the view, with y increasing upwards like renderTextLayout.
+//scrollOffset is how far the view has moved down the document
+int renderDocumentLayout(float* vecPtr, DocumentLayout* dl, float x, float y, double scrollOffset, float viewHeight, unsigned int overscan){
+    unsigned int firstRow, endRow;
+    getDocumentVisibleRows(dl, scrollOffset, viewHeight, overscan, &firstRow, &endRow);
+    if(firstRow == endRow){
+        return 0;
+    }
+
+    TextLayout* tl = &dl->measure;
+    int ctr = 0;
+    unsigned int line = findDocumentRowLine(dl, firstRow);
+    for(; line < dl->totalLines && dl->rowStarts[line] < endRow; line++){
+        unsigned int start = dl->lineStarts[line];
+        unsigned int length = getDocumentLineLength(dl, line);
+        unsigned int rows = dl->rowStarts[line + 1] - dl->rowStarts[line];
+        const char* s = dl->text + start;
+        if(rows > 1){
+            flowDocumentLine(dl, start, length);
+        }
+        for(unsigned int r = 0; r < rows; r++){
+            unsigned int row = dl->rowStarts[line] + r;
+            if(row < firstRow || row >= endRow){
+                continue;
+            }
+            unsigned int from = rows > 1 ? dl->scratch.lines[r].start : 0;
+            unsigned int to = rows > 1 ? dl->scratch.lines[r].end : length;
+            float baseline = y - tl->ascent - (float)((row * (double)tl->lineHeight) - scrollOffset);
+            float xMarker = x;
+            unsigned int k = from;
+            while(k < to){
+                int slot;
+                float adv;
+                unsigned int c = nextLayoutCharacter(tl, s, length, &k, &slot, &adv);
+                if(slot >= 0 && getLineBreakClass(c) != LINE_BREAK_SP){
+                    ctr += emitGlyphQuad(&vecPtr[ctr], tl->fa, slot, xMarker, baseline, tl->scale);
+                }
+                xMarker += adv;
+            }
+        }
+    }
+    return ctr;
+}
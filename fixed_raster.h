@@ -0,0 +1,404 @@
+#pragma once
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "truetype_parser.h"
+
+//integer rasterization of glyph outlines. the outline is flattened into lines in 26.6 fixed point,
+//64 steps per font unit, which holds the eight segments getGlyphLines cuts every curve into
+//exactly. samples sit on whole font units like getBitmapFromCharCode's and count as inside when
+//the outline winds around them, the rule isPixelInside applies. every sample row walks the edges
+//crossing it, stepping each one down the rows with an integer quotient and remainder so the
+//crossings are exact, and fills the spans between crossings. no float is involved past the
+//subpixel offset, so a glyph rasterizes to the same bytes on every host and atlases built this
+//way can be cached and shared by content hash
+
+static const int FIXED_RASTER_ONE = 64;
+
+struct FixedLine{
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+};
+
+//lines grow by doubling, the memory comes from allocator or the heap when it is 0
+struct FixedLineGroup{
+    unsigned int totalLines;
+    unsigned int capacity;
+    FixedLine* lines;
+    AtlasAllocator* allocator;
+
+    FixedLineGroup(AtlasAllocator* allocator = 0){
+        totalLines = 0;
+        capacity = 0;
+        lines = 0;
+        this->allocator = allocator;
+    }
+
+    void addLine(FixedLine l){
+        if(totalLines == capacity){
+            unsigned int newCapacity = capacity ? capacity * 2 : 64;
+            FixedLine* newLines = allocateAtlasArray<FixedLine>(allocator, newCapacity);
+            for(int i = 0; i < totalLines; i++){
+                newLines[i] = lines[i];
+            }
+            releaseAtlasMemory(allocator, lines);
+            lines = newLines;
+            capacity = newCapacity;
+        }
+        lines[totalLines++] = l;
+    }
+
+    void clear(){
+        releaseAtlasMemory(allocator, lines);
+        lines = 0;
+        capacity = 0;
+        totalLines = 0;
+    }
+};
+
+//floor of n / d for d > 0
+static inline long long floorFixedDivide(long long n, long long d){
+    long long q = n / d;
+    return (n % d != 0 && n < 0) ? q - 1 : q;
+}
+
+//the eight segments of a quadratic curve, end points and control point in 26.6
+static void getFixedLinesFromCurve(int x1, int y1, int x2, int y2, int ox, int oy, FixedLineGroup& lg){
+    int px = x1;
+    int py = y1;
+    //64 times the curve point at t = k / 8, rounded to the nearest 26.6 step
+    for(int k = 1; k <= 8; k++){
+        int a = (8 - k) * (8 - k);
+        int b = 2 * k * (8 - k);
+        int c = k * k;
+        int nx = k == 8 ? x2 : (int)floorFixedDivide((a * x1) + (b * ox) + (c * x2) + 32, 64);
+        int ny = k == 8 ? y2 : (int)floorFixedDivide((a * y1) + (b * oy) + (c * y2) + 32, 64);
+        FixedLine l = {px, py, nx, ny};
+        lg.addLine(l);
+        px = nx;
+        py = ny;
+    }
+}
+
+//the contours of g in 26.6, moved right by xOffset. composite glyphs come back without contours
+//and flatten to no lines, like getGlyphLines
+void getFixedGlyphLines(GlyphShape g, FixedLineGroup& lg, int xOffset = 0){
+    if((short)g.numContours <= 0){
+        return;
+    }
+    for(int i = 0; i < g.numContours; i++){
+        int start = i == 0 ? 0 : g.contourEndPoints[i - 1] + 1;
+        int end = g.contourEndPoints[i] + 1;
+
+        int gx = (g.points[start].x * FIXED_RASTER_ONE) + xOffset;
+        int gy = g.points[start].y * FIXED_RASTER_ONE;
+        for(int j = start; j < end; j++){
+            GlyphPoint np = j == end - 1 ? g.points[start] : g.points[j + 1];
+            int nx = (np.x * FIXED_RASTER_ONE) + xOffset;
+            int ny = np.y * FIXED_RASTER_ONE;
+            if(np.onCurve){
+                FixedLine l = {gx, gy, nx, ny};
+                lg.addLine(l);
+                gx = nx;
+                gy = ny;
+            }else{
+                GlyphPoint p3 = j == end - 2 ? g.points[start] : g.points[j + 2];
+                int x3 = (p3.x * FIXED_RASTER_ONE) + xOffset;
+                int y3 = p3.y * FIXED_RASTER_ONE;
+                if(!p3.onCurve){
+                    //the implied on curve point halfway to the next control point is exact in 26.6
+                    x3 = (nx + x3) / 2;
+                    y3 = (ny + y3) / 2;
+                }
+                getFixedLinesFromCurve(gx, gy, x3, y3, nx, ny, lg);
+                gx = x3;
+                gy = y3;
+            }
+        }
+    }
+}
+
+//edges crossing the current sample row. x is the floor of the crossing in 26.6 and rem / dy the
+//fraction left over, every row down adds q and r / dy to it
+struct FixedEdgeList{
+    int* x;
+    int* rem;
+    int* q;
+    int* r;
+    int* dy;
+    int* dir;
+    unsigned int* endRow;
+    unsigned int total;
+};
+
+static void stepFixedEdges(FixedEdgeList* active){
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    __m128i one = _mm_set1_epi32(1);
+    for(; i + 4 <= active->total; i += 4){
+        __m128i x = _mm_loadu_si128((__m128i*)&active->x[i]);
+        __m128i rem = _mm_add_epi32(_mm_loadu_si128((__m128i*)&active->rem[i]), _mm_loadu_si128((__m128i*)&active->r[i]));
+        __m128i dy = _mm_loadu_si128((__m128i*)&active->dy[i]);
+        //all ones where the remainder reached dy, which carries one into x
+        __m128i carry = _mm_cmpgt_epi32(rem, _mm_sub_epi32(dy, one));
+        x = _mm_sub_epi32(_mm_add_epi32(x, _mm_loadu_si128((__m128i*)&active->q[i])), carry);
+        rem = _mm_sub_epi32(rem, _mm_and_si128(carry, dy));
+        _mm_storeu_si128((__m128i*)&active->x[i], x);
+        _mm_storeu_si128((__m128i*)&active->rem[i], rem);
+    }
+#endif
+    for(; i < active->total; i++){
+        active->x[i] += active->q[i];
+        active->rem[i] += active->r[i];
+        if(active->rem[i] >= active->dy[i]){
+            active->x[i]++;
+            active->rem[i] -= active->dy[i];
+        }
+    }
+}
+
+//adds the samples [s0, s1) of a row to the inside counts of the pixels they fall in
+static void addFixedSpan(unsigned int* counts, unsigned int s0, unsigned int s1, unsigned int divisions){
+    unsigned int p0 = s0 / divisions;
+    unsigned int p1 = (s1 - 1) / divisions;
+    if(p0 == p1){
+        counts[p0] += s1 - s0;
+        return;
+    }
+    counts[p0] += ((p0 + 1) * divisions) - s0;
+    for(unsigned int p = p0 + 1; p < p1; p++){
+        counts[p] += divisions;
+    }
+    counts[p1] += s1 - (p1 * divisions);
+}
+
+//fills a width x height bitmap of divisions x divisions samples per pixel, sample (s, t) lies at
+//font units (xOrigin + s, yOrigin + t). coverage keeps the fraction of samples inside, otherwise
+//a pixel is set when at least half of them are. returns the samples taken
+unsigned long rasterizeFixedLines(FixedLineGroup& lg, int xOrigin, int yOrigin, unsigned int width, unsigned int height, unsigned int divisions, bool coverage, unsigned char* bitmap, AtlasAllocator* allocator = 0){
+    unsigned int rows = height * divisions;
+    unsigned int columns = width * divisions;
+    unsigned int total = lg.totalLines;
+
+    //edges are bucketed by the first sample row they cross
+    unsigned int* rowStarts = allocateAtlasArray<unsigned int>(allocator, rows + 2);
+    memset(rowStarts, 0, sizeof(unsigned int) * (rows + 2));
+    unsigned int* startRows = allocateAtlasArray<unsigned int>(allocator, total);
+    unsigned int* endRows = allocateAtlasArray<unsigned int>(allocator, total);
+    int yBase = yOrigin * FIXED_RASTER_ONE;
+    for(unsigned int i = 0; i < total; i++){
+        FixedLine l = lg.lines[i];
+        int low = l.y1 < l.y2 ? l.y1 : l.y2;
+        int high = l.y1 < l.y2 ? l.y2 : l.y1;
+        //rows t with low <= yBase + 64t < high, horizontal lines cross none
+        long long first = floorFixedDivide((long long)low - yBase + FIXED_RASTER_ONE - 1, FIXED_RASTER_ONE);
+        long long last = floorFixedDivide((long long)high - yBase + FIXED_RASTER_ONE - 1, FIXED_RASTER_ONE);
+        first = first < 0 ? 0 : first;
+        last = last > rows ? rows : last;
+        if(first >= last){
+            startRows[i] = rows;
+            endRows[i] = rows;
+            continue;
+        }
+        startRows[i] = (unsigned int)first;
+        endRows[i] = (unsigned int)last;
+        rowStarts[first + 1]++;
+    }
+    for(unsigned int t = 0; t < rows; t++){
+        rowStarts[t + 1] += rowStarts[t];
+    }
+    unsigned int* rowEdges = allocateAtlasArray<unsigned int>(allocator, rowStarts[rows] ? rowStarts[rows] : 1);
+    unsigned int* rowFill = allocateAtlasArray<unsigned int>(allocator, rows + 1);
+    memcpy(rowFill, rowStarts, sizeof(unsigned int) * (rows + 1));
+    for(unsigned int i = 0; i < total; i++){
+        if(startRows[i] < rows){
+            rowEdges[rowFill[startRows[i]]++] = i;
+        }
+    }
+
+    unsigned int capacity = rowStarts[rows] ? rowStarts[rows] : 1;
+    FixedEdgeList active;
+    active.x = allocateAtlasArray<int>(allocator, capacity);
+    active.rem = allocateAtlasArray<int>(allocator, capacity);
+    active.q = allocateAtlasArray<int>(allocator, capacity);
+    active.r = allocateAtlasArray<int>(allocator, capacity);
+    active.dy = allocateAtlasArray<int>(allocator, capacity);
+    active.dir = allocateAtlasArray<int>(allocator, capacity);
+    active.endRow = allocateAtlasArray<unsigned int>(allocator, capacity);
+    active.total = 0;
+    unsigned int* crossingColumns = allocateAtlasArray<unsigned int>(allocator, capacity);
+    int* crossingDirs = allocateAtlasArray<int>(allocator, capacity);
+    unsigned int* counts = allocateAtlasArray<unsigned int>(allocator, width);
+    memset(counts, 0, sizeof(unsigned int) * width);
+
+    int xBase = xOrigin * FIXED_RASTER_ONE;
+    unsigned int samplesPerPixel = divisions * divisions;
+    for(unsigned int t = 0; t < rows; t++){
+        int y = yBase + ((int)t * FIXED_RASTER_ONE);
+        for(unsigned int e = rowStarts[t]; e < rowStarts[t + 1]; e++){
+            FixedLine l = lg.lines[rowEdges[e]];
+            bool up = l.y1 < l.y2;
+            int xa = up ? l.x1 : l.x2;
+            int ya = up ? l.y1 : l.y2;
+            int xb = up ? l.x2 : l.x1;
+            int yb = up ? l.y2 : l.y1;
+            long long dy = yb - ya;
+            long long n = (long long)(y - ya) * (xb - xa);
+            long long nq = floorFixedDivide(n, dy);
+            long long step = (long long)FIXED_RASTER_ONE * (xb - xa);
+            long long sq = floorFixedDivide(step, dy);
+            unsigned int a = active.total++;
+            active.x[a] = xa + (int)nq;
+            active.rem[a] = (int)(n - (nq * dy));
+            active.q[a] = (int)sq;
+            active.r[a] = (int)(step - (sq * dy));
+            active.dy[a] = (int)dy;
+            active.dir[a] = up ? 1 : -1;
+            active.endRow[a] = endRows[rowEdges[e]];
+        }
+
+        //a crossing counts for the samples at or right of it, the first is the column of its ceiling
+        unsigned int totalCrossings = 0;
+        for(unsigned int a = 0; a < active.total; a++){
+            long long ceiling = (long long)active.x[a] + (active.rem[a] > 0 ? 1 : 0);
+            long long column = floorFixedDivide(ceiling - xBase + FIXED_RASTER_ONE - 1, FIXED_RASTER_ONE);
+            if(column >= columns){
+                continue;
+            }
+            unsigned int c = column < 0 ? 0 : (unsigned int)column;
+            int dir = active.dir[a];
+            unsigned int k = totalCrossings++;
+            while(k > 0 && crossingColumns[k - 1] > c){
+                crossingColumns[k] = crossingColumns[k - 1];
+                crossingDirs[k] = crossingDirs[k - 1];
+                k--;
+            }
+            crossingColumns[k] = c;
+            crossingDirs[k] = dir;
+        }
+        int winding = 0;
+        unsigned int spanStart = 0;
+        for(unsigned int k = 0; k < totalCrossings; k++){
+            if(winding != 0 && crossingColumns[k] > spanStart){
+                addFixedSpan(counts, spanStart, crossingColumns[k], divisions);
+            }
+            winding += crossingDirs[k];
+            spanStart = crossingColumns[k];
+        }
+        if(winding != 0 && columns > spanStart){
+            addFixedSpan(counts, spanStart, columns, divisions);
+        }
+
+        if((t + 1) % divisions == 0){
+            unsigned char* row = &bitmap[(t / divisions) * width];
+            for(unsigned int j = 0; j < width; j++){
+                if(coverage){
+                    row[j] = (unsigned char)(((counts[j] * 255) + (samplesPerPixel / 2)) / samplesPerPixel);
+                }else{
+                    row[j] = counts[j] * 2 >= samplesPerPixel ? 255 : 0;
+                }
+                counts[j] = 0;
+            }
+        }
+
+        //edges ending at the next row leave, their order doesn't matter to the winding sums
+        for(unsigned int a = 0; a < active.total;){
+            if(active.endRow[a] <= t + 1){
+                unsigned int last = --active.total;
+                active.x[a] = active.x[last];
+                active.rem[a] = active.rem[last];
+                active.q[a] = active.q[last];
+                active.r[a] = active.r[last];
+                active.dy[a] = active.dy[last];
+                active.dir[a] = active.dir[last];
+                active.endRow[a] = active.endRow[last];
+            }else{
+                a++;
+            }
+        }
+        stepFixedEdges(&active);
+    }
+
+    releaseAtlasMemory(allocator, counts);
+    releaseAtlasMemory(allocator, crossingDirs);
+    releaseAtlasMemory(allocator, crossingColumns);
+    releaseAtlasMemory(allocator, active.endRow);
+    releaseAtlasMemory(allocator, active.dir);
+    releaseAtlasMemory(allocator, active.dy);
+    releaseAtlasMemory(allocator, active.r);
+    releaseAtlasMemory(allocator, active.q);
+    releaseAtlasMemory(allocator, active.rem);
+    releaseAtlasMemory(allocator, active.x);
+    releaseAtlasMemory(allocator, rowFill);
+    releaseAtlasMemory(allocator, rowEdges);
+    releaseAtlasMemory(allocator, endRows);
+    releaseAtlasMemory(allocator, startRows);
+    releaseAtlasMemory(allocator, rowStarts);
+    return (unsigned long)rows * columns;
+}
+
+//getBitmapFromCharCode on the integer rasterizer, one sample per font unit
+unsigned char* getFixedBitmapFromCharCode(unsigned char* fileData, unsigned short characterCode, unsigned int* width, unsigned int* height, AtlasBuildStats* stats = 0, AtlasAllocator* allocator = 0){
+    ATLAS_STATS_START(glyphStart);
+    GlyphShape gs;
+    getGlyphShape(fileData, characterCode, &gs, allocator);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_PARSE, glyphStart, characterCode);
+    ATLAS_STATS_START(flattenStart);
+    FixedLineGroup lg(allocator);
+    getFixedGlyphLines(gs, lg);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_FLATTEN, flattenStart, characterCode);
+
+    *width = gs.xMax - gs.xMin;
+    *height = gs.yMax - gs.yMin;
+
+    ATLAS_STATS_START(rasterStart);
+    unsigned char* bitmap = allocateAtlasArray<unsigned char>(allocator, *width * *height);
+    rasterizeFixedLines(lg, gs.xMin, gs.yMin, *width, *height, 1, false, bitmap, allocator);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_RASTERIZE, rasterStart, characterCode);
+    ATLAS_STATS_GLYPH(stats, characterCode, lg.totalLines, *width * *height, *width * *height,
+                      (*width * *height) + (lg.totalLines * sizeof(FixedLine)) + (gs.totalPoints * sizeof(GlyphPoint)), glyphStart);
+    lg.clear();
+    freeGlyphShape(&gs, allocator);
+    return bitmap;
+}
+
+//getReducedBitmapFromIndex on the integer rasterizer, with the same bitmap size and metrics. every
+//pixel takes all divisions x divisions font units under it as samples. xOffset is rounded to 1/64
+//of a font unit, the only step where float can reach the bitmap
+unsigned char* getFixedReducedBitmapFromIndex(unsigned char* fileData, unsigned int glyphIndex, unsigned int* width, unsigned int* height, float* horzBng, float* vertBng, unsigned int divisions, float xOffset = 0, AtlasBuildStats* stats = 0, unsigned int traceCode = 0, AtlasAllocator* allocator = 0){
+    ATLAS_STATS_START(glyphStart);
+    GlyphShape gs;
+    getGlyphShapeFromIndex(fileData, glyphIndex, &gs, allocator);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_PARSE, glyphStart, traceCode);
+    ATLAS_STATS_START(flattenStart);
+    FixedLineGroup lg(allocator);
+    getFixedGlyphLines(gs, lg, (int)((xOffset * FIXED_RASTER_ONE) + 0.5f));
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_FLATTEN, flattenStart, traceCode);
+
+    *horzBng = (float)getGlyphAdvanceFromIndex(fileData, glyphIndex) / (float)divisions;
+    *vertBng = (float)gs.yMin / (float)divisions;
+    unsigned int gWidth = gs.xMax - gs.xMin + (unsigned int)xOffset;
+    unsigned int gHeight = gs.yMax - gs.yMin;
+    *width = (gWidth / divisions) + 1;
+    *height = (gHeight / divisions) + 1;
+
+    ATLAS_STATS_START(rasterStart);
+    unsigned char* bitmap = allocateAtlasArray<unsigned char>(allocator, *width * *height);
+    rasterizeFixedLines(lg, gs.xMin, gs.yMin, *width, *height, divisions, false, bitmap, allocator);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_RASTERIZE, rasterStart, traceCode);
+    ATLAS_STATS_GLYPH(stats, traceCode, lg.totalLines, *width * *height, (unsigned long)*width * *height * divisions * divisions,
+                      (*width * *height) + (lg.totalLines * sizeof(FixedLine)) + (gs.totalPoints * sizeof(GlyphPoint)), glyphStart);
+    lg.clear();
+    freeGlyphShape(&gs, allocator);
+    return bitmap;
+}
+
+unsigned char* getFixedReducedBitmapFromCharCode(unsigned char* fileData, unsigned short characterCode, unsigned int* width, unsigned int* height, float* horzBng, float* vertBng, unsigned int divisions, float xOffset = 0, AtlasBuildStats* stats = 0, AtlasAllocator* allocator = 0){
+    return getFixedReducedBitmapFromIndex(fileData, getGlyphIndex(fileData, characterCode), width, height, horzBng, vertBng, divisions, xOffset, stats, characterCode, allocator);
+}
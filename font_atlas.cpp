@@ -1,13 +1,23 @@
 #include "font_atlas.h"
 #include "truetype_parser.h"
+#include "fixed_raster.h"
+#include "thread_pool.h"
+#include "atlas_mipmap.h"
+#include "font_fallback.h"
+#include "bitmap_blit.h"
 
 struct Bitmap {
     unsigned int width;
     unsigned int height;
     unsigned short charCode;
+    unsigned char phase;
+    unsigned int padding;
     unsigned char* bytes;
     float xShift;
     float yShift;
+    unsigned int hash;
+    //index of the packed bitmap this one is drawn from
+    unsigned int slot;
 
     Bitmap(){}
     Bitmap(unsigned char* bytes, unsigned width, unsigned height): width(width), height(height), bytes(bytes){}
@@ -39,21 +49,23 @@ struct Rectangle {
 struct RectangleList {
     Rectangle* rects;
     unsigned int totalRects;
+    AtlasAllocator* allocator;
     
-    RectangleList(){
+    RectangleList(AtlasAllocator* allocator = 0){
         totalRects = 0;
-        rects = new Rectangle[0];
+        rects = 0;
+        this->allocator = allocator;
     }
 
     void add(Rectangle r){
-        Rectangle* tRct = new Rectangle[totalRects + 1];
+        Rectangle* tRct = allocateAtlasArray<Rectangle>(allocator, totalRects + 1);
         tRct[totalRects] = r;
 
         for(int i = 0; i < totalRects; i++){
             tRct[i] = rects[i];
         }
 
-        delete[] rects;
+        releaseAtlasMemory(allocator, rects);
         rects = tRct;
         totalRects++;
     }
@@ -65,7 +77,7 @@ struct RectangleList {
     Rectangle remove(unsigned int v){
         Rectangle r = rects[v];
 
-        Rectangle* tRct = new Rectangle[totalRects - 1];
+        Rectangle* tRct = allocateAtlasArray<Rectangle>(allocator, totalRects - 1);
 
         for(int i = 0; i < totalRects; i++){
             if(i < v){
@@ -75,7 +87,7 @@ struct RectangleList {
             }
         }
 
-        delete[] rects;        
+        releaseAtlasMemory(allocator, rects);
         rects = tRct;
 
         totalRects--;
@@ -83,10 +95,8 @@ struct RectangleList {
     }
 
     void clear(){
-        if(rects){
-            delete[] rects;
-            rects = 0;
-        }
+        releaseAtlasMemory(allocator, rects);
+        rects = 0;
         totalRects = 0;
     }
 };
@@ -103,44 +113,49 @@ struct RectNode{
         child2 = 0;
     }
 
-    RectNode* add(Bitmap bmp){
+    RectNode* add(Bitmap bmp, AtlasAllocator* allocator){
+        unsigned int bmpWidth = bmp.width + (2 * bmp.padding);
+        unsigned int bmpHeight = bmp.height + (2 * bmp.padding);
         if(child1 && child2){
-            RectNode* newNode = child1->add(bmp);
+            RectNode* newNode = child1->add(bmp, allocator);
             if(newNode){
                 return newNode;
             }else{
-                return child2->add(bmp);
+                return child2->add(bmp, allocator);
             }
         }else{
             if(set){
                 return 0;
-            }else if(rect.width < bmp.width || rect.height < bmp.height){
+            }else if(rect.width < bmpWidth || rect.height < bmpHeight){
                 return 0;
-            }else if(rect.width == bmp.width && rect.height == bmp.height){
+            }else if(rect.width == bmpWidth && rect.height == bmpHeight){
                 rect.bitmap = bmp;
                 set = true;
                 return this;
             }else{
-                child1 = new RectNode;
-                child2 = new RectNode;
-                int dw = rect.width - bmp.width;
-                int dh = rect.height - bmp.height;
+                child1 = newAtlasObject<RectNode>(allocator);
+                child2 = newAtlasObject<RectNode>(allocator);
+                int dw = rect.width - bmpWidth;
+                int dh = rect.height - bmpHeight;
 
                 if(dw > dh){
-                    child1->rect = Rectangle(rect.left, rect.left + bmp.width, rect.bottom, rect.top);
-                    child2->rect = Rectangle(rect.left + bmp.width, rect.right, rect.bottom, rect.top);
+                    child1->rect = Rectangle(rect.left, rect.left + bmpWidth, rect.bottom, rect.top);
+                    child2->rect = Rectangle(rect.left + bmpWidth, rect.right, rect.bottom, rect.top);
                 }else{
-                    child1->rect = Rectangle(rect.left, rect.right, rect.bottom, rect.bottom + bmp.height);
-                    child2->rect = Rectangle(rect.left, rect.right, rect.bottom + bmp.height, rect.top);
+                    child1->rect = Rectangle(rect.left, rect.right, rect.bottom, rect.bottom + bmpHeight);
+                    child2->rect = Rectangle(rect.left, rect.right, rect.bottom + bmpHeight, rect.top);
                 }
 
-                return child1->add(bmp);
+                return child1->add(bmp, allocator);
             }
         }
     }
 };
 
 static void sortBitmapsByDescendingArea(Bitmap* bitmaps, unsigned int totalBitmaps){
+    if(totalBitmaps == 0){
+        return;
+    }
     for(int i = 0; i < totalBitmaps - 1; i++){
         for(int j = i + 1; j < totalBitmaps; j++){
             unsigned int area1 = bitmaps[i].width * bitmaps[i].height;
@@ -166,78 +181,581 @@ static void flattenNodeTree(RectNode* node, RectangleList* list){
     }
 }
 
-static void clearNodeTree(RectNode* node){
+static void clearNodeTree(RectNode* node, AtlasAllocator* allocator){
     if(node->child1){
-        clearNodeTree(node->child1);
+        clearNodeTree(node->child1, allocator);
     }
     if(node->child2){
-        clearNodeTree(node->child2);
-    }
-    if(node){
-        delete node;
+        clearNodeTree(node->child2, allocator);
     }
+    deleteAtlasObject(allocator, node);
 }
 
 void clearFontAtlas(FontAtlas* fa){
     fa->id = -1;
     fa->totalCharacters = 0;
-    if(fa->bitmap) delete[] fa->bitmap;
-    if(fa->characterCodes) delete[] fa->characterCodes;
-    if(fa->xOffsets) delete[] fa->xOffsets;
-    if(fa->yOffsets) delete[] fa->yOffsets;
-    if(fa->widths) delete[] fa->widths;
-    if(fa->heights) delete[] fa->heights;
-    if(fa->xShifts) delete[] fa->xShifts;
-    if(fa->yShifts) delete[] fa->yShifts;
+    releaseAtlasMemory(fa->allocator, fa->bitmap);
+    releaseAtlasMemory(fa->allocator, fa->characterCodes);
+    releaseAtlasMemory(fa->allocator, fa->xOffsets);
+    releaseAtlasMemory(fa->allocator, fa->yOffsets);
+    releaseAtlasMemory(fa->allocator, fa->widths);
+    releaseAtlasMemory(fa->allocator, fa->heights);
+    releaseAtlasMemory(fa->allocator, fa->xShifts);
+    releaseAtlasMemory(fa->allocator, fa->yShifts);
+    releaseAtlasMemory(fa->allocator, fa->phases);
+    releaseAtlasMemory(fa->allocator, fa->glyphHashes);
+    fa->bitmap = 0;
+    fa->characterCodes = 0;
+    fa->xOffsets = 0;
+    fa->yOffsets = 0;
+    fa->widths = 0;
+    fa->heights = 0;
+    fa->xShifts = 0;
+    fa->yShifts = 0;
+    fa->phases = 0;
+    fa->glyphHashes = 0;
+    fa->capacity = 0;
+    fa->totalDirtyRegions = 0;
+    fa->sharedGlyphs = 0;
+    fa->sharedArea = 0;
+    freeFontAtlasMipmaps(fa);
+}
+
+FontAtlasSettings getDefaultFontAtlasSettings(){
+    FontAtlasSettings settings;
+    settings.divisions = 32;
+    settings.threadPool = 0;
+    settings.stats = 0;
+    settings.subpixelPhases = 1;
+    settings.lazySubpixelPhases = true;
+    settings.gutter = 0;
+    settings.mipLevels = 1;
+    settings.mipFilter = MIPMAP_FILTER_BOX;
+    settings.fallback = 0;
+    settings.glyphIndices = false;
+    settings.fixedPointRaster = false;
+    settings.allocator = 0;
+    return settings;
+}
+
+//the phase shifts the outline right by phase / subpixelPhases of a pixel
+static float getSubpixelPhaseOffset(unsigned int phase, unsigned int subpixelPhases, unsigned int divisions){
+    return ((float)phase * (float)divisions) / (float)subpixelPhases;
+}
+
+static void reserveFontAtlasEntries(FontAtlas* fa, unsigned int capacity){
+    if(capacity <= fa->capacity){
+        return;
+    }
+    unsigned int newCapacity = fa->capacity ? fa->capacity : 16;
+    while(newCapacity < capacity){
+        newCapacity *= 2;
+    }
+
+    AtlasAllocator* allocator = fa->allocator;
+    unsigned short* characterCodes = allocateAtlasArray<unsigned short>(allocator, newCapacity);
+    unsigned int* xOffsets = allocateAtlasArray<unsigned int>(allocator, newCapacity);
+    unsigned int* yOffsets = allocateAtlasArray<unsigned int>(allocator, newCapacity);
+    unsigned int* widths = allocateAtlasArray<unsigned int>(allocator, newCapacity);
+    unsigned int* heights = allocateAtlasArray<unsigned int>(allocator, newCapacity);
+    float* xShifts = allocateAtlasArray<float>(allocator, newCapacity);
+    float* yShifts = allocateAtlasArray<float>(allocator, newCapacity);
+    unsigned char* phases = allocateAtlasArray<unsigned char>(allocator, newCapacity);
+    unsigned int* glyphHashes = allocateAtlasArray<unsigned int>(allocator, newCapacity);
+    for(int i = 0; i < fa->totalCharacters; i++){
+        characterCodes[i] = fa->characterCodes[i];
+        xOffsets[i] = fa->xOffsets[i];
+        yOffsets[i] = fa->yOffsets[i];
+        widths[i] = fa->widths[i];
+        heights[i] = fa->heights[i];
+        xShifts[i] = fa->xShifts[i];
+        yShifts[i] = fa->yShifts[i];
+        phases[i] = fa->phases[i];
+        glyphHashes[i] = fa->glyphHashes[i];
+    }
+    releaseAtlasMemory(allocator, fa->characterCodes);
+    releaseAtlasMemory(allocator, fa->xOffsets);
+    releaseAtlasMemory(allocator, fa->yOffsets);
+    releaseAtlasMemory(allocator, fa->widths);
+    releaseAtlasMemory(allocator, fa->heights);
+    releaseAtlasMemory(allocator, fa->xShifts);
+    releaseAtlasMemory(allocator, fa->yShifts);
+    releaseAtlasMemory(allocator, fa->phases);
+    releaseAtlasMemory(allocator, fa->glyphHashes);
+
+    fa->characterCodes = characterCodes;
+    fa->xOffsets = xOffsets;
+    fa->yOffsets = yOffsets;
+    fa->widths = widths;
+    fa->heights = heights;
+    fa->xShifts = xShifts;
+    fa->yShifts = yShifts;
+    fa->phases = phases;
+    fa->glyphHashes = glyphHashes;
+    fa->capacity = newCapacity;
+}
+
+//bytes held by the atlas: its entry arrays at their capacity, the bitmap and the mip levels
+unsigned long getFontAtlasAllocatedBytes(FontAtlas* fa){
+    unsigned long entryBytes = (5 * sizeof(unsigned int)) + (2 * sizeof(float)) + sizeof(unsigned short) + sizeof(unsigned char);
+    unsigned long bytes = (fa->capacity * entryBytes) + ((unsigned long)fa->totalBitmapWidth * fa->totalBitmapHeight);
+    if(fa->mipBitmaps){
+        bytes += fa->totalMipLevels * (sizeof(unsigned char*) + (2 * sizeof(unsigned int)));
+        for(unsigned int i = 1; i < fa->totalMipLevels; i++){
+            bytes += (unsigned long)fa->mipWidths[i] * fa->mipHeights[i];
+        }
+    }
+    return bytes;
 }
 
-void buildFontAtlas(FontAtlas* fa, unsigned char* fontFileData, unsigned int totalCharacters, unsigned short* charCodes){
+//texels a merged upload would send that neither region changed
+static const unsigned long FONT_ATLAS_DIRTY_MERGE_SLACK = 256;
+
+static unsigned long getAtlasRegionArea(AtlasRegion r){
+    return (unsigned long)r.width * r.height;
+}
+
+static AtlasRegion getAtlasRegionUnion(AtlasRegion a, AtlasRegion b){
+    unsigned int left = a.x < b.x ? a.x : b.x;
+    unsigned int bottom = a.y < b.y ? a.y : b.y;
+    unsigned int right = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    unsigned int top = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    AtlasRegion r = {left, bottom, right - left, top - bottom};
+    return r;
+}
+
+//area of the union not covered by either region, overlaps are only counted once
+static unsigned long getAtlasRegionMergeWaste(AtlasRegion a, AtlasRegion b){
+    unsigned long overlap = 0;
+    unsigned int left = a.x > b.x ? a.x : b.x;
+    unsigned int bottom = a.y > b.y ? a.y : b.y;
+    unsigned int right = a.x + a.width < b.x + b.width ? a.x + a.width : b.x + b.width;
+    unsigned int top = a.y + a.height < b.y + b.height ? a.y + a.height : b.y + b.height;
+    if(right > left && top > bottom){
+        overlap = (unsigned long)(right - left) * (top - bottom);
+    }
+    return getAtlasRegionArea(getAtlasRegionUnion(a, b)) + overlap - getAtlasRegionArea(a) - getAtlasRegionArea(b);
+}
+
+static void removeFontAtlasDirtyRegion(FontAtlas* fa, unsigned int i){
+    fa->dirtyRegions[i] = fa->dirtyRegions[--fa->totalDirtyRegions];
+}
+
+//regions are merged whenever the union wastes little, which joins glyphs packed next to each other
+//on a shelf. once the list is full the pair wasting the least is merged instead
+void markFontAtlasRegionDirty(FontAtlas* fa, unsigned int x, unsigned int y, unsigned int width, unsigned int height){
+    if(x >= fa->totalBitmapWidth || y >= fa->totalBitmapHeight || width == 0 || height == 0){
+        return;
+    }
+    if(x + width > fa->totalBitmapWidth){
+        width = fa->totalBitmapWidth - x;
+    }
+    if(y + height > fa->totalBitmapHeight){
+        height = fa->totalBitmapHeight - y;
+    }
+    AtlasRegion r = {x, y, width, height};
+
+    //a merged region can reach ones it missed, so the list is scanned again after each merge
+    unsigned int i = 0;
+    while(i < fa->totalDirtyRegions){
+        AtlasRegion d = fa->dirtyRegions[i];
+        unsigned long waste = getAtlasRegionMergeWaste(d, r);
+        if(waste <= FONT_ATLAS_DIRTY_MERGE_SLACK || waste * 2 <= getAtlasRegionArea(d) + getAtlasRegionArea(r)){
+            r = getAtlasRegionUnion(d, r);
+            removeFontAtlasDirtyRegion(fa, i);
+            i = 0;
+        }else{
+            i++;
+        }
+    }
+
+    unsigned int total = fa->totalDirtyRegions;
+    if(total == FONT_ATLAS_MAX_DIRTY_REGIONS){
+        //index total stands for the new region
+        unsigned int bestI = 0;
+        unsigned int bestJ = total;
+        unsigned long bestWaste = (unsigned long)-1;
+        for(unsigned int a = 0; a < total; a++){
+            for(unsigned int b = a + 1; b <= total; b++){
+                unsigned long waste = getAtlasRegionMergeWaste(fa->dirtyRegions[a], b < total ? fa->dirtyRegions[b] : r);
+                if(waste < bestWaste){
+                    bestWaste = waste;
+                    bestI = a;
+                    bestJ = b;
+                }
+            }
+        }
+        AtlasRegion merged = getAtlasRegionUnion(fa->dirtyRegions[bestI], bestJ < total ? fa->dirtyRegions[bestJ] : r);
+        if(bestJ < total){
+            removeFontAtlasDirtyRegion(fa, bestJ);
+            removeFontAtlasDirtyRegion(fa, bestI);
+            fa->dirtyRegions[fa->totalDirtyRegions++] = r;
+        }else{
+            removeFontAtlasDirtyRegion(fa, bestI);
+        }
+        markFontAtlasRegionDirty(fa, merged.x, merged.y, merged.width, merged.height);
+        return;
+    }
+    fa->dirtyRegions[fa->totalDirtyRegions++] = r;
+}
+
+//for changes that touch the whole bitmap, like a resize, which also needs a new texture
+void markFontAtlasDirty(FontAtlas* fa){
+    fa->totalDirtyRegions = 0;
+    markFontAtlasRegionDirty(fa, 0, 0, fa->totalBitmapWidth, fa->totalBitmapHeight);
+}
+
+void clearFontAtlasDirtyRegions(FontAtlas* fa){
+    fa->totalDirtyRegions = 0;
+}
+
+unsigned int getFontAtlasDirtyRegions(FontAtlas* fa, AtlasRegion** regions){
+    *regions = fa->dirtyRegions;
+    return fa->totalDirtyRegions;
+}
+
+//texels of a mip level filtered from a base level region, rounded outwards like the glyph rects
+AtlasRegion getFontAtlasLevelRegion(FontAtlas* fa, AtlasRegion region, unsigned int level){
+    unsigned int left = region.x;
+    unsigned int bottom = region.y;
+    unsigned int right = region.x + region.width;
+    unsigned int top = region.y + region.height;
+    for(unsigned int i = 0; i < level; i++){
+        left >>= 1;
+        bottom >>= 1;
+        right = (right + 1) >> 1;
+        top = (top + 1) >> 1;
+    }
+    unsigned int levelWidth = getMipLevelWidth(fa, level);
+    unsigned int levelHeight = getMipLevelHeight(fa, level);
+    right = right < levelWidth ? right : levelWidth;
+    top = top < levelHeight ? top : levelHeight;
+    AtlasRegion r = {left, bottom, right > left ? right - left : 0, top > bottom ? top - bottom : 0};
+    return r;
+}
+
+//first texel of a region in a level's coordinates, rows are rowPitch bytes apart. backends that
+//take a pitch can upload straight from here
+unsigned char* getFontAtlasRegionBytes(FontAtlas* fa, AtlasRegion region, unsigned int level, unsigned int* rowPitch){
+    *rowPitch = getMipLevelWidth(fa, level);
+    return getMipLevelBitmap(fa, level) + ((unsigned long)region.y * *rowPitch) + region.x;
+}
+
+//packs a region in a level's coordinates into dst, whose rows are dstRowPitch bytes apart
+void copyFontAtlasRegion(FontAtlas* fa, AtlasRegion region, unsigned int level, unsigned char* dst, unsigned int dstRowPitch){
+    unsigned int rowPitch;
+    unsigned char* src = getFontAtlasRegionBytes(fa, region, level, &rowPitch);
+    for(unsigned int i = 0; i < region.height; i++){
+        memcpy(dst + ((unsigned long)i * dstRowPitch), src + ((unsigned long)i * rowPitch), region.width);
+    }
+}
+
+static void growFontAtlasBitmap(FontAtlas* fa, unsigned int width, unsigned int height){
+    unsigned char* bitmap = allocateBlitTarget(width, height, fa->allocator);
+    if(fa->bitmap){
+        blitRegion(bitmap, width, fa->bitmap, fa->totalBitmapWidth, fa->totalBitmapWidth, fa->totalBitmapHeight);
+    }
+    releaseAtlasMemory(fa->allocator, fa->bitmap);
+    fa->bitmap = bitmap;
+    fa->totalBitmapWidth = width;
+    fa->totalBitmapHeight = height;
+    markFontAtlasDirty(fa);
+}
+
+//fnv-1a over the size and pixels. only a hint, matches are confirmed by comparing the pixels
+static unsigned int getGlyphBitmapHash(unsigned char* bytes, unsigned int width, unsigned int height){
+    unsigned int hash = 2166136261u;
+    hash = (hash ^ width) * 16777619u;
+    hash = (hash ^ height) * 16777619u;
+    unsigned int size = width * height;
+    for(unsigned int i = 0; i < size; i++){
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+//entry already holding these exact pixels in the atlas, or -1
+static int findFontAtlasGlyphSlot(FontAtlas* fa, unsigned int hash, unsigned char* bytes, unsigned int width, unsigned int height){
+    for(unsigned int i = 0; i < fa->totalCharacters; i++){
+        if(fa->glyphHashes[i] != hash || fa->widths[i] != width || fa->heights[i] != height){
+            continue;
+        }
+        bool same = true;
+        for(unsigned int j = 0; j < height && same; j++){
+            same = memcmp(&fa->bitmap[((fa->yOffsets[i] + j) * fa->totalBitmapWidth) + fa->xOffsets[i]], &bytes[j * width], width) == 0;
+        }
+        if(same){
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int addFontAtlasEntry(FontAtlas* fa, unsigned short charCode, unsigned int phase, unsigned int x, unsigned int y, unsigned int width, unsigned int height, float xShift, float yShift, unsigned int hash){
+    int index = fa->totalCharacters++;
+    fa->characterCodes[index] = charCode;
+    fa->xOffsets[index] = x;
+    fa->yOffsets[index] = y;
+    fa->widths[index] = width;
+    fa->heights[index] = height;
+    fa->xShifts[index] = xShift;
+    fa->yShifts[index] = yShift;
+    fa->phases[index] = phase;
+    fa->glyphHashes[index] = hash;
+    return index;
+}
+
+//places the bitmap on a shelf above the packed glyphs, growing the atlas when it runs out of room
+int addGlyphToFontAtlas(FontAtlas* fa, unsigned short charCode, unsigned int phase, unsigned char* bytes, unsigned int width, unsigned int height, float xShift, float yShift){
+    reserveFontAtlasEntries(fa, fa->totalCharacters + 1);
+
+    unsigned int hash = getGlyphBitmapHash(bytes, width, height);
+    int shared = findFontAtlasGlyphSlot(fa, hash, bytes, width, height);
+    if(shared >= 0){
+        fa->sharedGlyphs++;
+        fa->sharedArea += (unsigned long)(width + (2 * fa->gutter)) * (height + (2 * fa->gutter));
+        return addFontAtlasEntry(fa, charCode, phase, fa->xOffsets[shared], fa->yOffsets[shared], width, height, xShift, yShift, hash);
+    }
+
+    unsigned int paddedWidth = width + (2 * fa->gutter);
+    unsigned int paddedHeight = height + (2 * fa->gutter);
+    if(fa->shelfX + paddedWidth > fa->totalBitmapWidth){
+        fa->shelfY += fa->shelfHeight;
+        fa->shelfX = 0;
+        fa->shelfHeight = 0;
+    }
+    unsigned int newWidth = paddedWidth > fa->totalBitmapWidth ? paddedWidth : fa->totalBitmapWidth;
+    unsigned int newHeight = fa->totalBitmapHeight;
+    if(fa->shelfY + paddedHeight > newHeight){
+        newHeight += newHeight / 4;
+        if(fa->shelfY + paddedHeight > newHeight){
+            newHeight = fa->shelfY + paddedHeight;
+        }
+    }
+    if(newWidth != fa->totalBitmapWidth || newHeight != fa->totalBitmapHeight){
+        growFontAtlasBitmap(fa, newWidth, newHeight);
+    }
+
+    //the gutter is cleared as well, the space may have held something before
+    unsigned int x = fa->shelfX + fa->gutter;
+    unsigned int y = fa->shelfY + fa->gutter;
+    BlitImage image = genBlitImage(bytes, width, height);
+    blitImage(fa->bitmap, fa->totalBitmapWidth, x, y, &image, fa->gutter, BLIT_EDGE_CLEAR);
+
+    int index = addFontAtlasEntry(fa, charCode, phase, x, y, width, height, xShift, yShift, hash);
+
+    fa->shelfX += paddedWidth;
+    if(paddedHeight > fa->shelfHeight){
+        fa->shelfHeight = paddedHeight;
+    }
+    updateFontAtlasMipmaps(fa, x, y, width, height);
+    markFontAtlasRegionDirty(fa, x, y, width, height);
+    return index;
+}
+
+//picks the first chain face with a glyph for the character and scales divisions to its units per em.
+//characters no face has come from the atlas font, which draws its missing glyph box
+unsigned char* getAtlasGlyphFont(FontFallbackChain* fallback, unsigned char* fontData, unsigned short charCode, unsigned int divisions, unsigned int* faceDivisions){
+    *faceDivisions = divisions;
+    if(!fallback){
+        return fontData;
+    }
+    unsigned int glyphIndex;
+    int face = resolveFontFallback(fallback, charCode, &glyphIndex);
+    if(face < 0 || fallback->faces[face] == fontData){
+        return fontData;
+    }
+    unsigned int unitsPerEm = getUnitsPerEm(fontData);
+    unsigned int scaled = ((divisions * fallback->unitsPerEm[face]) + (unitsPerEm / 2)) / unitsPerEm;
+    *faceDivisions = scaled ? scaled : 1;
+    return fallback->faces[face];
+}
+
+//an atlas key is a character of fontData, or one of its glyph indices for glyph indexed atlases
+unsigned char* getAtlasGlyphBitmap(unsigned char* fontData, unsigned short code, bool glyphIndex, bool fixedPoint, unsigned int* width, unsigned int* height, float* xShift, float* yShift, unsigned int divisions, float xOffset, AtlasBuildStats* stats, AtlasAllocator* allocator){
+    if(fixedPoint){
+        unsigned int glyph = glyphIndex ? code : getGlyphIndex(fontData, code);
+        return getFixedReducedBitmapFromIndex(fontData, glyph, width, height, xShift, yShift, divisions, xOffset, stats, code, allocator);
+    }
+    if(glyphIndex){
+        return getReducedBitmapFromIndex(fontData, code, width, height, xShift, yShift, divisions, xOffset, stats, code, allocator);
+    }
+    return getReducedBitmapFromCharCode(fontData, code, width, height, xShift, yShift, divisions, xOffset, stats, allocator);
+}
+
+int addSubpixelGlyphToFontAtlas(FontAtlas* fa, unsigned short charCode, unsigned int phase){
+    if(!fa->fontData || phase >= fa->subpixelPhases){
+        return -1;
+    }
+    unsigned int w, h;
+    float ho, v;
+    unsigned int divisions;
+    unsigned char* fontData = getAtlasGlyphFont(fa->glyphIndices ? 0 : fa->fallback, fa->fontData, charCode, fa->divisions, &divisions);
+    float xOffset = getSubpixelPhaseOffset(phase, fa->subpixelPhases, divisions);
+    unsigned char* bytes = getAtlasGlyphBitmap(fontData, charCode, fa->glyphIndices, fa->fixedPointRaster, &w, &h, &ho, &v, divisions, xOffset, 0, fa->allocator);
+    if(!bytes){
+        return -1;
+    }
+    int index = addGlyphToFontAtlas(fa, charCode, phase, bytes, w, h, ho, v);
+    freeBitmapMemory(bytes, fa->allocator);
+    return index;
+}
+
+struct GlyphRasterJob{
+    unsigned char** glyphFonts;
+    unsigned int* glyphDivisions;
+    unsigned short* charCodes;
+    unsigned int subpixelPhases;
+    unsigned int builtPhases;
+    unsigned int gutter;
+    bool glyphIndices;
+    bool fixedPointRaster;
+    AtlasBuildStats* stats;
+    AtlasAllocator* allocator;
+    Bitmap* bitmaps;
+};
+
+static void rasterizeAtlasGlyph(void* data, unsigned int i){
+    GlyphRasterJob* job = (GlyphRasterJob*)data;
+    Bitmap* b = &job->bitmaps[i];
+    unsigned int c = i / job->builtPhases;
+    unsigned short charCode = job->charCodes[c];
+    unsigned int phase = i % job->builtPhases;
+    float xOffset = getSubpixelPhaseOffset(phase, job->subpixelPhases, job->glyphDivisions[c]);
+    b->bytes = getAtlasGlyphBitmap(job->glyphFonts[c], charCode, job->glyphIndices, job->fixedPointRaster, &b->width, &b->height, &b->xShift, &b->yShift, job->glyphDivisions[c], xOffset, job->stats, job->allocator);
+    b->charCode = charCode;
+    b->phase = phase;
+    b->padding = job->gutter;
+}
+
+void buildFontAtlas(FontAtlas* fa, unsigned char* fontFileData, unsigned int totalCharacters, unsigned short* charCodes, FontAtlasSettings* settings = 0){
+    FontAtlasSettings defaultSettings = getDefaultFontAtlasSettings();
+    if(!settings){
+        settings = &defaultSettings;
+    }
+    AtlasBuildStats* stats = settings->stats;
+    ATLAS_STATS_START(buildStart);
+
+    unsigned int subpixelPhases = settings->subpixelPhases ? settings->subpixelPhases : 1;
+    unsigned int builtPhases = settings->lazySubpixelPhases ? 1 : subpixelPhases;
+    unsigned int totalBitmaps = totalCharacters * builtPhases;
+    //the scratch memory of the build is counted against the atlas as well
+    AtlasAllocator* allocator = settings->allocator;
+    fa->allocator = allocator;
+
+    //fallback lookups are memoized in the chain, so they are resolved here rather than on the workers
+    unsigned char** glyphFonts = allocateAtlasArray<unsigned char*>(allocator, totalCharacters);
+    unsigned int* glyphDivisions = allocateAtlasArray<unsigned int>(allocator, totalCharacters);
+    for(unsigned int i = 0; i < totalCharacters; i++){
+        glyphFonts[i] = getAtlasGlyphFont(settings->glyphIndices ? 0 : settings->fallback, fontFileData, charCodes[i], settings->divisions, &glyphDivisions[i]);
+    }
+
+    Bitmap* bitmaps = allocateAtlasArray<Bitmap>(allocator, totalBitmaps);
+    GlyphRasterJob job;
+    job.glyphFonts = glyphFonts;
+    job.glyphDivisions = glyphDivisions;
+    job.charCodes = charCodes;
+    job.subpixelPhases = subpixelPhases;
+    job.builtPhases = builtPhases;
+    job.gutter = settings->gutter;
+    job.glyphIndices = settings->glyphIndices;
+    job.fixedPointRaster = settings->fixedPointRaster;
+    job.stats = stats;
+    job.allocator = allocator;
+    job.bitmaps = bitmaps;
+    runParallel(settings->threadPool, rasterizeAtlasGlyph, &job, totalBitmaps);
+    releaseAtlasMemory(allocator, glyphFonts);
+    releaseAtlasMemory(allocator, glyphDivisions);
+
     unsigned int totalAcceptedChars = 0;
-    Bitmap* bitmaps = new Bitmap[totalCharacters];
-    for(int i = 0; i < totalCharacters; i++){
-        unsigned int w, h;
-        float ho, v;
-        unsigned char* dats = getReducedBitmapFromCharCode(fontFileData, charCodes[i], &w, &h, &ho, &v, 32);
-        if(dats){
-            bitmaps[totalAcceptedChars].bytes = dats;
-            bitmaps[totalAcceptedChars].width = w;
-            bitmaps[totalAcceptedChars].height = h;
-            bitmaps[totalAcceptedChars].xShift = ho;
-            bitmaps[totalAcceptedChars].yShift = v;
-            bitmaps[totalAcceptedChars].charCode = charCodes[i];
-            totalAcceptedChars++;
+    for(int i = 0; i < totalBitmaps; i++){
+        if(bitmaps[i].bytes){
+            bitmaps[totalAcceptedChars++] = bitmaps[i];
         }
     }
 
+    //identical bitmaps, say the same digit from two faces, are packed once. the rest are moved to
+    //shared and take the slot of the first one, found through an open addressed table of hashes
+    unsigned int tableSize = 16;
+    while(tableSize < totalAcceptedChars * 2){
+        tableSize *= 2;
+    }
+    int* slotTable = allocateAtlasArray<int>(allocator, tableSize);
+    for(unsigned int i = 0; i < tableSize; i++){
+        slotTable[i] = -1;
+    }
+    Bitmap* shared = allocateAtlasArray<Bitmap>(allocator, totalAcceptedChars);
+    unsigned int totalShared = 0;
+    unsigned int totalSlots = 0;
+    for(unsigned int i = 0; i < totalAcceptedChars; i++){
+        Bitmap b = bitmaps[i];
+        b.hash = getGlyphBitmapHash(b.bytes, b.width, b.height);
+        unsigned int k = b.hash & (tableSize - 1);
+        int match = -1;
+        while(slotTable[k] >= 0){
+            Bitmap* s = &bitmaps[slotTable[k]];
+            if(s->hash == b.hash && s->width == b.width && s->height == b.height && memcmp(s->bytes, b.bytes, b.width * b.height) == 0){
+                match = slotTable[k];
+                break;
+            }
+            k = (k + 1) & (tableSize - 1);
+        }
+        if(match >= 0){
+            b.slot = bitmaps[match].slot;
+            freeBitmapMemory(b.bytes, allocator);
+            b.bytes = 0;
+            shared[totalShared++] = b;
+        }else{
+            b.slot = totalSlots;
+            slotTable[k] = totalSlots;
+            bitmaps[totalSlots++] = b;
+        }
+    }
+    releaseAtlasMemory(allocator, slotTable);
+
     static const unsigned int MAX_SIZE = 20000;
-    sortBitmapsByDescendingArea(bitmaps, totalAcceptedChars);
-    RectNode* node = new RectNode;
+    ATLAS_STATS_START(sortStart);
+    sortBitmapsByDescendingArea(bitmaps, totalSlots);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_SORT, sortStart, 0);
+    ATLAS_STATS_START(packStart);
+    RectNode* node = newAtlasObject<RectNode>(allocator);
     node->rect = Rectangle(0, MAX_SIZE, 0, MAX_SIZE);
-    for(int i = 0; i < totalAcceptedChars; i++){
-        node->add(bitmaps[i]);
+    for(int i = 0; i < totalSlots; i++){
+        node->add(bitmaps[i], allocator);
     }
-    RectangleList rects;
+    RectangleList rects(allocator);
     flattenNodeTree(node, &rects);
-    clearNodeTree(node);
+    clearNodeTree(node, allocator);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_PACK, packStart, 0);
 
-    fa->widths = new unsigned int[totalAcceptedChars];
-    fa->heights = new unsigned int[totalAcceptedChars];
-    fa->xOffsets = new unsigned int[totalAcceptedChars];
-    fa->yOffsets = new unsigned int[totalAcceptedChars];
-    fa->xShifts = new float[totalAcceptedChars];
-    fa->yShifts = new float[totalAcceptedChars];
-    fa->characterCodes = new unsigned short[totalAcceptedChars];  
+    fa->widths = allocateAtlasArray<unsigned int>(allocator, totalAcceptedChars);
+    fa->heights = allocateAtlasArray<unsigned int>(allocator, totalAcceptedChars);
+    fa->xOffsets = allocateAtlasArray<unsigned int>(allocator, totalAcceptedChars);
+    fa->yOffsets = allocateAtlasArray<unsigned int>(allocator, totalAcceptedChars);
+    fa->xShifts = allocateAtlasArray<float>(allocator, totalAcceptedChars);
+    fa->yShifts = allocateAtlasArray<float>(allocator, totalAcceptedChars);
+    fa->characterCodes = allocateAtlasArray<unsigned short>(allocator, totalAcceptedChars);
+    fa->phases = allocateAtlasArray<unsigned char>(allocator, totalAcceptedChars);
+    fa->glyphHashes = allocateAtlasArray<unsigned int>(allocator, totalAcceptedChars);
+    int* slotEntries = allocateAtlasArray<int>(allocator, totalSlots);
+    for(unsigned int i = 0; i < totalSlots; i++){
+        slotEntries[i] = -1;
+    }
 
     unsigned int totalWidth = 0;
     unsigned int totalHeight = 0;
+    unsigned int gutter = settings->gutter;
     for(int i = 0; i < rects.totalRects; i++){
-        fa->widths[i] = rects.get(i).width;
-        fa->heights[i] = rects.get(i).height;
-        fa->xOffsets[i] = rects.get(i).left;
-        fa->yOffsets[i] = rects.get(i).bottom;
+        fa->widths[i] = rects.get(i).width - (2 * gutter);
+        fa->heights[i] = rects.get(i).height - (2 * gutter);
+        fa->xOffsets[i] = rects.get(i).left + gutter;
+        fa->yOffsets[i] = rects.get(i).bottom + gutter;
         fa->characterCodes[i] = rects.get(i).bitmap.charCode;
         fa->xShifts[i] = rects.get(i).bitmap.xShift;
         fa->yShifts[i] = rects.get(i).bitmap.yShift;
+        fa->phases[i] = rects.get(i).bitmap.phase;
+        fa->glyphHashes[i] = rects.get(i).bitmap.hash;
+        slotEntries[rects.get(i).bitmap.slot] = i;
 
         if(rects.get(i).right > totalWidth){
             totalWidth = rects.get(i).right;
@@ -247,19 +765,150 @@ void buildFontAtlas(FontAtlas* fa, unsigned char* fontFileData, unsigned int tot
         }
     }
 
-    unsigned char* bitmapData = new unsigned char[totalWidth * totalHeight];
+    ATLAS_STATS_START(blitStart);
+    unsigned long packedArea = 0;
+    unsigned char* bitmapData = allocateBlitTarget(totalWidth, totalHeight, allocator);
     for(int i = 0; i < rects.totalRects; i++){
-        Rectangle r = rects.get(i);
         Bitmap b = rects.get(i).bitmap;
-        for(int j = r.bottom; j < r.top; j++){
-            for(int k = r.left; k < r.right; k++){
-                bitmapData[(j * totalWidth) + k] = b.bytes[((j - r.bottom) * b.width) + (k - r.left)];
-            }
-        }
+        BlitImage image = genBlitImage(b.bytes, b.width, b.height);
+        blitImage(bitmapData, totalWidth, fa->xOffsets[i], fa->yOffsets[i], &image);
+        packedArea += b.width * b.height;
     }
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_BLIT, blitStart, 0);
+    //bitmaps too big for the packer never made it into rects, so the slots are freed directly
+    for(unsigned int i = 0; i < totalSlots; i++){
+        freeBitmapMemory(bitmaps[i].bytes, allocator);
+    }
+    releaseAtlasMemory(allocator, bitmaps);
 
     fa->bitmap = bitmapData;
     fa->totalBitmapWidth = totalWidth;
     fa->totalBitmapHeight = totalHeight;
-    fa->totalCharacters = totalAcceptedChars;
-}
\ No newline at end of file
+    fa->totalCharacters = rects.totalRects;
+    fa->capacity = totalAcceptedChars;
+    rects.clear();
+    fa->sharedGlyphs = 0;
+    fa->sharedArea = 0;
+    for(unsigned int i = 0; i < totalShared; i++){
+        Bitmap b = shared[i];
+        int e = slotEntries[b.slot];
+        if(e < 0){
+            continue;
+        }
+        addFontAtlasEntry(fa, b.charCode, b.phase, fa->xOffsets[e], fa->yOffsets[e], b.width, b.height, b.xShift, b.yShift, b.hash);
+        fa->sharedGlyphs++;
+        fa->sharedArea += (unsigned long)(b.width + (2 * gutter)) * (b.height + (2 * gutter));
+    }
+    releaseAtlasMemory(allocator, shared);
+    releaseAtlasMemory(allocator, slotEntries);
+    fa->subpixelPhases = subpixelPhases;
+    fa->fontData = fontFileData;
+    fa->fallback = settings->fallback;
+    fa->glyphIndices = settings->glyphIndices;
+    fa->fixedPointRaster = settings->fixedPointRaster;
+    fa->shelfX = 0;
+    fa->shelfY = totalHeight;
+    fa->shelfHeight = 0;
+
+    short ascent, descent, lineGap;
+    getFontVerticalMetrics(fontFileData, &ascent, &descent, &lineGap);
+    fa->divisions = settings->divisions;
+    fa->ascent = (float)ascent / (float)settings->divisions;
+    fa->descent = (float)descent / (float)settings->divisions;
+    fa->lineGap = (float)lineGap / (float)settings->divisions;
+    fa->gutter = gutter;
+    fa->totalMipLevels = 1;
+    fa->mipBitmaps = 0;
+    fa->mipWidths = 0;
+    fa->mipHeights = 0;
+    fa->mipFilter = settings->mipFilter;
+    if(settings->mipLevels > 1){
+        generateFontAtlasMipmaps(fa, settings->mipLevels, settings->mipFilter);
+    }
+    markFontAtlasDirty(fa);
+
+    ATLAS_STATS_SET(stats, packedArea, packedArea);
+    ATLAS_STATS_SET(stats, sharedGlyphs, fa->sharedGlyphs);
+    ATLAS_STATS_SET(stats, sharedArea, fa->sharedArea);
+    ATLAS_STATS_SET(stats, atlasArea, (unsigned long)totalWidth * totalHeight);
+    ATLAS_STATS_SET(stats, allocatedBytes, stats->allocatedBytes + getFontAtlasAllocatedBytes(fa));
+    ATLAS_STATS_SET(stats, wallNanoseconds, getStatsNanoseconds() - buildStart);
+}
+//an atlas with no glyphs yet, for filling with addGlyphToFontAtlas. width fixes the shelf width,
+//the bitmap only grows upwards from there unless a glyph is wider
+void initFontAtlas(FontAtlas* fa, unsigned char* fontFileData, unsigned int width, FontAtlasSettings* settings = 0){
+    FontAtlasSettings defaultSettings = getDefaultFontAtlasSettings();
+    if(!settings){
+        settings = &defaultSettings;
+    }
+    memset(fa, 0, sizeof(FontAtlas));
+    fa->id = -1;
+    fa->totalBitmapWidth = width;
+    fa->subpixelPhases = settings->subpixelPhases ? settings->subpixelPhases : 1;
+    fa->fontData = fontFileData;
+    fa->fallback = settings->fallback;
+    fa->glyphIndices = settings->glyphIndices;
+    fa->fixedPointRaster = settings->fixedPointRaster;
+    fa->allocator = settings->allocator;
+
+    short ascent, descent, lineGap;
+    getFontVerticalMetrics(fontFileData, &ascent, &descent, &lineGap);
+    fa->divisions = settings->divisions;
+    fa->ascent = (float)ascent / (float)settings->divisions;
+    fa->descent = (float)descent / (float)settings->divisions;
+    fa->lineGap = (float)lineGap / (float)settings->divisions;
+    fa->gutter = settings->gutter;
+    fa->totalMipLevels = 1;
+    fa->mipFilter = settings->mipFilter;
+    //the chain is regenerated at full size once the first glyph gives the bitmap a height
+    if(settings->mipLevels > 1){
+        generateFontAtlasMipmaps(fa, settings->mipLevels, settings->mipFilter);
+    }
+}
+
+//deep copy, dst must not hold an atlas. the copy takes its memory from src's allocator
+void copyFontAtlas(FontAtlas* dst, FontAtlas* src){
+    *dst = *src;
+    AtlasAllocator* allocator = src->allocator;
+    unsigned int total = src->totalCharacters;
+    dst->capacity = total;
+    dst->bitmap = allocateAtlasArray<unsigned char>(allocator, src->totalBitmapWidth * src->totalBitmapHeight);
+    if(src->bitmap){
+        memcpy(dst->bitmap, src->bitmap, src->totalBitmapWidth * src->totalBitmapHeight);
+    }
+    dst->characterCodes = allocateAtlasArray<unsigned short>(allocator, total);
+    dst->xOffsets = allocateAtlasArray<unsigned int>(allocator, total);
+    dst->yOffsets = allocateAtlasArray<unsigned int>(allocator, total);
+    dst->widths = allocateAtlasArray<unsigned int>(allocator, total);
+    dst->heights = allocateAtlasArray<unsigned int>(allocator, total);
+    dst->xShifts = allocateAtlasArray<float>(allocator, total);
+    dst->yShifts = allocateAtlasArray<float>(allocator, total);
+    dst->phases = allocateAtlasArray<unsigned char>(allocator, total);
+    dst->glyphHashes = allocateAtlasArray<unsigned int>(allocator, total);
+    memcpy(dst->characterCodes, src->characterCodes, total * sizeof(unsigned short));
+    memcpy(dst->xOffsets, src->xOffsets, total * sizeof(unsigned int));
+    memcpy(dst->yOffsets, src->yOffsets, total * sizeof(unsigned int));
+    memcpy(dst->widths, src->widths, total * sizeof(unsigned int));
+    memcpy(dst->heights, src->heights, total * sizeof(unsigned int));
+    memcpy(dst->xShifts, src->xShifts, total * sizeof(float));
+    memcpy(dst->yShifts, src->yShifts, total * sizeof(float));
+    memcpy(dst->phases, src->phases, total);
+    memcpy(dst->glyphHashes, src->glyphHashes, total * sizeof(unsigned int));
+
+    if(src->mipBitmaps){
+        unsigned int levels = src->totalMipLevels;
+        dst->mipBitmaps = allocateAtlasArray<unsigned char*>(allocator, levels);
+        dst->mipWidths = allocateAtlasArray<unsigned int>(allocator, levels);
+        dst->mipHeights = allocateAtlasArray<unsigned int>(allocator, levels);
+        dst->mipBitmaps[0] = 0;
+        for(unsigned int i = 0; i < levels; i++){
+            dst->mipWidths[i] = src->mipWidths[i];
+            dst->mipHeights[i] = src->mipHeights[i];
+            if(i > 0){
+                unsigned int size = src->mipWidths[i] * src->mipHeights[i];
+                dst->mipBitmaps[i] = allocateAtlasArray<unsigned char>(allocator, size);
+                memcpy(dst->mipBitmaps[i], src->mipBitmaps[i], size);
+            }
+        }
+    }
+}
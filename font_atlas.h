@@ -1,5 +1,55 @@
 #pragma once
 
+struct ThreadPool;
+struct AtlasBuildStats;
+struct FontFallbackChain;
+struct AtlasAllocator;
+
+enum MipmapFilter{
+    MIPMAP_FILTER_BOX,
+    MIPMAP_FILTER_KAISER
+};
+
+struct FontAtlasSettings{
+    unsigned int divisions;
+    ThreadPool* threadPool;
+    AtlasBuildStats* stats;
+    //horizontal subpixel positions per glyph, 1 disables them
+    unsigned int subpixelPhases;
+    //only phase 0 is built up front, the others are rasterized the first time renderText, or a
+    //TextRenderContext with addMissingGlyphs set, needs them
+    bool lazySubpixelPhases;
+    //empty pixels kept around every glyph so filtering and mip levels don't bleed
+    unsigned int gutter;
+    //mip levels including the base bitmap, 1 builds none
+    unsigned int mipLevels;
+    MipmapFilter mipFilter;
+    //characters the font lacks are rasterized from the first chain face that has them
+    FontFallbackChain* fallback;
+    //character codes are glyph indices of the font, for shaped text. the fallback chain is not used
+    bool glyphIndices;
+    //glyphs go through the integer rasterizer of fixed_raster.h, so the atlas comes out the same
+    //bytes on every host. it samples every font unit of a pixel and sets the pixel when at least
+    //half are inside, where the float rasterizer sets it when any sample of its bottom row is, so
+    //glyphs come out slightly thinner than without it
+    bool fixedPointRaster;
+    //where the atlas and the glyphs rasterized for it get their memory, the heap when 0
+    AtlasAllocator* allocator;
+};
+
+//most upload regions kept before the closest pair is merged
+static const unsigned int FONT_ATLAS_MAX_DIRTY_REGIONS = 16;
+
+//texel rectangle in the base level, y counts rows from the start of the bitmap
+struct AtlasRegion{
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+};
+
+//any number of threads may draw from an atlas at once. building it, adding glyphs, making mips
+//and clearing it need it to themselves
 struct FontAtlas{
     unsigned int id;
     unsigned int totalCharacters;
@@ -13,4 +63,50 @@ struct FontAtlas{
     unsigned int* heights;
     float* xShifts;
     float* yShifts;
-};
\ No newline at end of file
+    unsigned char* phases;
+    //content hash of each glyph's bitmap, entries with identical bitmaps share one slot
+    unsigned int* glyphHashes;
+    unsigned int capacity;
+    unsigned int subpixelPhases;
+    unsigned char* fontData;
+    FontFallbackChain* fallback;
+    //characterCodes hold glyph indices
+    bool glyphIndices;
+    bool fixedPointRaster;
+    //owns every array above and the mip levels, copies share it
+    AtlasAllocator* allocator;
+    unsigned int shelfX;
+    unsigned int shelfY;
+    unsigned int shelfHeight;
+    unsigned int gutter;
+    unsigned int totalMipLevels;
+    unsigned char** mipBitmaps;
+    unsigned int* mipWidths;
+    unsigned int* mipHeights;
+    MipmapFilter mipFilter;
+    //texels changed since the backend last uploaded the atlas, cleared by whoever uploads them
+    AtlasRegion dirtyRegions[FONT_ATLAS_MAX_DIRTY_REGIONS];
+    unsigned int totalDirtyRegions;
+    //entries drawn from another entry's slot, and the texels they would have taken with their gutter
+    unsigned int sharedGlyphs;
+    unsigned long sharedArea;
+    unsigned int divisions;
+    float ascent;
+    float descent;
+    float lineGap;
+};
+
+int addGlyphToFontAtlas(FontAtlas* fa, unsigned short charCode, unsigned int phase, unsigned char* bytes, unsigned int width, unsigned int height, float xShift, float yShift);
+unsigned char* getAtlasGlyphFont(FontFallbackChain* fallback, unsigned char* fontData, unsigned short charCode, unsigned int divisions, unsigned int* faceDivisions);
+unsigned char* getAtlasGlyphBitmap(unsigned char* fontData, unsigned short code, bool glyphIndex, bool fixedPoint, unsigned int* width, unsigned int* height, float* xShift, float* yShift, unsigned int divisions, float xOffset, AtlasBuildStats* stats, AtlasAllocator* allocator);
+int addSubpixelGlyphToFontAtlas(FontAtlas* fa, unsigned short charCode, unsigned int phase);
+void initFontAtlas(FontAtlas* fa, unsigned char* fontFileData, unsigned int width, FontAtlasSettings* settings);
+void copyFontAtlas(FontAtlas* dst, FontAtlas* src);
+unsigned long getFontAtlasAllocatedBytes(FontAtlas* fa);
+void markFontAtlasRegionDirty(FontAtlas* fa, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+void markFontAtlasDirty(FontAtlas* fa);
+void clearFontAtlasDirtyRegions(FontAtlas* fa);
+unsigned int getFontAtlasDirtyRegions(FontAtlas* fa, AtlasRegion** regions);
+AtlasRegion getFontAtlasLevelRegion(FontAtlas* fa, AtlasRegion region, unsigned int level);
+unsigned char* getFontAtlasRegionBytes(FontAtlas* fa, AtlasRegion region, unsigned int level, unsigned int* rowPitch);
+void copyFontAtlasRegion(FontAtlas* fa, AtlasRegion region, unsigned int level, unsigned char* dst, unsigned int dstRowPitch);
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <string.h>
+
+#include "truetype_parser.h"
+
+//faces are searched in the order they were added and the first one with a real glyph for a
+//codepoint wins. answers, including misses, are memoized per chain so a codepoint only probes
+//the faces once. faces are font data as returned by loadFontFace and must outlive the chain
+
+struct FontFallbackEntry{
+    unsigned int codepoint;
+    int face;
+    unsigned int glyphIndex;
+    bool used;
+};
+
+struct FontFallbackChain{
+    unsigned char** faces;
+    FontTables* tables;
+    unsigned int* unitsPerEm;
+    unsigned int totalFaces;
+    unsigned int faceCapacity;
+    FontFallbackEntry* entries;
+    unsigned int entryCapacity;
+    unsigned int totalEntries;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+void initFontFallbackChain(FontFallbackChain* chain){
+    memset(chain, 0, sizeof(FontFallbackChain));
+}
+
+static void clearFontFallbackEntries(FontFallbackChain* chain){
+    for(unsigned int i = 0; i < chain->entryCapacity; i++){
+        chain->entries[i].used = false;
+    }
+    chain->totalEntries = 0;
+}
+
+//returns the face's position in the chain
+unsigned int addFontFallbackFace(FontFallbackChain* chain, unsigned char* faceData){
+    if(chain->totalFaces == chain->faceCapacity){
+        unsigned int capacity = chain->faceCapacity ? chain->faceCapacity * 2 : 4;
+        unsigned char** faces = new unsigned char*[capacity];
+        FontTables* tables = new FontTables[capacity];
+        unsigned int* unitsPerEm = new unsigned int[capacity];
+        for(unsigned int i = 0; i < chain->totalFaces; i++){
+            faces[i] = chain->faces[i];
+            tables[i] = chain->tables[i];
+            unitsPerEm[i] = chain->unitsPerEm[i];
+        }
+        if(chain->faces) delete[] chain->faces;
+        if(chain->tables) delete[] chain->tables;
+        if(chain->unitsPerEm) delete[] chain->unitsPerEm;
+        chain->faces = faces;
+        chain->tables = tables;
+        chain->unitsPerEm = unitsPerEm;
+        chain->faceCapacity = capacity;
+    }
+    chain->faces[chain->totalFaces] = faceData;
+    initFontTables(&chain->tables[chain->totalFaces], faceData);
+    chain->unitsPerEm[chain->totalFaces] = chain->tables[chain->totalFaces].head.unitsPerEm();
+
+    //codepoints that were missing everywhere might be in the new face
+    clearFontFallbackEntries(chain);
+    return chain->totalFaces++;
+}
+
+static unsigned int hashFallbackCodepoint(unsigned int codepoint){
+    unsigned int h = codepoint * 0x9e3779b1u;
+    return h ^ (h >> 15);
+}
+
+static void insertFontFallbackEntry(FontFallbackChain* chain, FontFallbackEntry entry){
+    unsigned int mask = chain->entryCapacity - 1;
+    unsigned int i = hashFallbackCodepoint(entry.codepoint) & mask;
+    while(chain->entries[i].used){
+        i = (i + 1) & mask;
+    }
+    chain->entries[i] = entry;
+    chain->totalEntries++;
+}
+
+static void growFontFallbackEntries(FontFallbackChain* chain){
+    FontFallbackEntry* old = chain->entries;
+    unsigned int oldCapacity = chain->entryCapacity;
+    chain->entryCapacity = oldCapacity ? oldCapacity * 2 : 256;
+    chain->entries = new FontFallbackEntry[chain->entryCapacity];
+    chain->totalEntries = 0;
+    for(unsigned int i = 0; i < chain->entryCapacity; i++){
+        chain->entries[i].used = false;
+    }
+    for(unsigned int i = 0; i < oldCapacity; i++){
+        if(old[i].used){
+            insertFontFallbackEntry(chain, old[i]);
+        }
+    }
+    if(old) delete[] old;
+}
+
+static bool faceHasGlyph(FontTables* ft, unsigned int codepoint, unsigned int* glyphIndex){
+    //the cmap reader only understands the basic multilingual plane
+    if(codepoint > 0xffff){
+        return false;
+    }
+    unsigned int index = getGlyphIndexFromTables(ft, (unsigned short)codepoint);
+    if(index == 0 || index >= ft->numGlyphs){
+        return false;
+    }
+    *glyphIndex = index;
+    return true;
+}
+
+//returns the chain position of the face to draw the codepoint with, or -1 when none has it
+int resolveFontFallback(FontFallbackChain* chain, unsigned int codepoint, unsigned int* glyphIndex){
+    if(chain->entryCapacity){
+        unsigned int mask = chain->entryCapacity - 1;
+        unsigned int i = hashFallbackCodepoint(codepoint) & mask;
+        while(chain->entries[i].used){
+            if(chain->entries[i].codepoint == codepoint){
+                chain->hits++;
+                *glyphIndex = chain->entries[i].glyphIndex;
+                return chain->entries[i].face;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+    chain->misses++;
+
+    FontFallbackEntry entry;
+    entry.codepoint = codepoint;
+    entry.face = -1;
+    entry.glyphIndex = 0;
+    entry.used = true;
+    for(unsigned int i = 0; i < chain->totalFaces; i++){
+        if(faceHasGlyph(&chain->tables[i], codepoint, &entry.glyphIndex)){
+            entry.face = i;
+            break;
+        }
+    }
+
+    if((chain->totalEntries + 1) * 2 > chain->entryCapacity){
+        growFontFallbackEntries(chain);
+    }
+    insertFontFallbackEntry(chain, entry);
+    *glyphIndex = entry.glyphIndex;
+    return entry.face;
+}
+
+void destroyFontFallbackChain(FontFallbackChain* chain){
+    for(unsigned int i = 0; i < chain->totalFaces; i++){
+        freeFontTables(&chain->tables[i]);
+    }
+    if(chain->faces) delete[] chain->faces;
+    if(chain->tables) delete[] chain->tables;
+    if(chain->unitsPerEm) delete[] chain->unitsPerEm;
+    if(chain->entries) delete[] chain->entries;
+    initFontFallbackChain(chain);
+}
@@ -0,0 +1,708 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "truetype_parser.h"
+#include "font_fallback.h"
+
+//resolution independent glyph outlines. the quadratic curves are kept exactly as the font stores
+//them, split where they turn around in x or y so every piece is monotonic, and sorted into
+//horizontal and vertical bands. a coverage query casts one ray along x through the sample's
+//horizontal band and one along y through its vertical band, so it only visits the curves that
+//can cross those rays instead of every edge of the glyph. straight segments are stored as curves
+//with the control point halfway along them.
+//the curves, band offsets and band lists live in a single block so an outline can be written
+//out and read back with plain copies. the serialized form uses the byte order of the machine
+//that wrote it, like the atlas bitmaps it sits next to
+
+static const unsigned int BANDED_OUTLINE_MAGIC = 0x444e4247;
+static const unsigned int BANDED_OUTLINE_SET_MAGIC = 0x534e4247;
+static const unsigned int BANDED_OUTLINE_VERSION = 1;
+static const unsigned int BANDED_OUTLINE_MAX_BANDS = 16;
+
+struct QuadCurve{
+    float x1;
+    float y1;
+    float cx;
+    float cy;
+    float x2;
+    float y2;
+};
+
+struct BandedOutline{
+    short xMin;
+    short xMax;
+    short yMin;
+    short yMax;
+    unsigned short advance;
+    unsigned short unitsPerEm;
+    //extent of the curves themselves, which the bands divide evenly
+    float bandXMin;
+    float bandYMin;
+    float bandWidth;
+    float bandHeight;
+    unsigned int totalCurves;
+    unsigned int hBands;
+    unsigned int vBands;
+    unsigned int hReferences;
+    unsigned int vReferences;
+    //curves, then hBands + 1 offsets into hBandCurves, hBandCurves, then the same for the vertical bands
+    unsigned char* data;
+    unsigned long bytes;
+    QuadCurve* curves;
+    unsigned int* hBandStarts;
+    unsigned int* hBandCurves;
+    unsigned int* vBandStarts;
+    unsigned int* vBandCurves;
+};
+
+//every outline of an atlas' characters, the form they are cached and saved in
+struct BandedOutlineSet{
+    unsigned int totalOutlines;
+    unsigned short* characterCodes;
+    BandedOutline* outlines;
+};
+
+struct QuadCurveList{
+    QuadCurve* curves;
+    unsigned int total;
+    unsigned int capacity;
+};
+
+static void pushQuadCurve(QuadCurveList* list, QuadCurve c){
+    if(c.x1 == c.x2 && c.y1 == c.y2 && c.x1 == c.cx && c.y1 == c.cy){
+        return;
+    }
+    if(list->total == list->capacity){
+        unsigned int capacity = list->capacity ? list->capacity * 2 : 32;
+        QuadCurve* curves = new QuadCurve[capacity];
+        for(unsigned int i = 0; i < list->total; i++){
+            curves[i] = list->curves[i];
+        }
+        if(list->curves) delete[] list->curves;
+        list->curves = curves;
+        list->capacity = capacity;
+    }
+    //rounding in the splits can push the control point just past an end, which would let a piece turn around
+    float lo = c.x1 < c.x2 ? c.x1 : c.x2, hi = c.x1 < c.x2 ? c.x2 : c.x1;
+    c.cx = c.cx < lo ? lo : (c.cx > hi ? hi : c.cx);
+    lo = c.y1 < c.y2 ? c.y1 : c.y2, hi = c.y1 < c.y2 ? c.y2 : c.y1;
+    c.cy = c.cy < lo ? lo : (c.cy > hi ? hi : c.cy);
+    list->curves[list->total++] = c;
+}
+
+//where the curve turns around along one axis, or 0 if it doesn't inside (0, 1)
+static float getQuadCurveExtremum(float p1, float c, float p2){
+    float d = p1 - (2 * c) + p2;
+    if(d == 0){
+        return 0;
+    }
+    float t = (p1 - c) / d;
+    return t > 0 && t < 1 ? t : 0;
+}
+
+static void splitQuadCurve(QuadCurve c, float t, QuadCurve* first, QuadCurve* second){
+    float ax = c.x1 + ((c.cx - c.x1) * t), ay = c.y1 + ((c.cy - c.y1) * t);
+    float bx = c.cx + ((c.x2 - c.cx) * t), by = c.cy + ((c.y2 - c.cy) * t);
+    float mx = ax + ((bx - ax) * t), my = ay + ((by - ay) * t);
+    QuadCurve f = {c.x1, c.y1, ax, ay, mx, my};
+    QuadCurve s = {mx, my, bx, by, c.x2, c.y2};
+    *first = f;
+    *second = s;
+}
+
+static void addMonotonicQuadCurves(QuadCurveList* list, float x1, float y1, float cx, float cy, float x2, float y2){
+    QuadCurve c = {x1, y1, cx, cy, x2, y2};
+    float tx = getQuadCurveExtremum(x1, cx, x2);
+    float ty = getQuadCurveExtremum(y1, cy, y2);
+    float t1 = tx < ty ? tx : ty;
+    float t2 = tx < ty ? ty : tx;
+    if(t1 == 0){
+        t1 = t2;
+        t2 = 0;
+    }
+    if(t1 == 0){
+        pushQuadCurve(list, c);
+        return;
+    }
+    QuadCurve first, rest;
+    splitQuadCurve(c, t1, &first, &rest);
+    pushQuadCurve(list, first);
+    if(t2 != 0 && t2 != t1){
+        splitQuadCurve(rest, (t2 - t1) / (1 - t1), &first, &rest);
+        pushQuadCurve(list, first);
+    }
+    pushQuadCurve(list, rest);
+}
+
+//walks each contour from an on curve point, pairing off curve points with the implied on curve
+//midpoints between them the same way getGlyphLines does
+static void getGlyphQuadCurves(GlyphShape* gs, QuadCurveList* list){
+    for(int i = 0; i < gs->numContours; i++){
+        int start = i == 0 ? 0 : gs->contourEndPoints[i - 1] + 1;
+        int end = gs->contourEndPoints[i] + 1;
+        int count = end - start;
+        if(count < 2){
+            continue;
+        }
+
+        int first = 0;
+        while(first < count && !gs->points[start + first].onCurve){
+            first++;
+        }
+        float px, py;
+        if(first == count){
+            //no point is on the curve, start from the midpoint between the last and first points
+            first = count - 1;
+            GlyphPoint a = gs->points[end - 1], b = gs->points[start];
+            px = (a.x + b.x) * 0.5f;
+            py = (a.y + b.y) * 0.5f;
+        }else{
+            px = gs->points[start + first].x;
+            py = gs->points[start + first].y;
+        }
+        float sx = px, sy = py;
+
+        bool pending = false;
+        float ox = 0, oy = 0;
+        for(int j = 1; j <= count; j++){
+            GlyphPoint p = gs->points[start + ((first + j) % count)];
+            if(p.onCurve){
+                if(pending){
+                    addMonotonicQuadCurves(list, px, py, ox, oy, p.x, p.y);
+                }else{
+                    addMonotonicQuadCurves(list, px, py, (px + p.x) * 0.5f, (py + p.y) * 0.5f, p.x, p.y);
+                }
+                px = p.x;
+                py = p.y;
+                pending = false;
+            }else{
+                if(pending){
+                    float mx = (ox + p.x) * 0.5f, my = (oy + p.y) * 0.5f;
+                    addMonotonicQuadCurves(list, px, py, ox, oy, mx, my);
+                    px = mx;
+                    py = my;
+                }
+                ox = p.x;
+                oy = p.y;
+                pending = true;
+            }
+        }
+        if(pending){
+            addMonotonicQuadCurves(list, px, py, ox, oy, sx, sy);
+        }
+    }
+}
+
+static void setBandedOutlinePointers(BandedOutline* bo){
+    unsigned char* p = bo->data;
+    bo->curves = (QuadCurve*)p;
+    p += bo->totalCurves * sizeof(QuadCurve);
+    bo->hBandStarts = (unsigned int*)p;
+    p += (bo->hBands + 1) * sizeof(unsigned int);
+    bo->hBandCurves = (unsigned int*)p;
+    p += bo->hReferences * sizeof(unsigned int);
+    bo->vBandStarts = (unsigned int*)p;
+    p += (bo->vBands + 1) * sizeof(unsigned int);
+    bo->vBandCurves = (unsigned int*)p;
+}
+
+static unsigned long getBandedOutlineDataSize(BandedOutline* bo){
+    return ((unsigned long)bo->totalCurves * sizeof(QuadCurve)) +
+           (((unsigned long)bo->hBands + 1 + bo->hReferences + bo->vBands + 1 + bo->vReferences) * sizeof(unsigned int));
+}
+
+static inline unsigned int getOutlineBand(float v, float origin, float size, unsigned int bands){
+    float b = (v - origin) / size;
+    if(b <= 0){
+        return 0;
+    }
+    unsigned int i = (unsigned int)b;
+    return i < bands ? i : bands - 1;
+}
+
+//counts (starts == 0) or fills the band lists for one axis, then sorts each band by the far
+//end of its curves so queries can stop once the rest of the band is behind the sample
+static unsigned int fillOutlineBands(BandedOutline* bo, bool horizontal, unsigned int* starts, unsigned int* lists){
+    unsigned int bands = horizontal ? bo->hBands : bo->vBands;
+    float origin = horizontal ? bo->bandYMin : bo->bandXMin;
+    float size = horizontal ? bo->bandHeight : bo->bandWidth;
+    unsigned int total = 0;
+    for(unsigned int b = 0; b < bands; b++){
+        if(starts){
+            starts[b] = total;
+        }
+        for(unsigned int i = 0; i < bo->totalCurves; i++){
+            QuadCurve* c = &bo->curves[i];
+            float lo = horizontal ? (c->y1 < c->y2 ? c->y1 : c->y2) : (c->x1 < c->x2 ? c->x1 : c->x2);
+            float hi = horizontal ? (c->y1 < c->y2 ? c->y2 : c->y1) : (c->x1 < c->x2 ? c->x2 : c->x1);
+            if(getOutlineBand(lo, origin, size, bands) <= b && getOutlineBand(hi, origin, size, bands) >= b){
+                if(lists){
+                    lists[total] = i;
+                }
+                total++;
+            }
+        }
+        if(lists){
+            for(unsigned int i = starts[b] + 1; i < total; i++){
+                unsigned int curve = lists[i];
+                QuadCurve* c = &bo->curves[curve];
+                float end = horizontal ? (c->x1 > c->x2 ? c->x1 : c->x2) : (c->y1 > c->y2 ? c->y1 : c->y2);
+                unsigned int j = i;
+                while(j > starts[b]){
+                    QuadCurve* p = &bo->curves[lists[j - 1]];
+                    float pEnd = horizontal ? (p->x1 > p->x2 ? p->x1 : p->x2) : (p->y1 > p->y2 ? p->y1 : p->y2);
+                    if(pEnd >= end){
+                        break;
+                    }
+                    lists[j] = lists[j - 1];
+                    j--;
+                }
+                lists[j] = curve;
+            }
+        }
+    }
+    if(starts){
+        starts[bands] = total;
+    }
+    return total;
+}
+
+//bands 0 picks a count from the number of curves
+void buildBandedOutline(BandedOutline* bo, GlyphShape* gs, unsigned short advance, unsigned short unitsPerEm, unsigned int bands = 0){
+    memset(bo, 0, sizeof(BandedOutline));
+    bo->xMin = gs->xMin;
+    bo->xMax = gs->xMax;
+    bo->yMin = gs->yMin;
+    bo->yMax = gs->yMax;
+    bo->advance = advance;
+    bo->unitsPerEm = unitsPerEm;
+
+    QuadCurveList list = {0, 0, 0};
+    //composite glyphs aren't parsed yet and come back without contours
+    if((short)gs->numContours > 0){
+        getGlyphQuadCurves(gs, &list);
+    }
+
+    float xMin = 0, yMin = 0, xMax = 0, yMax = 0;
+    for(unsigned int i = 0; i < list.total; i++){
+        QuadCurve* c = &list.curves[i];
+        float cxMin = c->x1 < c->x2 ? c->x1 : c->x2, cxMax = c->x1 < c->x2 ? c->x2 : c->x1;
+        float cyMin = c->y1 < c->y2 ? c->y1 : c->y2, cyMax = c->y1 < c->y2 ? c->y2 : c->y1;
+        if(i == 0 || cxMin < xMin) xMin = cxMin;
+        if(i == 0 || cyMin < yMin) yMin = cyMin;
+        if(i == 0 || cxMax > xMax) xMax = cxMax;
+        if(i == 0 || cyMax > yMax) yMax = cyMax;
+    }
+
+    if(!bands){
+        bands = (list.total + 7) / 8;
+    }
+    if(bands > BANDED_OUTLINE_MAX_BANDS){
+        bands = BANDED_OUTLINE_MAX_BANDS;
+    }
+    if(bands < 1){
+        bands = 1;
+    }
+    bo->totalCurves = list.total;
+    bo->hBands = bands;
+    bo->vBands = bands;
+    bo->bandXMin = xMin;
+    bo->bandYMin = yMin;
+    bo->bandWidth = xMax > xMin ? (xMax - xMin) / bands : 1;
+    bo->bandHeight = yMax > yMin ? (yMax - yMin) / bands : 1;
+
+    //curves are copied first so the band lists can be counted and sorted against them
+    bo->curves = list.curves;
+    bo->hReferences = fillOutlineBands(bo, true, 0, 0);
+    bo->vReferences = fillOutlineBands(bo, false, 0, 0);
+
+    bo->bytes = getBandedOutlineDataSize(bo);
+    bo->data = new unsigned char[bo->bytes];
+    setBandedOutlinePointers(bo);
+    if(list.total){
+        memcpy(bo->curves, list.curves, list.total * sizeof(QuadCurve));
+    }
+    fillOutlineBands(bo, true, bo->hBandStarts, bo->hBandCurves);
+    fillOutlineBands(bo, false, bo->vBandStarts, bo->vBandCurves);
+
+    if(list.curves){
+        delete[] list.curves;
+    }
+}
+
+void buildBandedOutlineFromIndex(BandedOutline* bo, unsigned char* fontData, unsigned int glyphIndex, unsigned int bands = 0){
+    GlyphShape gs;
+    getGlyphShapeFromIndex(fontData, glyphIndex, &gs);
+    buildBandedOutline(bo, &gs, getGlyphAdvanceFromIndex(fontData, glyphIndex), getUnitsPerEm(fontData), bands);
+    freeGlyphShape(&gs);
+}
+
+void freeBandedOutline(BandedOutline* bo){
+    if(bo->data){
+        delete[] bo->data;
+    }
+    memset(bo, 0, sizeof(BandedOutline));
+}
+
+//t where a curve that is monotonic along this axis reaches v, a is p1 - 2c + p2 and b is p1 - c
+static inline float solveMonotonicQuadCurve(float p1, float c, float p2, float v){
+    float a = p1 - (2 * c) + p2;
+    float b = p1 - c;
+    float d = p1 - v;
+    float t;
+    if(fabsf(a) < 1e-4f * (fabsf(b) + 1e-4f)){
+        t = b != 0 ? d / (2 * b) : 0.5f;
+    }else{
+        float disc = (b * b) - (a * d);
+        float root = sqrtf(disc > 0 ? disc : 0);
+        float q = b + (b < 0 ? -root : root);
+        float t1 = q / a;
+        float t2 = q != 0 ? d / q : t1;
+        t = (t1 >= -1e-4f && t1 <= 1.0001f) ? t1 : t2;
+    }
+    return t < 0 ? 0 : (t > 1 ? 1 : t);
+}
+
+static inline float evaluateQuadCurve(float p1, float c, float p2, float t){
+    float s = 1 - t;
+    return (s * s * p1) + (2 * s * t * c) + (t * t * p2);
+}
+
+//signed coverage of a ray from (x, y) towards +x when the ray is filtered over width font units,
+//exact winding numbers when width is 0
+static float getHorizontalBandWinding(BandedOutline* bo, float x, float y, float width){
+    if(y < bo->bandYMin || y > bo->bandYMin + (bo->bandHeight * bo->hBands)){
+        return 0;
+    }
+    unsigned int b = getOutlineBand(y, bo->bandYMin, bo->bandHeight, bo->hBands);
+    float reach = x - (width * 0.5f);
+    float winding = 0;
+    for(unsigned int i = bo->hBandStarts[b]; i < bo->hBandStarts[b + 1]; i++){
+        QuadCurve* c = &bo->curves[bo->hBandCurves[i]];
+        if((c->x1 > c->x2 ? c->x1 : c->x2) < reach){
+            break;
+        }
+        float dir;
+        if(c->y1 <= y && c->y2 > y){
+            dir = 1;
+        }else if(c->y2 <= y && c->y1 > y){
+            dir = -1;
+        }else{
+            continue;
+        }
+        float xCrs = evaluateQuadCurve(c->x1, c->cx, c->x2, solveMonotonicQuadCurve(c->y1, c->cy, c->y2, y));
+        if(width > 0){
+            float f = ((xCrs - x) / width) + 0.5f;
+            winding += dir * (f < 0 ? 0 : (f > 1 ? 1 : f));
+        }else if(xCrs > x){
+            winding += dir;
+        }
+    }
+    return winding;
+}
+
+static float getVerticalBandWinding(BandedOutline* bo, float x, float y, float height){
+    if(x < bo->bandXMin || x > bo->bandXMin + (bo->bandWidth * bo->vBands)){
+        return 0;
+    }
+    unsigned int b = getOutlineBand(x, bo->bandXMin, bo->bandWidth, bo->vBands);
+    float reach = y - (height * 0.5f);
+    float winding = 0;
+    for(unsigned int i = bo->vBandStarts[b]; i < bo->vBandStarts[b + 1]; i++){
+        QuadCurve* c = &bo->curves[bo->vBandCurves[i]];
+        if((c->y1 > c->y2 ? c->y1 : c->y2) < reach){
+            break;
+        }
+        float dir;
+        if(c->x1 <= x && c->x2 > x){
+            dir = 1;
+        }else if(c->x2 <= x && c->x1 > x){
+            dir = -1;
+        }else{
+            continue;
+        }
+        float yCrs = evaluateQuadCurve(c->y1, c->cy, c->y2, solveMonotonicQuadCurve(c->x1, c->cx, c->x2, x));
+        if(height > 0){
+            float f = ((yCrs - y) / height) + 0.5f;
+            winding += dir * (f < 0 ? 0 : (f > 1 ? 1 : f));
+        }else if(yCrs > y){
+            winding += dir;
+        }
+    }
+    return winding;
+}
+
+//nonzero fill rule at a point in font units
+bool isInsideBandedOutline(BandedOutline* bo, float x, float y){
+    return getHorizontalBandWinding(bo, x, y, 0) != 0;
+}
+
+//fraction of a pixel of pixelUnits font units centered on (x, y) covered by the glyph,
+//averaged from one filtered ray along each axis
+float getBandedOutlineCoverage(BandedOutline* bo, float x, float y, float pixelUnits){
+    float h = fabsf(getHorizontalBandWinding(bo, x, y, pixelUnits));
+    float v = fabsf(getVerticalBandWinding(bo, x, y, pixelUnits));
+    h = h > 1 ? 1 : h;
+    v = v > 1 ? 1 : v;
+    return (h + v) * 0.5f;
+}
+
+//rasterizes coverage at any size with row 0 at the bottom like the atlas bitmaps.
+//xShift and yShift get the pen advance and baseline to bitmap bottom in pixels
+unsigned char* getBitmapFromBandedOutline(BandedOutline* bo, float pixelsPerEm, unsigned int* width, unsigned int* height, float* xShift, float* yShift){
+    float unitsPerPixel = (float)bo->unitsPerEm / pixelsPerEm;
+    *width = (unsigned int)((bo->xMax - bo->xMin) / unitsPerPixel) + 1;
+    *height = (unsigned int)((bo->yMax - bo->yMin) / unitsPerPixel) + 1;
+    *xShift = bo->advance / unitsPerPixel;
+    *yShift = bo->yMin / unitsPerPixel;
+
+    unsigned char* bitmap = new unsigned char[*width * *height];
+    unsigned int ctr = 0;
+    for(unsigned int i = 0; i < *height; i++){
+        float y = bo->yMin + ((i + 0.5f) * unitsPerPixel);
+        for(unsigned int j = 0; j < *width; j++){
+            float x = bo->xMin + ((j + 0.5f) * unitsPerPixel);
+            bitmap[ctr++] = (unsigned char)((getBandedOutlineCoverage(bo, x, y, unitsPerPixel) * 255) + 0.5f);
+        }
+    }
+    return bitmap;
+}
+
+struct BandedOutlineHeader{
+    unsigned int magic;
+    unsigned int version;
+    short xMin;
+    short xMax;
+    short yMin;
+    short yMax;
+    unsigned short advance;
+    unsigned short unitsPerEm;
+    float bandXMin;
+    float bandYMin;
+    float bandWidth;
+    float bandHeight;
+    unsigned int totalCurves;
+    unsigned int hBands;
+    unsigned int vBands;
+    unsigned int hReferences;
+    unsigned int vReferences;
+};
+
+unsigned long getBandedOutlineSize(BandedOutline* bo){
+    return sizeof(BandedOutlineHeader) + bo->bytes;
+}
+
+//writes getBandedOutlineSize bytes
+unsigned long writeBandedOutline(BandedOutline* bo, unsigned char* out){
+    BandedOutlineHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = BANDED_OUTLINE_MAGIC;
+    h.version = BANDED_OUTLINE_VERSION;
+    h.xMin = bo->xMin;
+    h.xMax = bo->xMax;
+    h.yMin = bo->yMin;
+    h.yMax = bo->yMax;
+    h.advance = bo->advance;
+    h.unitsPerEm = bo->unitsPerEm;
+    h.bandXMin = bo->bandXMin;
+    h.bandYMin = bo->bandYMin;
+    h.bandWidth = bo->bandWidth;
+    h.bandHeight = bo->bandHeight;
+    h.totalCurves = bo->totalCurves;
+    h.hBands = bo->hBands;
+    h.vBands = bo->vBands;
+    h.hReferences = bo->hReferences;
+    h.vReferences = bo->vReferences;
+    memcpy(out, &h, sizeof(h));
+    memcpy(out + sizeof(h), bo->data, bo->bytes);
+    return sizeof(h) + bo->bytes;
+}
+
+//returns the bytes read, or 0 if the data isn't a complete outline of this version
+unsigned long readBandedOutline(BandedOutline* bo, const unsigned char* in, unsigned long size){
+    BandedOutlineHeader h;
+    if(size < sizeof(h)){
+        return 0;
+    }
+    memcpy(&h, in, sizeof(h));
+    if(h.magic != BANDED_OUTLINE_MAGIC || h.version != BANDED_OUTLINE_VERSION ||
+       h.hBands < 1 || h.hBands > BANDED_OUTLINE_MAX_BANDS || h.vBands < 1 || h.vBands > BANDED_OUTLINE_MAX_BANDS){
+        return 0;
+    }
+    //getOutlineBand divides by the band sizes and casts the result, which only works out for finite sizes above 0
+    if(!isfinite(h.bandXMin) || !isfinite(h.bandYMin) || !isfinite(h.bandWidth) || !isfinite(h.bandHeight) ||
+       !(h.bandWidth > 0) || !(h.bandHeight > 0)){
+        return 0;
+    }
+    //no count can be more than the data holds, which also keeps the size sum from overflowing
+    unsigned long available = size - sizeof(h);
+    if(h.totalCurves > available / sizeof(QuadCurve) || h.hReferences > available / sizeof(unsigned int) ||
+       h.vReferences > available / sizeof(unsigned int)){
+        return 0;
+    }
+    BandedOutline read;
+    memset(&read, 0, sizeof(read));
+    read.totalCurves = h.totalCurves;
+    read.hBands = h.hBands;
+    read.vBands = h.vBands;
+    read.hReferences = h.hReferences;
+    read.vReferences = h.vReferences;
+    read.bytes = getBandedOutlineDataSize(&read);
+    if(available < read.bytes){
+        return 0;
+    }
+
+    read.xMin = h.xMin;
+    read.xMax = h.xMax;
+    read.yMin = h.yMin;
+    read.yMax = h.yMax;
+    read.advance = h.advance;
+    read.unitsPerEm = h.unitsPerEm;
+    read.bandXMin = h.bandXMin;
+    read.bandYMin = h.bandYMin;
+    read.bandWidth = h.bandWidth;
+    read.bandHeight = h.bandHeight;
+    read.data = new unsigned char[read.bytes];
+    memcpy(read.data, in + sizeof(h), read.bytes);
+    setBandedOutlinePointers(&read);
+
+    //band data indexes the curves directly, so it is checked once here instead of on every query
+    bool valid = read.hBandStarts[read.hBands] == read.hReferences && read.vBandStarts[read.vBands] == read.vReferences;
+    for(unsigned int i = 0; valid && i < read.hBands; i++){
+        valid = read.hBandStarts[i] <= read.hBandStarts[i + 1];
+    }
+    for(unsigned int i = 0; valid && i < read.vBands; i++){
+        valid = read.vBandStarts[i] <= read.vBandStarts[i + 1];
+    }
+    for(unsigned int i = 0; valid && i < read.hReferences; i++){
+        valid = read.hBandCurves[i] < read.totalCurves;
+    }
+    for(unsigned int i = 0; valid && i < read.vReferences; i++){
+        valid = read.vBandCurves[i] < read.totalCurves;
+    }
+    if(!valid){
+        delete[] read.data;
+        return 0;
+    }
+    *bo = read;
+    return sizeof(h) + read.bytes;
+}
+
+//outlines come from the atlas' font, or the first fallback face that has the character
+void buildFontAtlasBandedOutlines(BandedOutlineSet* set, FontAtlas* fa, unsigned int bands = 0){
+    set->totalOutlines = 0;
+    set->characterCodes = new unsigned short[fa->totalCharacters];
+    set->outlines = new BandedOutline[fa->totalCharacters];
+    for(unsigned int i = 0; i < fa->totalCharacters; i++){
+        if(fa->phases && fa->phases[i] != 0){
+            continue;
+        }
+        unsigned short code = fa->characterCodes[i];
+        unsigned char* fontData = fa->fontData;
+        unsigned int glyphIndex = 0;
+        int face = fa->fallback && !fa->glyphIndices ? resolveFontFallback(fa->fallback, code, &glyphIndex) : -1;
+        if(face >= 0){
+            fontData = fa->fallback->faces[face];
+        }else if(fa->glyphIndices){
+            glyphIndex = code;
+        }else{
+            glyphIndex = getGlyphIndex(fontData, code);
+        }
+        set->characterCodes[set->totalOutlines] = code;
+        buildBandedOutlineFromIndex(&set->outlines[set->totalOutlines], fontData, glyphIndex, bands);
+        set->totalOutlines++;
+    }
+}
+
+BandedOutline* findBandedOutline(BandedOutlineSet* set, unsigned short characterCode){
+    for(unsigned int i = 0; i < set->totalOutlines; i++){
+        if(set->characterCodes[i] == characterCode){
+            return &set->outlines[i];
+        }
+    }
+    return 0;
+}
+
+void freeBandedOutlineSet(BandedOutlineSet* set){
+    for(unsigned int i = 0; i < set->totalOutlines; i++){
+        freeBandedOutline(&set->outlines[i]);
+    }
+    if(set->characterCodes) delete[] set->characterCodes;
+    if(set->outlines) delete[] set->outlines;
+    set->characterCodes = 0;
+    set->outlines = 0;
+    set->totalOutlines = 0;
+}
+
+bool writeBandedOutlineSet(BandedOutlineSet* set, const char* fileName){
+    FILE* file = fopen(fileName, "wb");
+    if(!file){
+        return false;
+    }
+    unsigned int header[3] = {BANDED_OUTLINE_SET_MAGIC, BANDED_OUTLINE_VERSION, set->totalOutlines};
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+    for(unsigned int i = 0; ok && i < set->totalOutlines; i++){
+        unsigned long size = getBandedOutlineSize(&set->outlines[i]);
+        unsigned char* bytes = new unsigned char[size];
+        writeBandedOutline(&set->outlines[i], bytes);
+        unsigned int entry[2] = {set->characterCodes[i], (unsigned int)size};
+        ok = fwrite(entry, sizeof(entry), 1, file) == 1 && fwrite(bytes, 1, size, file) == size;
+        delete[] bytes;
+    }
+    return fclose(file) == 0 && ok;
+}
+
+bool readBandedOutlineSet(BandedOutlineSet* set, const char* fileName){
+    set->totalOutlines = 0;
+    set->characterCodes = 0;
+    set->outlines = 0;
+    FILE* file = fopen(fileName, "rb");
+    if(!file){
+        return false;
+    }
+    //counts and sizes come from the file, so none may claim more than the bytes left in it
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned long remaining = fileSize > 0 ? (unsigned long)fileSize : 0;
+
+    unsigned int header[3];
+    bool ok = remaining >= sizeof(header) && fread(header, sizeof(header), 1, file) == 1 &&
+              header[0] == BANDED_OUTLINE_SET_MAGIC && header[1] == BANDED_OUTLINE_VERSION;
+    if(ok){
+        remaining -= sizeof(header);
+        ok = header[2] <= remaining / ((2 * sizeof(unsigned int)) + sizeof(BandedOutlineHeader));
+    }
+    if(ok){
+        set->characterCodes = new unsigned short[header[2]];
+        set->outlines = new BandedOutline[header[2]];
+    }
+    for(unsigned int i = 0; ok && i < header[2]; i++){
+        unsigned int entry[2];
+        ok = remaining >= sizeof(entry) && fread(entry, sizeof(entry), 1, file) == 1;
+        if(ok){
+            remaining -= sizeof(entry);
+            ok = entry[1] <= remaining;
+        }
+        if(!ok){
+            break;
+        }
+        remaining -= entry[1];
+        unsigned char* bytes = new unsigned char[entry[1]];
+        ok = fread(bytes, 1, entry[1], file) == entry[1] &&
+             readBandedOutline(&set->outlines[i], bytes, entry[1]) == entry[1];
+        delete[] bytes;
+        if(ok){
+            set->characterCodes[i] = (unsigned short)entry[0];
+            set->totalOutlines++;
+        }
+    }
+    fclose(file);
+    if(!ok){
+        freeBandedOutlineSet(set);
+    }
+    return ok;
+}
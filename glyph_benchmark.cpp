@@ -0,0 +1,400 @@
+#include "font_atlas.cpp"
+#include "truetype_parser.h"
+#include "text_renderer.h"
+#include "thread_pool.h"
+#include "atlas_compression.h"
+#include "graphics_math.h"
+#include "glyph_bands.h"
+#include "fixed_raster.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+
+static unsigned long totalAllocations = 0;
+static unsigned long totalAllocatedBytes = 0;
+
+//the replacements below pair malloc with free, which gcc can't see through once it inlines them
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size){
+    __sync_fetch_and_add(&totalAllocations, 1);
+    __sync_fetch_and_add(&totalAllocatedBytes, size);
+    void* p = malloc(size ? size : 1);
+    if(!p){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size){
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept{
+    free(p);
+}
+
+#pragma GCC diagnostic pop
+
+struct BenchmarkSample{
+    unsigned long glyphs;
+    unsigned long iterations;
+    unsigned long nanoseconds;
+    unsigned long allocations;
+    unsigned long allocatedBytes;
+};
+
+struct BenchmarkRun{
+    const char* font;
+    unsigned char* fontData;
+    unsigned short* charCodes;
+    unsigned int totalChars;
+    unsigned int divisions;
+    unsigned int threads;
+    ThreadPool* pool;
+};
+
+typedef unsigned long (*BenchmarkStage)(BenchmarkRun* run);
+
+static const unsigned long MIN_BENCHMARK_NANOSECONDS = 200000000;
+static bool firstResult = true;
+
+static unsigned long getTimeNanoseconds(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((unsigned long)ts.tv_sec * 1000000000ul) + ts.tv_nsec;
+}
+
+static unsigned char* loadFontFile(const char* fileName){
+    FILE* file = fopen(fileName, "rb");
+    if(!file){
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char* data = new unsigned char[size];
+    if(fread(data, 1, size, file) != (size_t)size){
+        delete[] data;
+        data = 0;
+    }
+    fclose(file);
+    return data;
+}
+
+//each stage returns the number of glyphs it processed
+static unsigned long benchGlyphIndex(BenchmarkRun* run){
+    volatile unsigned int sink = 0;
+    for(int i = 0; i < run->totalChars; i++){
+        sink += getGlyphIndex(run->fontData, run->charCodes[i]);
+    }
+    return run->totalChars;
+}
+
+static unsigned long benchGlyphShape(BenchmarkRun* run){
+    for(int i = 0; i < run->totalChars; i++){
+        GlyphShape gs;
+        getGlyphShape(run->fontData, run->charCodes[i], &gs);
+        freeGlyphShape(&gs);
+    }
+    return run->totalChars;
+}
+
+static unsigned long benchGlyphLines(BenchmarkRun* run){
+    for(int i = 0; i < run->totalChars; i++){
+        GlyphShape gs;
+        getGlyphShape(run->fontData, run->charCodes[i], &gs);
+        LineGroup lg;
+        getGlyphLines(gs, lg);
+        lg.clear();
+        freeGlyphShape(&gs);
+    }
+    return run->totalChars;
+}
+
+static unsigned long benchFullBitmap(BenchmarkRun* run){
+    for(int i = 0; i < run->totalChars; i++){
+        unsigned int w, h;
+        freeBitmapMemory(getBitmapFromCharCode(run->fontData, run->charCodes[i], &w, &h, 0, 0, run->pool));
+    }
+    return run->totalChars;
+}
+
+static unsigned long benchFixedBitmap(BenchmarkRun* run){
+    for(int i = 0; i < run->totalChars; i++){
+        unsigned int w, h;
+        freeBitmapMemory(getFixedBitmapFromCharCode(run->fontData, run->charCodes[i], &w, &h));
+    }
+    return run->totalChars;
+}
+
+static unsigned long benchFixedReducedBitmap(BenchmarkRun* run){
+    for(int i = 0; i < run->totalChars; i++){
+        unsigned int w, h;
+        float ho, v;
+        freeBitmapMemory(getFixedReducedBitmapFromCharCode(run->fontData, run->charCodes[i], &w, &h, &ho, &v, run->divisions));
+    }
+    return run->totalChars;
+}
+
+static unsigned long benchReducedBitmap(BenchmarkRun* run){
+    for(int i = 0; i < run->totalChars; i++){
+        unsigned int w, h;
+        float ho, v;
+        freeBitmapMemory(getReducedBitmapFromCharCode(run->fontData, run->charCodes[i], &w, &h, &ho, &v, run->divisions));
+    }
+    return run->totalChars;
+}
+
+static unsigned long benchBuildFontAtlas(BenchmarkRun* run){
+    FontAtlasSettings settings = getDefaultFontAtlasSettings();
+    settings.divisions = run->divisions;
+    settings.threadPool = run->pool;
+    FontAtlas fa;
+    buildFontAtlas(&fa, run->fontData, run->totalChars, run->charCodes, &settings);
+    clearFontAtlas(&fa);
+    return run->totalChars;
+}
+
+static BandedOutline bandedOutlines[95];
+
+static unsigned long benchBandedOutlineBitmap(BenchmarkRun* run){
+    float pixelsPerEm = (float)bandedOutlines[0].unitsPerEm / (float)run->divisions;
+    for(int i = 0; i < run->totalChars; i++){
+        unsigned int w, h;
+        float ho, v;
+        freeBitmapMemory(getBitmapFromBandedOutline(&bandedOutlines[run->charCodes[i] - 32], pixelsPerEm, &w, &h, &ho, &v));
+    }
+    return run->totalChars;
+}
+
+static FontAtlas* layoutAtlas = 0;
+static float* layoutVertices = 0;
+static unsigned int layoutVertexTotal = 0;
+static float* transformVertices = 0;
+static char layoutText[1024];
+static TextRenderContext layoutContext;
+
+static unsigned long benchRenderText(BenchmarkRun*){
+    vertexCount = 0;
+    renderText(layoutVertices, layoutAtlas, layoutText, 0, 0, 1);
+    return strlen(layoutText);
+}
+
+static unsigned long benchAppendText(BenchmarkRun*){
+    resetTextRenderContext(&layoutContext);
+    appendText(&layoutContext, layoutAtlas, layoutText, 0, 0, 1);
+    return strlen(layoutText);
+}
+
+//transforms a fresh copy of the rendered text every time, so the input doesn't drift between iterations
+static unsigned long benchTransformGlyphQuads(BenchmarkRun*){
+    memcpy(transformVertices, layoutVertices, sizeof(float) * 4 * layoutVertexTotal);
+    transformGlyphQuads(transformVertices, layoutVertexTotal, genAffine2(1.0f, 0.1f, vec2(0, 0), vec2(0, 0)));
+    return layoutVertexTotal / 6;
+}
+
+static unsigned long benchCompressBc4(BenchmarkRun* run){
+    CompressedBitmap cb;
+    compressFontAtlasBc4(&cb, layoutAtlas, BC4_QUALITY_NORMAL, run->pool);
+    freeCompressedBitmap(&cb);
+    return layoutAtlas->totalCharacters;
+}
+
+static BenchmarkSample runBenchmarkStage(BenchmarkStage stage, BenchmarkRun* run){
+    BenchmarkSample s;
+    s.glyphs = 0;
+    s.iterations = 0;
+    s.allocations = totalAllocations;
+    s.allocatedBytes = totalAllocatedBytes;
+
+    unsigned long start = getTimeNanoseconds();
+    unsigned long now = start;
+    while(now - start < MIN_BENCHMARK_NANOSECONDS || s.iterations == 0){
+        s.glyphs += stage(run);
+        s.iterations++;
+        now = getTimeNanoseconds();
+    }
+
+    s.nanoseconds = now - start;
+    s.allocations = totalAllocations - s.allocations;
+    s.allocatedBytes = totalAllocatedBytes - s.allocatedBytes;
+    return s;
+}
+
+static void printBenchmarkResult(FILE* out, const char* stageName, BenchmarkRun* run, BenchmarkSample s){
+    double glyphs = s.glyphs ? (double)s.glyphs : 1.0;
+    fprintf(out, "%s\n    {\"stage\": \"%s\", \"font\": \"%s\", \"charset\": %u, \"divisions\": %u, \"threads\": %u, "
+                 "\"iterations\": %lu, \"glyphs\": %lu, \"ns_per_glyph\": %.1f, \"glyphs_per_second\": %.1f, "
+                 "\"allocations_per_glyph\": %.2f, \"allocated_bytes_per_glyph\": %.1f}",
+            firstResult ? "" : ",", stageName, run->font, run->totalChars, run->divisions, run->threads,
+            s.iterations, s.glyphs, s.nanoseconds / glyphs, glyphs * 1e9 / (double)s.nanoseconds,
+            s.allocations / glyphs, s.allocatedBytes / glyphs);
+    firstResult = false;
+    fflush(out);
+}
+
+int main(int argc, char** argv){
+    const char* fonts[] = {"Arial.ttf", "Times New Roman.ttf", "Courier New.ttf", "Keyboard.ttf"};
+    unsigned int charsets[] = {16, 48, 95};
+    unsigned int divisions[] = {64, 32, 16};
+    unsigned int threadCounts[] = {1, 2, 4, 8};
+    unsigned int totalCharsets = 3;
+    unsigned int totalDivisions = 3;
+    unsigned int totalThreadCounts = 4;
+    FILE* out = stdout;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--quick") == 0){
+            charsets[0] = 95;
+            divisions[0] = 32;
+            threadCounts[1] = 4;
+            totalCharsets = 1;
+            totalDivisions = 1;
+            totalThreadCounts = 2;
+        }else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc){
+            out = fopen(argv[++i], "w");
+            if(!out){
+                fprintf(stderr, "could not open %s\n", argv[i]);
+                return 1;
+            }
+        }else{
+            fprintf(stderr, "usage: %s [--quick] [--output file.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    unsigned short charCodes[95];
+    for(int i = 0; i < 95; i++){
+        charCodes[i] = (unsigned short)(i + 32);
+    }
+    for(int i = 0; i < 95; i++){
+        layoutText[i] = (char)charCodes[i];
+        layoutText[i + 95] = (char)charCodes[94 - i];
+    }
+    layoutText[190] = '\0';
+    layoutVertices = new float[190 * 24];
+    transformVertices = new float[190 * 24];
+    initTextRenderContext(&layoutContext);
+
+    ThreadPool pools[4];
+    for(int i = 0; i < totalThreadCounts; i++){
+        initThreadPool(&pools[i], threadCounts[i]);
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"glyph_pipeline\",\n  \"results\": [");
+    for(int f = 0; f < 4; f++){
+        BenchmarkRun run;
+        run.font = fonts[f];
+        run.fontData = loadFontFile(fonts[f]);
+        if(!run.fontData){
+            fprintf(stderr, "could not load %s\n", fonts[f]);
+            continue;
+        }
+        run.charCodes = charCodes;
+        run.divisions = 32;
+        run.threads = 1;
+        run.pool = 0;
+
+        for(int c = 0; c < totalCharsets; c++){
+            run.totalChars = charsets[c];
+            printBenchmarkResult(out, "getGlyphIndex", &run, runBenchmarkStage(benchGlyphIndex, &run));
+            printBenchmarkResult(out, "getGlyphShape", &run, runBenchmarkStage(benchGlyphShape, &run));
+            printBenchmarkResult(out, "getGlyphLines", &run, runBenchmarkStage(benchGlyphLines, &run));
+        }
+
+        //full resolution bitmaps are rasterized in font units, so a few glyphs are plenty
+        unsigned short fullCodes[] = {'A', 'g', '@', 'W'};
+        run.charCodes = fullCodes;
+        run.totalChars = 4;
+        printBenchmarkResult(out, "getBitmapFromCharCode", &run, runBenchmarkStage(benchFullBitmap, &run));
+        printBenchmarkResult(out, "getFixedBitmapFromCharCode", &run, runBenchmarkStage(benchFixedBitmap, &run));
+        //and tiled across the pool, the way poster sized glyphs are rasterized
+        for(int t = 0; t < totalThreadCounts; t++){
+            run.threads = threadCounts[t];
+            run.pool = &pools[t];
+            printBenchmarkResult(out, "getBitmapFromCharCodeTiled", &run, runBenchmarkStage(benchFullBitmap, &run));
+        }
+        run.threads = 1;
+        run.pool = 0;
+        run.charCodes = charCodes;
+
+        for(int i = 0; i < 95; i++){
+            buildBandedOutlineFromIndex(&bandedOutlines[i], run.fontData, getGlyphIndex(run.fontData, charCodes[i]));
+        }
+
+        for(int d = 0; d < totalDivisions; d++){
+            run.divisions = divisions[d];
+            run.totalChars = 95;
+            run.threads = 1;
+            run.pool = 0;
+            printBenchmarkResult(out, "getReducedBitmapFromCharCode", &run, runBenchmarkStage(benchReducedBitmap, &run));
+            printBenchmarkResult(out, "getFixedReducedBitmapFromCharCode", &run, runBenchmarkStage(benchFixedReducedBitmap, &run));
+            printBenchmarkResult(out, "getBitmapFromBandedOutline", &run, runBenchmarkStage(benchBandedOutlineBitmap, &run));
+
+            for(int c = 0; c < totalCharsets; c++){
+                run.totalChars = charsets[c];
+                for(int t = 0; t < totalThreadCounts; t++){
+                    run.threads = threadCounts[t];
+                    run.pool = &pools[t];
+                    printBenchmarkResult(out, "buildFontAtlas", &run, runBenchmarkStage(benchBuildFontAtlas, &run));
+                }
+            }
+        }
+
+        FontAtlasSettings settings = getDefaultFontAtlasSettings();
+        settings.threadPool = &pools[totalThreadCounts - 1];
+        FontAtlas fa;
+        buildFontAtlas(&fa, run.fontData, 95, charCodes, &settings);
+        layoutAtlas = &fa;
+        run.totalChars = 95;
+        run.divisions = 32;
+        run.threads = 1;
+        run.pool = 0;
+        printBenchmarkResult(out, "renderText", &run, runBenchmarkStage(benchRenderText, &run));
+        vertexCount = 0;
+        renderText(layoutVertices, layoutAtlas, layoutText, 0, 0, 1);
+        layoutVertexTotal = vertexCount;
+        printBenchmarkResult(out, "appendText", &run, runBenchmarkStage(benchAppendText, &run));
+        printBenchmarkResult(out, "transformGlyphQuads", &run, runBenchmarkStage(benchTransformGlyphQuads, &run));
+        for(int t = 0; t < totalThreadCounts; t++){
+            run.threads = threadCounts[t];
+            run.pool = &pools[t];
+            printBenchmarkResult(out, "compressBc4", &run, runBenchmarkStage(benchCompressBc4, &run));
+        }
+        clearFontAtlas(&fa);
+        for(int i = 0; i < 95; i++){
+            freeBandedOutline(&bandedOutlines[i]);
+        }
+
+        delete[] run.fontData;
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    for(int i = 0; i < totalThreadCounts; i++){
+        destroyThreadPool(&pools[i]);
+    }
+    delete[] layoutVertices;
+    delete[] transformVertices;
+    freeTextRenderContext(&layoutContext);
+    if(out != stdout){
+        fclose(out);
+    }
+    return 0;
+}
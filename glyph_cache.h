@@ -0,0 +1,427 @@
+#pragma once
+
+#include <string.h>
+
+#include "truetype_parser.h"
+
+//bitmaps are cached per (face, glyph index, pixel size, render mode) while the flattened outline
+//is shared by every size of a glyph. all bitmaps and outlines count against a single byte budget,
+//and when it is exceeded the least recently used entries are evicted, preferring the cheapest
+//to rasterize again among the oldest few. pointers returned by the cache stay valid only until
+//the next call that can insert, evict or remove
+
+enum GlyphRenderMode{
+    //the thresholded bitmap buildFontAtlas uses
+    GLYPH_RENDER_BINARY,
+    //fraction of samples inside the outline
+    GLYPH_RENDER_COVERAGE
+};
+
+static const unsigned int GLYPH_CACHE_EVICTION_WINDOW = 8;
+
+struct GlyphOutline{
+    unsigned int face;
+    unsigned int glyphIndex;
+    short xMin;
+    short xMax;
+    short yMin;
+    short yMax;
+    unsigned short advance;
+    LineGroup lines;
+    unsigned int references;
+    unsigned long bytes;
+    int next;
+};
+
+struct CachedGlyph{
+    unsigned int face;
+    unsigned int glyphIndex;
+    unsigned int pixelSize;
+    GlyphRenderMode renderMode;
+    unsigned char* bitmap;
+    unsigned int width;
+    unsigned int height;
+    //pen advance and baseline to bitmap bottom, in pixels
+    float xShift;
+    float yShift;
+    int outline;
+    unsigned long bytes;
+    //rough work to rasterize again, samples times edges tested per sample
+    unsigned long cost;
+    int next;
+    int older;
+    int newer;
+};
+
+struct GlyphCache{
+    unsigned char** faces;
+    FontTables* tables;
+    unsigned int totalFaces;
+    unsigned int faceCapacity;
+
+    CachedGlyph* glyphs;
+    int* glyphBuckets;
+    unsigned int glyphCapacity;
+    unsigned int totalGlyphs;
+    int freeGlyph;
+    int newest;
+    int oldest;
+
+    GlyphOutline* outlines;
+    int* outlineBuckets;
+    unsigned int outlineCapacity;
+    unsigned int totalOutlines;
+    int freeOutline;
+
+    unsigned long budgetBytes;
+    unsigned long totalBytes;
+    unsigned long peakBytes;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+static unsigned int hashGlyphCacheKey(unsigned int face, unsigned int glyphIndex, unsigned int pixelSize, unsigned int renderMode){
+    unsigned int h = (face * 0x9e3779b1u) ^ glyphIndex;
+    h = (h * 0x85ebca6bu) ^ pixelSize;
+    h = (h * 0xc2b2ae35u) ^ renderMode;
+    return h ^ (h >> 16);
+}
+
+void initGlyphCache(GlyphCache* gc, unsigned long budgetBytes){
+    memset(gc, 0, sizeof(GlyphCache));
+    gc->freeGlyph = -1;
+    gc->newest = -1;
+    gc->oldest = -1;
+    gc->freeOutline = -1;
+    gc->budgetBytes = budgetBytes;
+}
+
+//the cache doesn't copy the font data, it has to outlive the cache
+unsigned int addGlyphCacheFace(GlyphCache* gc, unsigned char* fontData){
+    for(unsigned int i = 0; i < gc->totalFaces; i++){
+        if(gc->faces[i] == fontData){
+            return i;
+        }
+    }
+    if(gc->totalFaces == gc->faceCapacity){
+        unsigned int capacity = gc->faceCapacity ? gc->faceCapacity * 2 : 4;
+        unsigned char** faces = new unsigned char*[capacity];
+        FontTables* tables = new FontTables[capacity];
+        for(unsigned int i = 0; i < gc->totalFaces; i++){
+            faces[i] = gc->faces[i];
+            tables[i] = gc->tables[i];
+        }
+        if(gc->faces) delete[] gc->faces;
+        if(gc->tables) delete[] gc->tables;
+        gc->faces = faces;
+        gc->tables = tables;
+        gc->faceCapacity = capacity;
+    }
+    gc->faces[gc->totalFaces] = fontData;
+    initFontTables(&gc->tables[gc->totalFaces], fontData);
+    return gc->totalFaces++;
+}
+
+//capacities are powers of two so the bucket arrays can be indexed with a mask
+static void growGlyphCacheGlyphs(GlyphCache* gc){
+    unsigned int capacity = gc->glyphCapacity ? gc->glyphCapacity * 2 : 64;
+    CachedGlyph* glyphs = new CachedGlyph[capacity];
+    for(unsigned int i = 0; i < gc->glyphCapacity; i++){
+        glyphs[i] = gc->glyphs[i];
+    }
+    for(unsigned int i = gc->glyphCapacity; i < capacity; i++){
+        glyphs[i].bitmap = 0;
+        glyphs[i].next = i + 1 < capacity ? i + 1 : gc->freeGlyph;
+    }
+    gc->freeGlyph = gc->glyphCapacity;
+
+    int* buckets = new int[capacity];
+    for(unsigned int i = 0; i < capacity; i++){
+        buckets[i] = -1;
+    }
+    for(int i = gc->oldest; i >= 0; i = glyphs[i].newer){
+        CachedGlyph* g = &glyphs[i];
+        unsigned int b = hashGlyphCacheKey(g->face, g->glyphIndex, g->pixelSize, g->renderMode) & (capacity - 1);
+        g->next = buckets[b];
+        buckets[b] = i;
+    }
+
+    if(gc->glyphs) delete[] gc->glyphs;
+    if(gc->glyphBuckets) delete[] gc->glyphBuckets;
+    gc->glyphs = glyphs;
+    gc->glyphBuckets = buckets;
+    gc->glyphCapacity = capacity;
+}
+
+static void growGlyphCacheOutlines(GlyphCache* gc){
+    unsigned int capacity = gc->outlineCapacity ? gc->outlineCapacity * 2 : 64;
+    GlyphOutline* outlines = new GlyphOutline[capacity];
+    for(unsigned int i = 0; i < gc->outlineCapacity; i++){
+        outlines[i] = gc->outlines[i];
+    }
+    for(unsigned int i = gc->outlineCapacity; i < capacity; i++){
+        outlines[i].references = 0;
+        outlines[i].next = i + 1 < capacity ? i + 1 : gc->freeOutline;
+    }
+    gc->freeOutline = gc->outlineCapacity;
+
+    int* buckets = new int[capacity];
+    for(unsigned int i = 0; i < capacity; i++){
+        buckets[i] = -1;
+    }
+    for(unsigned int i = 0; i < gc->outlineCapacity; i++){
+        GlyphOutline* o = &outlines[i];
+        if(o->references){
+            unsigned int b = hashGlyphCacheKey(o->face, o->glyphIndex, 0, 0) & (capacity - 1);
+            o->next = buckets[b];
+            buckets[b] = i;
+        }
+    }
+
+    if(gc->outlines) delete[] gc->outlines;
+    if(gc->outlineBuckets) delete[] gc->outlineBuckets;
+    gc->outlines = outlines;
+    gc->outlineBuckets = buckets;
+    gc->outlineCapacity = capacity;
+}
+
+static void addGlyphCacheBytes(GlyphCache* gc, unsigned long bytes){
+    gc->totalBytes += bytes;
+    if(gc->totalBytes > gc->peakBytes){
+        gc->peakBytes = gc->totalBytes;
+    }
+}
+
+//returns the outline with a reference held for the caller, parsing and flattening it on first use
+static int acquireGlyphOutline(GlyphCache* gc, unsigned int face, unsigned int glyphIndex){
+    if(gc->outlineCapacity){
+        unsigned int b = hashGlyphCacheKey(face, glyphIndex, 0, 0) & (gc->outlineCapacity - 1);
+        for(int i = gc->outlineBuckets[b]; i >= 0; i = gc->outlines[i].next){
+            if(gc->outlines[i].face == face && gc->outlines[i].glyphIndex == glyphIndex){
+                gc->outlines[i].references++;
+                return i;
+            }
+        }
+    }
+
+    if(gc->freeOutline < 0 || gc->totalOutlines >= gc->outlineCapacity){
+        growGlyphCacheOutlines(gc);
+    }
+    int index = gc->freeOutline;
+    GlyphOutline* o = &gc->outlines[index];
+    gc->freeOutline = o->next;
+
+    GlyphShape gs;
+    getGlyphShapeFromIndex(gc->faces[face], glyphIndex, &gs);
+    o->face = face;
+    o->glyphIndex = glyphIndex;
+    o->xMin = gs.xMin;
+    o->xMax = gs.xMax;
+    o->yMin = gs.yMin;
+    o->yMax = gs.yMax;
+    o->advance = getGlyphAdvanceFromIndex(gc->faces[face], glyphIndex);
+    o->lines = LineGroup();
+    //composite glyphs aren't parsed yet and come back without contours
+    if((short)gs.numContours >= 0){
+        getGlyphLines(gs, o->lines);
+    }
+    freeGlyphShape(&gs);
+    o->references = 1;
+    o->bytes = sizeof(GlyphOutline) + (o->lines.capacity * sizeof(vecLine));
+    addGlyphCacheBytes(gc, o->bytes);
+
+    unsigned int b = hashGlyphCacheKey(face, glyphIndex, 0, 0) & (gc->outlineCapacity - 1);
+    o->next = gc->outlineBuckets[b];
+    gc->outlineBuckets[b] = index;
+    gc->totalOutlines++;
+    return index;
+}
+
+static void releaseGlyphOutline(GlyphCache* gc, int index){
+    GlyphOutline* o = &gc->outlines[index];
+    if(--o->references > 0){
+        return;
+    }
+    unsigned int b = hashGlyphCacheKey(o->face, o->glyphIndex, 0, 0) & (gc->outlineCapacity - 1);
+    int* link = &gc->outlineBuckets[b];
+    while(*link != index){
+        link = &gc->outlines[*link].next;
+    }
+    *link = o->next;
+
+    o->lines.clear();
+    gc->totalBytes -= o->bytes;
+    o->next = gc->freeOutline;
+    gc->freeOutline = index;
+    gc->totalOutlines--;
+}
+
+static void unlinkCachedGlyphRecency(GlyphCache* gc, int index){
+    CachedGlyph* g = &gc->glyphs[index];
+    if(g->older >= 0) gc->glyphs[g->older].newer = g->newer;
+    else gc->oldest = g->newer;
+    if(g->newer >= 0) gc->glyphs[g->newer].older = g->older;
+    else gc->newest = g->older;
+}
+
+static void linkCachedGlyphNewest(GlyphCache* gc, int index){
+    CachedGlyph* g = &gc->glyphs[index];
+    g->older = gc->newest;
+    g->newer = -1;
+    if(gc->newest >= 0) gc->glyphs[gc->newest].newer = index;
+    else gc->oldest = index;
+    gc->newest = index;
+}
+
+static void removeCachedGlyph(GlyphCache* gc, int index){
+    CachedGlyph* g = &gc->glyphs[index];
+    unsigned int b = hashGlyphCacheKey(g->face, g->glyphIndex, g->pixelSize, g->renderMode) & (gc->glyphCapacity - 1);
+    int* link = &gc->glyphBuckets[b];
+    while(*link != index){
+        link = &gc->glyphs[*link].next;
+    }
+    *link = g->next;
+    unlinkCachedGlyphRecency(gc, index);
+
+    delete[] g->bitmap;
+    g->bitmap = 0;
+    gc->totalBytes -= g->bytes;
+    releaseGlyphOutline(gc, g->outline);
+    g->next = gc->freeGlyph;
+    gc->freeGlyph = index;
+    gc->totalGlyphs--;
+}
+
+//evicts until incoming more bytes fit. among the oldest few entries the one that is cheapest to
+//rebuild per byte goes first, so a big slow glyph outlives a small cheap one of the same age
+static void evictGlyphCache(GlyphCache* gc, unsigned long incoming){
+    while(gc->totalBytes + incoming > gc->budgetBytes && gc->oldest >= 0){
+        int victim = -1;
+        float victimScore = 0;
+        int i = gc->oldest;
+        for(unsigned int n = 0; n < GLYPH_CACHE_EVICTION_WINDOW && i >= 0; n++){
+            float score = (float)gc->glyphs[i].cost / (float)gc->glyphs[i].bytes;
+            if(victim < 0 || score < victimScore){
+                victim = i;
+                victimScore = score;
+            }
+            i = gc->glyphs[i].newer;
+        }
+        removeCachedGlyph(gc, victim);
+        gc->evictions++;
+    }
+}
+
+void setGlyphCacheBudget(GlyphCache* gc, unsigned long budgetBytes){
+    gc->budgetBytes = budgetBytes;
+    evictGlyphCache(gc, 0);
+}
+
+unsigned int getGlyphCacheDivisions(GlyphCache* gc, unsigned int face, unsigned int pixelSize){
+    unsigned int unitsPerEm = gc->tables[face].head.unitsPerEm();
+    unsigned int divisions = pixelSize ? (unitsPerEm + (pixelSize / 2)) / pixelSize : unitsPerEm;
+    return divisions ? divisions : 1;
+}
+
+CachedGlyph* findCachedGlyph(GlyphCache* gc, unsigned int face, unsigned int glyphIndex, unsigned int pixelSize, GlyphRenderMode renderMode){
+    if(!gc->glyphCapacity){
+        return 0;
+    }
+    unsigned int b = hashGlyphCacheKey(face, glyphIndex, pixelSize, renderMode) & (gc->glyphCapacity - 1);
+    for(int i = gc->glyphBuckets[b]; i >= 0; i = gc->glyphs[i].next){
+        CachedGlyph* g = &gc->glyphs[i];
+        if(g->face == face && g->glyphIndex == glyphIndex && g->pixelSize == pixelSize && g->renderMode == renderMode){
+            return g;
+        }
+    }
+    return 0;
+}
+
+//a single glyph bigger than the whole budget is still returned, and evicted by the next insertion
+CachedGlyph* getCachedGlyph(GlyphCache* gc, unsigned int face, unsigned int glyphIndex, unsigned int pixelSize, GlyphRenderMode renderMode){
+    CachedGlyph* found = findCachedGlyph(gc, face, glyphIndex, pixelSize, renderMode);
+    if(found){
+        int index = (int)(found - gc->glyphs);
+        unlinkCachedGlyphRecency(gc, index);
+        linkCachedGlyphNewest(gc, index);
+        gc->hits++;
+        return found;
+    }
+    gc->misses++;
+
+    int outline = acquireGlyphOutline(gc, face, glyphIndex);
+    GlyphOutline* o = &gc->outlines[outline];
+    unsigned int divisions = getGlyphCacheDivisions(gc, face, pixelSize);
+    GlyphShape bounds;
+    bounds.xMin = o->xMin;
+    bounds.xMax = o->xMax;
+    bounds.yMin = o->yMin;
+    bounds.yMax = o->yMax;
+    unsigned int width, height;
+    unsigned long samples = 0;
+    unsigned char* bitmap = getReducedBitmapFromLines(&bounds, o->lines, &width, &height, divisions, 0, renderMode == GLYPH_RENDER_COVERAGE, &samples);
+    unsigned long bytes = sizeof(CachedGlyph) + (width * height);
+
+    //the outline reference is already held, so evicting other sizes of this glyph can't free it
+    evictGlyphCache(gc, bytes);
+    if(gc->freeGlyph < 0 || gc->totalGlyphs >= gc->glyphCapacity){
+        growGlyphCacheGlyphs(gc);
+    }
+    int index = gc->freeGlyph;
+    CachedGlyph* g = &gc->glyphs[index];
+    gc->freeGlyph = g->next;
+
+    g->face = face;
+    g->glyphIndex = glyphIndex;
+    g->pixelSize = pixelSize;
+    g->renderMode = renderMode;
+    g->bitmap = bitmap;
+    g->width = width;
+    g->height = height;
+    g->xShift = (float)o->advance / (float)divisions;
+    g->yShift = (float)o->yMin / (float)divisions;
+    g->outline = outline;
+    g->bytes = bytes;
+    g->cost = samples * (o->lines.totalLines + 1);
+
+    unsigned int b = hashGlyphCacheKey(face, glyphIndex, pixelSize, renderMode) & (gc->glyphCapacity - 1);
+    g->next = gc->glyphBuckets[b];
+    gc->glyphBuckets[b] = index;
+    linkCachedGlyphNewest(gc, index);
+    gc->totalGlyphs++;
+    addGlyphCacheBytes(gc, bytes);
+    return g;
+}
+
+CachedGlyph* getCachedCharacter(GlyphCache* gc, unsigned int face, unsigned short characterCode, unsigned int pixelSize, GlyphRenderMode renderMode){
+    return getCachedGlyph(gc, face, getGlyphIndexFromTables(&gc->tables[face], characterCode), pixelSize, renderMode);
+}
+
+//drops every size of every glyph of the face, the face id stays valid
+void purgeGlyphCacheFace(GlyphCache* gc, unsigned int face){
+    int i = gc->oldest;
+    while(i >= 0){
+        int newer = gc->glyphs[i].newer;
+        if(gc->glyphs[i].face == face){
+            removeCachedGlyph(gc, i);
+        }
+        i = newer;
+    }
+}
+
+void destroyGlyphCache(GlyphCache* gc){
+    while(gc->oldest >= 0){
+        removeCachedGlyph(gc, gc->oldest);
+    }
+    if(gc->glyphs) delete[] gc->glyphs;
+    if(gc->glyphBuckets) delete[] gc->glyphBuckets;
+    if(gc->outlines) delete[] gc->outlines;
+    if(gc->outlineBuckets) delete[] gc->outlineBuckets;
+    for(unsigned int i = 0; i < gc->totalFaces; i++){
+        freeFontTables(&gc->tables[i]);
+    }
+    if(gc->faces) delete[] gc->faces;
+    if(gc->tables) delete[] gc->tables;
+    initGlyphCache(gc, gc->budgetBytes);
+}
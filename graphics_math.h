@@ -1,11 +1,17 @@
  #pragma once
  
  #include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 union vec2;
 union vec3;
 union vec4;
 union quat;
 union mat4;
+union affine2;
 
 static vec3 cross(vec3, vec3);
 static vec3 getForwardVector(mat4);
@@ -14,6 +20,8 @@ static vec3 getRightVector(mat4);
 static quat rotationToQuat(vec3, float);
 static quat multiply(quat, quat);
 static mat4 multiply(mat4, mat4);
+static vec4 multiply(mat4, vec4);
+static affine2 multiply(affine2, affine2);
 static mat4 genIdentityMatrix();
 
 union vec2 {
@@ -118,6 +126,21 @@ union mat4 {
     }
 };
 
+//2d affine transform stored by column like mat4, the third column is the translation
+union affine2 {
+    float m[3][2];
+
+    void setIdentity(){
+        m[0][0] = 1; m[1][0] = 0; m[2][0] = 0;
+        m[0][1] = 0; m[1][1] = 1; m[2][1] = 0;
+    }
+
+    void translate(vec2 v){
+        m[2][0] += v.x;
+        m[2][1] += v.y;
+    }
+};
+
 vec3 cross(vec3 v1, vec3 v2){
     vec3 c;
     c.x = (v1.y * v2.z) - (v1.z * v2.y);
@@ -157,16 +180,39 @@ quat rotationToQuat(vec3 axis, float angle){
 
 quat multiply(quat q1, quat q2){
     quat q;
+#if defined(__SSE2__)
+    //each lane keeps the term order and signs of the scalar version so both give the same bits
+    __m128 b = _mm_loadu_ps(q2.v);
+    __m128 r = _mm_mul_ps(_mm_set1_ps(q1.x), _mm_mul_ps(_mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 1, 2, 3)), _mm_set_ps(-1, 1, -1, 1)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(q1.y), _mm_mul_ps(_mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 0, 3, 2)), _mm_set_ps(-1, -1, 1, 1))));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(q1.z), _mm_mul_ps(_mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1)), _mm_set_ps(-1, 1, 1, -1))));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(q1.w), b));
+    _mm_storeu_ps(q.v, r);
+#else
     q.x =   q1.x * q2.w + q1.y * q2.z - q1.z * q2.y + q1.w * q2.x;
     q.y =  -q1.x * q2.z + q1.y * q2.w + q1.z * q2.x + q1.w * q2.y;
     q.z =   q1.x * q2.y - q1.y * q2.x + q1.z * q2.w + q1.w * q2.z;
     q.w =  -q1.x * q2.x - q1.y * q2.y - q1.z * q2.z + q1.w * q2.w;
+#endif
     return q;
 }
 
 mat4 multiply(mat4 m1, mat4 m2){
     mat4 mat;
-
+#if defined(__SSE2__)
+    //column c of the result is the columns of m1 weighted by column c of m2
+    __m128 c0 = _mm_loadu_ps(m1.m[0]);
+    __m128 c1 = _mm_loadu_ps(m1.m[1]);
+    __m128 c2 = _mm_loadu_ps(m1.m[2]);
+    __m128 c3 = _mm_loadu_ps(m1.m[3]);
+    for(int c = 0; c < 4; c++){
+        __m128 r = _mm_mul_ps(c0, _mm_set1_ps(m2.m[c][0]));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(m2.m[c][1])));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(m2.m[c][2])));
+        r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(m2.m[c][3])));
+        _mm_storeu_ps(mat.m[c], r);
+    }
+#else
     mat.m[0][0] = (m1.m[0][0] * m2.m[0][0]) + (m1.m[1][0] * m2.m[0][1]) + (m1.m[2][0] * m2.m[0][2]) + (m1.m[3][0] * m2.m[0][3]);
     mat.m[0][1] = (m1.m[0][1] * m2.m[0][0]) + (m1.m[1][1] * m2.m[0][1]) + (m1.m[2][1] * m2.m[0][2]) + (m1.m[3][1] * m2.m[0][3]);
     mat.m[0][2] = (m1.m[0][2] * m2.m[0][0]) + (m1.m[1][2] * m2.m[0][1]) + (m1.m[2][2] * m2.m[0][2]) + (m1.m[3][2] * m2.m[0][3]);
@@ -186,10 +232,37 @@ mat4 multiply(mat4 m1, mat4 m2){
     mat.m[3][1] = (m1.m[0][1] * m2.m[3][0]) + (m1.m[1][1] * m2.m[3][1]) + (m1.m[2][1] * m2.m[3][2]) + (m1.m[3][1] * m2.m[3][3]);
     mat.m[3][2] = (m1.m[0][2] * m2.m[3][0]) + (m1.m[1][2] * m2.m[3][1]) + (m1.m[2][2] * m2.m[3][2]) + (m1.m[3][2] * m2.m[3][3]);
     mat.m[3][3] = (m1.m[0][3] * m2.m[3][0]) + (m1.m[1][3] * m2.m[3][1]) + (m1.m[2][3] * m2.m[3][2]) + (m1.m[3][3] * m2.m[3][3]);
-
+#endif
     return mat;
 }
 
+vec4 multiply(mat4 m, vec4 v){
+    vec4 r;
+#if defined(__SSE2__)
+    __m128 t = _mm_mul_ps(_mm_loadu_ps(m.m[0]), _mm_set1_ps(v.x));
+    t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(m.m[1]), _mm_set1_ps(v.y)));
+    t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(m.m[2]), _mm_set1_ps(v.z)));
+    t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(m.m[3]), _mm_set1_ps(v.w)));
+    _mm_storeu_ps(r.v, t);
+#else
+    for(int i = 0; i < 4; i++){
+        r.v[i] = (m.m[0][i] * v.x) + (m.m[1][i] * v.y) + (m.m[2][i] * v.z) + (m.m[3][i] * v.w);
+    }
+#endif
+    return r;
+}
+
+affine2 multiply(affine2 a1, affine2 a2){
+    affine2 a;
+    for(int c = 0; c < 3; c++){
+        a.m[c][0] = (a1.m[0][0] * a2.m[c][0]) + (a1.m[1][0] * a2.m[c][1]);
+        a.m[c][1] = (a1.m[0][1] * a2.m[c][0]) + (a1.m[1][1] * a2.m[c][1]);
+    }
+    a.m[2][0] += a1.m[2][0];
+    a.m[2][1] += a1.m[2][1];
+    return a;
+}
+
 mat4 quatToMat4(quat q){
     q.normalize();
 
@@ -277,4 +350,89 @@ mat4 setPerspectiveProjection(float fov, float aspect, float znear, float zfar){
         projection.m[3][3] = 1.0f;
 
         return projection;
-    }
\ No newline at end of file
+    }
+
+affine2 genIdentityAffine(){
+    affine2 a;
+    a.setIdentity();
+    return a;
+}
+
+//rotates counterclockwise by angle radians and scales about origin, then moves origin to translation
+affine2 genAffine2(float scale, float angle, vec2 origin, vec2 translation){
+    float c = cos(angle) * scale;
+    float s = sin(angle) * scale;
+    affine2 a;
+    a.m[0][0] = c; a.m[1][0] = -s;
+    a.m[0][1] = s; a.m[1][1] = c;
+    a.m[2][0] = translation.x - ((c * origin.x) - (s * origin.y));
+    a.m[2][1] = translation.y - ((s * origin.x) + (c * origin.y));
+    return a;
+}
+
+//the part of m that acts on points in the z = 0 plane, ignoring any projection
+affine2 getAffine2(mat4 m){
+    affine2 a;
+    a.m[0][0] = m.m[0][0]; a.m[1][0] = m.m[1][0]; a.m[2][0] = m.m[3][0];
+    a.m[0][1] = m.m[0][1]; a.m[1][1] = m.m[1][1]; a.m[2][1] = m.m[3][1];
+    return a;
+}
+
+//glyph quad vertices are x, y, u, v. only x and y are moved, so the quads keep sampling the same
+//atlas texels. w holds 1 for affine transforms and is divided out for projective ones
+static void transformGlyphVertices(float* vertices, unsigned int totalVertices, const float* mx, const float* my, const float* mw){
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    __m128 ax = _mm_set1_ps(mx[0]), bx = _mm_set1_ps(mx[1]), cx = _mm_set1_ps(mx[2]);
+    __m128 ay = _mm_set1_ps(my[0]), by = _mm_set1_ps(my[1]), cy = _mm_set1_ps(my[2]);
+    __m128 aw = _mm_set1_ps(mw[0]), bw = _mm_set1_ps(mw[1]), cw = _mm_set1_ps(mw[2]);
+    bool projective = mw[0] != 0 || mw[1] != 0 || mw[2] != 1;
+    for(; i + 4 <= totalVertices; i += 4){
+        float* p = &vertices[i * 4];
+        __m128 v0 = _mm_loadu_ps(p);
+        __m128 v1 = _mm_loadu_ps(p + 4);
+        __m128 v2 = _mm_loadu_ps(p + 8);
+        __m128 v3 = _mm_loadu_ps(p + 12);
+        __m128 lo = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(1, 0, 1, 0));
+        __m128 hi = _mm_shuffle_ps(v2, v3, _MM_SHUFFLE(1, 0, 1, 0));
+        __m128 x = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 y = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 tx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, x), _mm_mul_ps(bx, y)), cx);
+        __m128 ty = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ay, x), _mm_mul_ps(by, y)), cy);
+        if(projective){
+            __m128 tw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(aw, x), _mm_mul_ps(bw, y)), cw);
+            tx = _mm_div_ps(tx, tw);
+            ty = _mm_div_ps(ty, tw);
+        }
+        lo = _mm_unpacklo_ps(tx, ty);
+        hi = _mm_unpackhi_ps(tx, ty);
+        _mm_storeu_ps(p, _mm_shuffle_ps(lo, v0, _MM_SHUFFLE(3, 2, 1, 0)));
+        _mm_storeu_ps(p + 4, _mm_shuffle_ps(lo, v1, _MM_SHUFFLE(3, 2, 3, 2)));
+        _mm_storeu_ps(p + 8, _mm_shuffle_ps(hi, v2, _MM_SHUFFLE(3, 2, 1, 0)));
+        _mm_storeu_ps(p + 12, _mm_shuffle_ps(hi, v3, _MM_SHUFFLE(3, 2, 3, 2)));
+    }
+#endif
+    for(; i < totalVertices; i++){
+        float* p = &vertices[i * 4];
+        float x = p[0];
+        float y = p[1];
+        float w = ((mw[0] * x) + (mw[1] * y)) + mw[2];
+        p[0] = (((mx[0] * x) + (mx[1] * y)) + mx[2]) / w;
+        p[1] = (((my[0] * x) + (my[1] * y)) + my[2]) / w;
+    }
+}
+
+//transforms glyph quads in place, treating each position as the point (x, y, 0, 1)
+void transformGlyphQuads(float* vertices, unsigned int totalVertices, mat4 m){
+    float mx[3] = {m.m[0][0], m.m[1][0], m.m[3][0]};
+    float my[3] = {m.m[0][1], m.m[1][1], m.m[3][1]};
+    float mw[3] = {m.m[0][3], m.m[1][3], m.m[3][3]};
+    transformGlyphVertices(vertices, totalVertices, mx, my, mw);
+}
+
+void transformGlyphQuads(float* vertices, unsigned int totalVertices, affine2 a){
+    float mx[3] = {a.m[0][0], a.m[1][0], a.m[2][0]};
+    float my[3] = {a.m[0][1], a.m[1][1], a.m[2][1]};
+    float mw[3] = {0, 0, 1};
+    transformGlyphVertices(vertices, totalVertices, mx, my, mw);
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "font_atlas.h"
+
+//an atlas built once into a named posix shared memory segment that other processes on the host
+//map read only, so many renderer processes share one copy and one build. the name is claimed
+//before building, so a second builder finds it taken and attaches instead of building too.
+//the segment starts with a header giving every array as a byte offset from the segment start,
+//it maps at a different address in every process. the segment is sized and filled only once the
+//build is done, and attachers wait for the ready flag, set last, before reading anything.
+//attached atlases have no font data, so missing subpixel phases fall back to phase 0 instead
+//of being added. build with lazySubpixelPhases off to share every phase
+
+//"FATL"
+static const unsigned int SHARED_ATLAS_MAGIC = 0x4c544146;
+//bumped whenever the header or the arrays change layout
+static const unsigned int SHARED_ATLAS_VERSION = 2;
+static const unsigned int SHARED_ATLAS_MAX_MIP_LEVELS = 16;
+static const unsigned long SHARED_ATLAS_ALIGNMENT = 64;
+
+enum SharedAtlasStatus{
+    SHARED_ATLAS_OK,
+    //another process holds the name, attach to it instead of building
+    SHARED_ATLAS_EXISTS,
+    SHARED_ATLAS_NOT_FOUND,
+    //not ready in time, the builder may have died part way. unlink the name to build it again
+    SHARED_ATLAS_TIMEOUT,
+    //built by a process with another layout
+    SHARED_ATLAS_VERSION_MISMATCH,
+    SHARED_ATLAS_ERROR
+};
+
+struct SharedAtlasHeader{
+    unsigned int magic;
+    unsigned int version;
+    //0 until everything after the header is written
+    volatile unsigned int ready;
+    //catches layout changes that forgot to bump the version
+    unsigned int headerBytes;
+    unsigned long totalBytes;
+    unsigned int totalCharacters;
+    unsigned int totalBitmapWidth;
+    unsigned int totalBitmapHeight;
+    unsigned int subpixelPhases;
+    unsigned int glyphIndices;
+    unsigned int fixedPointRaster;
+    unsigned int gutter;
+    unsigned int divisions;
+    unsigned int mipFilter;
+    unsigned int totalMipLevels;
+    unsigned int sharedGlyphs;
+    unsigned long sharedArea;
+    float ascent;
+    float descent;
+    float lineGap;
+    unsigned long bitmapOffset;
+    unsigned long characterCodesOffset;
+    unsigned long xOffsetsOffset;
+    unsigned long yOffsetsOffset;
+    unsigned long widthsOffset;
+    unsigned long heightsOffset;
+    unsigned long xShiftsOffset;
+    unsigned long yShiftsOffset;
+    unsigned long phasesOffset;
+    unsigned long glyphHashesOffset;
+    //level 0 is the base bitmap
+    unsigned long mipOffsets[SHARED_ATLAS_MAX_MIP_LEVELS];
+    unsigned int mipWidths[SHARED_ATLAS_MAX_MIP_LEVELS];
+    unsigned int mipHeights[SHARED_ATLAS_MAX_MIP_LEVELS];
+};
+
+//atlas points into the mapping, and its mip level pointers into mipBitmaps, so this must not be
+//moved or copied while attached. free it with detachSharedFontAtlas, never clearFontAtlas
+struct SharedFontAtlas{
+    FontAtlas atlas;
+    SharedAtlasHeader* header;
+    unsigned long mappedBytes;
+    //held between claiming the name and publishing the atlas
+    int fd;
+    unsigned char* mipBitmaps[SHARED_ATLAS_MAX_MIP_LEVELS];
+};
+
+static unsigned long reserveSharedAtlasBytes(unsigned long* total, unsigned long bytes){
+    unsigned long offset = (*total + SHARED_ATLAS_ALIGNMENT - 1) & ~(SHARED_ATLAS_ALIGNMENT - 1);
+    *total = offset + bytes;
+    return offset;
+}
+
+//fills in the sizes and offsets of fa's arrays and returns the bytes the segment needs
+static unsigned long getSharedAtlasLayout(FontAtlas* fa, SharedAtlasHeader* h){
+    memset(h, 0, sizeof(SharedAtlasHeader));
+    h->magic = SHARED_ATLAS_MAGIC;
+    h->version = SHARED_ATLAS_VERSION;
+    h->headerBytes = sizeof(SharedAtlasHeader);
+    h->totalCharacters = fa->totalCharacters;
+    h->totalBitmapWidth = fa->totalBitmapWidth;
+    h->totalBitmapHeight = fa->totalBitmapHeight;
+    h->subpixelPhases = fa->subpixelPhases;
+    h->glyphIndices = fa->glyphIndices;
+    h->fixedPointRaster = fa->fixedPointRaster;
+    h->gutter = fa->gutter;
+    h->divisions = fa->divisions;
+    h->mipFilter = fa->mipFilter;
+    h->totalMipLevels = fa->mipBitmaps ? fa->totalMipLevels : 1;
+    if(h->totalMipLevels > SHARED_ATLAS_MAX_MIP_LEVELS){
+        h->totalMipLevels = SHARED_ATLAS_MAX_MIP_LEVELS;
+    }
+    h->sharedGlyphs = fa->sharedGlyphs;
+    h->sharedArea = fa->sharedArea;
+    h->ascent = fa->ascent;
+    h->descent = fa->descent;
+    h->lineGap = fa->lineGap;
+
+    unsigned long total = sizeof(SharedAtlasHeader);
+    unsigned int n = fa->totalCharacters;
+    h->bitmapOffset = reserveSharedAtlasBytes(&total, (unsigned long)fa->totalBitmapWidth * fa->totalBitmapHeight);
+    h->characterCodesOffset = reserveSharedAtlasBytes(&total, n * sizeof(unsigned short));
+    h->xOffsetsOffset = reserveSharedAtlasBytes(&total, n * sizeof(unsigned int));
+    h->yOffsetsOffset = reserveSharedAtlasBytes(&total, n * sizeof(unsigned int));
+    h->widthsOffset = reserveSharedAtlasBytes(&total, n * sizeof(unsigned int));
+    h->heightsOffset = reserveSharedAtlasBytes(&total, n * sizeof(unsigned int));
+    h->xShiftsOffset = reserveSharedAtlasBytes(&total, n * sizeof(float));
+    h->yShiftsOffset = reserveSharedAtlasBytes(&total, n * sizeof(float));
+    h->phasesOffset = reserveSharedAtlasBytes(&total, n);
+    h->glyphHashesOffset = reserveSharedAtlasBytes(&total, n * sizeof(unsigned int));
+    h->mipOffsets[0] = h->bitmapOffset;
+    h->mipWidths[0] = fa->totalBitmapWidth;
+    h->mipHeights[0] = fa->totalBitmapHeight;
+    for(unsigned int i = 1; i < h->totalMipLevels; i++){
+        h->mipWidths[i] = fa->mipWidths[i];
+        h->mipHeights[i] = fa->mipHeights[i];
+        h->mipOffsets[i] = reserveSharedAtlasBytes(&total, (unsigned long)fa->mipWidths[i] * fa->mipHeights[i]);
+    }
+    h->totalBytes = total;
+    return total;
+}
+
+//points sa->atlas at the arrays of a mapped segment
+static void setSharedAtlasPointers(SharedFontAtlas* sa){
+    SharedAtlasHeader* h = sa->header;
+    unsigned char* base = (unsigned char*)h;
+    FontAtlas* fa = &sa->atlas;
+    memset(fa, 0, sizeof(FontAtlas));
+    fa->id = -1;
+    fa->totalCharacters = h->totalCharacters;
+    fa->capacity = h->totalCharacters;
+    fa->totalBitmapWidth = h->totalBitmapWidth;
+    fa->totalBitmapHeight = h->totalBitmapHeight;
+    fa->bitmap = base + h->bitmapOffset;
+    fa->characterCodes = (unsigned short*)(base + h->characterCodesOffset);
+    fa->xOffsets = (unsigned int*)(base + h->xOffsetsOffset);
+    fa->yOffsets = (unsigned int*)(base + h->yOffsetsOffset);
+    fa->widths = (unsigned int*)(base + h->widthsOffset);
+    fa->heights = (unsigned int*)(base + h->heightsOffset);
+    fa->xShifts = (float*)(base + h->xShiftsOffset);
+    fa->yShifts = (float*)(base + h->yShiftsOffset);
+    fa->phases = base + h->phasesOffset;
+    fa->glyphHashes = (unsigned int*)(base + h->glyphHashesOffset);
+    fa->subpixelPhases = h->subpixelPhases;
+    fa->glyphIndices = h->glyphIndices != 0;
+    fa->fixedPointRaster = h->fixedPointRaster != 0;
+    fa->gutter = h->gutter;
+    fa->divisions = h->divisions;
+    fa->ascent = h->ascent;
+    fa->descent = h->descent;
+    fa->lineGap = h->lineGap;
+    fa->sharedGlyphs = h->sharedGlyphs;
+    fa->sharedArea = h->sharedArea;
+    fa->mipFilter = (MipmapFilter)h->mipFilter;
+    fa->totalMipLevels = h->totalMipLevels;
+    if(h->totalMipLevels > 1){
+        sa->mipBitmaps[0] = 0;
+        for(unsigned int i = 1; i < h->totalMipLevels; i++){
+            sa->mipBitmaps[i] = base + h->mipOffsets[i];
+        }
+        fa->mipBitmaps = sa->mipBitmaps;
+        fa->mipWidths = h->mipWidths;
+        fa->mipHeights = h->mipHeights;
+    }
+    //a new attachment has to upload the whole atlas
+    markFontAtlasDirty(fa);
+}
+
+//claims the name for building, names start with a slash. SHARED_ATLAS_EXISTS means another
+//process claimed it first and the atlas should be attached instead
+SharedAtlasStatus claimSharedFontAtlas(SharedFontAtlas* sa, const char* name){
+    memset(sa, 0, sizeof(SharedFontAtlas));
+    sa->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(sa->fd < 0){
+        return errno == EEXIST ? SHARED_ATLAS_EXISTS : SHARED_ATLAS_ERROR;
+    }
+    return SHARED_ATLAS_OK;
+}
+
+//copies a built atlas into the claimed segment and marks it ready. sa->atlas then reads from the
+//segment like any attachment, fa stays the caller's to clear
+SharedAtlasStatus publishSharedFontAtlas(SharedFontAtlas* sa, FontAtlas* fa){
+    SharedAtlasHeader layout;
+    unsigned long totalBytes = getSharedAtlasLayout(fa, &layout);
+    if(sa->fd < 0 || ftruncate(sa->fd, totalBytes) != 0){
+        return SHARED_ATLAS_ERROR;
+    }
+    void* mapping = mmap(0, totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED, sa->fd, 0);
+    close(sa->fd);
+    sa->fd = -1;
+    if(mapping == MAP_FAILED){
+        return SHARED_ATLAS_ERROR;
+    }
+
+    unsigned char* base = (unsigned char*)mapping;
+    SharedAtlasHeader* h = (SharedAtlasHeader*)mapping;
+    unsigned int n = fa->totalCharacters;
+    if(fa->bitmap){
+        memcpy(base + layout.bitmapOffset, fa->bitmap, (unsigned long)fa->totalBitmapWidth * fa->totalBitmapHeight);
+    }
+    if(n){
+        memcpy(base + layout.characterCodesOffset, fa->characterCodes, n * sizeof(unsigned short));
+        memcpy(base + layout.xOffsetsOffset, fa->xOffsets, n * sizeof(unsigned int));
+        memcpy(base + layout.yOffsetsOffset, fa->yOffsets, n * sizeof(unsigned int));
+        memcpy(base + layout.widthsOffset, fa->widths, n * sizeof(unsigned int));
+        memcpy(base + layout.heightsOffset, fa->heights, n * sizeof(unsigned int));
+        memcpy(base + layout.xShiftsOffset, fa->xShifts, n * sizeof(float));
+        memcpy(base + layout.yShiftsOffset, fa->yShifts, n * sizeof(float));
+        memcpy(base + layout.phasesOffset, fa->phases, n);
+        memcpy(base + layout.glyphHashesOffset, fa->glyphHashes, n * sizeof(unsigned int));
+    }
+    for(unsigned int i = 1; i < layout.totalMipLevels; i++){
+        memcpy(base + layout.mipOffsets[i], fa->mipBitmaps[i], (unsigned long)layout.mipWidths[i] * layout.mipHeights[i]);
+    }
+    layout.ready = 0;
+    memcpy(h, &layout, sizeof(SharedAtlasHeader));
+
+    //everything above has to be visible before the flag is
+    __sync_synchronize();
+    h->ready = 1;
+    mprotect(mapping, totalBytes, PROT_READ);
+
+    sa->header = h;
+    sa->mappedBytes = totalBytes;
+    setSharedAtlasPointers(sa);
+    return SHARED_ATLAS_OK;
+}
+
+static unsigned long getSharedAtlasMilliseconds(){
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((unsigned long)t.tv_sec * 1000) + (t.tv_nsec / 1000000);
+}
+
+//maps an atlas another process published, waiting up to timeoutMilliseconds for it to be ready
+SharedAtlasStatus attachSharedFontAtlas(SharedFontAtlas* sa, const char* name, unsigned int timeoutMilliseconds){
+    memset(sa, 0, sizeof(SharedFontAtlas));
+    sa->fd = -1;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0){
+        return errno == ENOENT ? SHARED_ATLAS_NOT_FOUND : SHARED_ATLAS_ERROR;
+    }
+
+    //the builder only sizes the segment once the atlas is built, so an empty one is still building
+    unsigned long start = getSharedAtlasMilliseconds();
+    timespec pause = {0, 1000000};
+    struct stat st;
+    while(true){
+        if(fstat(fd, &st) != 0){
+            close(fd);
+            return SHARED_ATLAS_ERROR;
+        }
+        if((unsigned long)st.st_size >= sizeof(SharedAtlasHeader)){
+            break;
+        }
+        if(getSharedAtlasMilliseconds() - start >= timeoutMilliseconds){
+            close(fd);
+            return SHARED_ATLAS_TIMEOUT;
+        }
+        nanosleep(&pause, 0);
+    }
+    void* mapping = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        return SHARED_ATLAS_ERROR;
+    }
+    sa->header = (SharedAtlasHeader*)mapping;
+    sa->mappedBytes = st.st_size;
+
+    while(!sa->header->ready){
+        if(getSharedAtlasMilliseconds() - start >= timeoutMilliseconds){
+            munmap(mapping, sa->mappedBytes);
+            sa->header = 0;
+            return SHARED_ATLAS_TIMEOUT;
+        }
+        nanosleep(&pause, 0);
+    }
+    __sync_synchronize();
+
+    SharedAtlasHeader* h = sa->header;
+    if(h->magic != SHARED_ATLAS_MAGIC || h->version != SHARED_ATLAS_VERSION ||
+       h->headerBytes != sizeof(SharedAtlasHeader) || h->totalBytes > sa->mappedBytes){
+        munmap(mapping, sa->mappedBytes);
+        sa->header = 0;
+        return SHARED_ATLAS_VERSION_MISMATCH;
+    }
+    setSharedAtlasPointers(sa);
+    return SHARED_ATLAS_OK;
+}
+
+//the segment lives on until every process detached and the name was unlinked
+void detachSharedFontAtlas(SharedFontAtlas* sa){
+    if(sa->fd >= 0){
+        close(sa->fd);
+    }
+    if(sa->header){
+        munmap(sa->header, sa->mappedBytes);
+    }
+    memset(sa, 0, sizeof(SharedFontAtlas));
+    sa->fd = -1;
+}
+
+//removes the name so the next claim builds a fresh atlas, attached processes keep their mapping
+void unlinkSharedFontAtlas(const char* name){
+    shm_unlink(name);
+}
+
+//builds the atlas into the segment if this process claims the name first, otherwise attaches to
+//the one another process is building. settings are only used by the builder
+SharedAtlasStatus buildSharedFontAtlas(SharedFontAtlas* sa, const char* name, unsigned char* fontFileData, unsigned int totalCharacters, unsigned short* charCodes, FontAtlasSettings* settings, unsigned int timeoutMilliseconds){
+    SharedAtlasStatus status = claimSharedFontAtlas(sa, name);
+    if(status == SHARED_ATLAS_EXISTS){
+        return attachSharedFontAtlas(sa, name, timeoutMilliseconds);
+    }
+    if(status != SHARED_ATLAS_OK){
+        return status;
+    }
+
+    FontAtlas fa;
+    buildFontAtlas(&fa, fontFileData, totalCharacters, charCodes, settings);
+    status = publishSharedFontAtlas(sa, &fa);
+    clearFontAtlas(&fa);
+    if(status != SHARED_ATLAS_OK){
+        //nobody should wait on a segment that will never be ready
+        unlinkSharedFontAtlas(name);
+        detachSharedFontAtlas(sa);
+    }
+    return status;
+}
@@ -0,0 +1,338 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "font_atlas.h"
+#include "thread_pool.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//framebuffer rows are stored top to bottom, while quad positions use the
+//same y up pixel space as the orthographic projection of the Metal path
+struct Framebuffer{
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned char* pixels;
+};
+
+struct PixelColor{
+    unsigned char r;
+    unsigned char g;
+    unsigned char b;
+    unsigned char a;
+};
+
+struct GlyphQuadRect{
+    int left;
+    int right;
+    int bottom;
+    int top;
+    float x;
+    float y;
+    float uScale;
+    float vScale;
+    float u;
+    float v;
+};
+
+void initFramebuffer(Framebuffer* fb, unsigned int width, unsigned int height, unsigned int channels){
+    fb->width = width;
+    fb->height = height;
+    fb->channels = channels;
+    fb->pixels = new unsigned char[width * height * channels];
+    memset(fb->pixels, 0, width * height * channels);
+}
+
+void clearFramebuffer(Framebuffer* fb, PixelColor color){
+    unsigned int total = fb->width * fb->height;
+    if(fb->channels == 1){
+        memset(fb->pixels, ((color.r * 77) + (color.g * 150) + (color.b * 29)) >> 8, total);
+    }else{
+        for(unsigned int i = 0; i < total; i++){
+            fb->pixels[(i * 4) + 0] = color.r;
+            fb->pixels[(i * 4) + 1] = color.g;
+            fb->pixels[(i * 4) + 2] = color.b;
+            fb->pixels[(i * 4) + 3] = color.a;
+        }
+    }
+}
+
+void freeFramebuffer(Framebuffer* fb){
+    if(fb->pixels){
+        delete[] fb->pixels;
+        fb->pixels = 0;
+    }
+}
+
+//out = (dst * (255 - a) + src * a) / 255, rounded the same way in the scalar and SIMD paths
+static inline unsigned char blendChannel(unsigned char dst, unsigned char src, unsigned char a){
+    unsigned int x = (dst * (255 - a)) + (src * a) + 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static void blendGrayRow(unsigned char* dst, const unsigned char* alpha, unsigned char src, unsigned int count){
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i full = _mm_set1_epi16(255);
+    __m128i bias = _mm_set1_epi16(128);
+    __m128i srcv = _mm_set1_epi16(src);
+    for(; i + 16 <= count; i += 16){
+        __m128i d = _mm_loadu_si128((__m128i*)&dst[i]);
+        __m128i a = _mm_loadu_si128((__m128i*)&alpha[i]);
+        __m128i dl = _mm_unpacklo_epi8(d, zero);
+        __m128i dh = _mm_unpackhi_epi8(d, zero);
+        __m128i al = _mm_unpacklo_epi8(a, zero);
+        __m128i ah = _mm_unpackhi_epi8(a, zero);
+        __m128i xl = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dl, _mm_sub_epi16(full, al)), _mm_mullo_epi16(srcv, al)), bias);
+        __m128i xh = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dh, _mm_sub_epi16(full, ah)), _mm_mullo_epi16(srcv, ah)), bias);
+        xl = _mm_srli_epi16(_mm_add_epi16(xl, _mm_srli_epi16(xl, 8)), 8);
+        xh = _mm_srli_epi16(_mm_add_epi16(xh, _mm_srli_epi16(xh, 8)), 8);
+        _mm_storeu_si128((__m128i*)&dst[i], _mm_packus_epi16(xl, xh));
+    }
+#endif
+    for(; i < count; i++){
+        dst[i] = blendChannel(dst[i], src, alpha[i]);
+    }
+}
+
+static void blendRGBARow(unsigned char* dst, const unsigned char* alpha, PixelColor src, unsigned int count){
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i full = _mm_set1_epi16(255);
+    __m128i bias = _mm_set1_epi16(128);
+    __m128i srcv = _mm_set_epi16(255, src.b, src.g, src.r, 255, src.b, src.g, src.r);
+    for(; i + 4 <= count; i += 4){
+        __m128i d = _mm_loadu_si128((__m128i*)&dst[i * 4]);
+        int a4;
+        memcpy(&a4, &alpha[i], 4);
+        __m128i a = _mm_cvtsi32_si128(a4);
+        a = _mm_unpacklo_epi8(a, a);
+        a = _mm_unpacklo_epi16(a, a);
+        __m128i dl = _mm_unpacklo_epi8(d, zero);
+        __m128i dh = _mm_unpackhi_epi8(d, zero);
+        __m128i al = _mm_unpacklo_epi8(a, zero);
+        __m128i ah = _mm_unpackhi_epi8(a, zero);
+        __m128i xl = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dl, _mm_sub_epi16(full, al)), _mm_mullo_epi16(srcv, al)), bias);
+        __m128i xh = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dh, _mm_sub_epi16(full, ah)), _mm_mullo_epi16(srcv, ah)), bias);
+        xl = _mm_srli_epi16(_mm_add_epi16(xl, _mm_srli_epi16(xl, 8)), 8);
+        xh = _mm_srli_epi16(_mm_add_epi16(xh, _mm_srli_epi16(xh, 8)), 8);
+        _mm_storeu_si128((__m128i*)&dst[i * 4], _mm_packus_epi16(xl, xh));
+    }
+#endif
+    for(; i < count; i++){
+        unsigned char* p = &dst[i * 4];
+        p[0] = blendChannel(p[0], src.r, alpha[i]);
+        p[1] = blendChannel(p[1], src.g, alpha[i]);
+        p[2] = blendChannel(p[2], src.b, alpha[i]);
+        p[3] = blendChannel(p[3], 255, alpha[i]);
+    }
+}
+
+//quads are the six vertex, four float per vertex output of renderText
+static GlyphQuadRect getGlyphQuadRect(float* quad, FontAtlas* fa){
+    float left = quad[0];
+    float bottom = quad[1];
+    float right = quad[8];
+    float top = quad[9];
+
+    GlyphQuadRect r;
+    r.left = (int)floorf(left + 0.5f);
+    r.right = (int)floorf(right + 0.5f);
+    r.bottom = (int)floorf(bottom + 0.5f);
+    r.top = (int)floorf(top + 0.5f);
+    r.x = left;
+    r.y = bottom;
+    r.uScale = right > left ? ((quad[10] - quad[2]) * fa->totalBitmapWidth) / (right - left) : 0;
+    r.vScale = top > bottom ? ((quad[11] - quad[3]) * fa->totalBitmapHeight) / (top - bottom) : 0;
+    r.u = quad[2] * fa->totalBitmapWidth;
+    r.v = quad[3] * fa->totalBitmapHeight;
+    return r;
+}
+
+//composites one quad clipped to [x0, x1) x [y0, y1) in y up pixel space, sampling the atlas with nearest filtering
+static void drawGlyphQuadClipped(Framebuffer* fb, FontAtlas* fa, GlyphQuadRect* r, PixelColor color, int x0, int x1, int y0, int y1, unsigned char* coverage){
+    int left = r->left > x0 ? r->left : x0;
+    int right = r->right < x1 ? r->right : x1;
+    int bottom = r->bottom > y0 ? r->bottom : y0;
+    int top = r->top < y1 ? r->top : y1;
+    if(left >= right || bottom >= top){
+        return;
+    }
+
+    unsigned int count = right - left;
+    unsigned char gray = ((color.r * 77) + (color.g * 150) + (color.b * 29)) >> 8;
+    for(int y = bottom; y < top; y++){
+        int ty = (int)(r->v + (((y + 0.5f) - r->y) * r->vScale));
+        if(ty < 0) ty = 0;
+        if(ty >= (int)fa->totalBitmapHeight) ty = fa->totalBitmapHeight - 1;
+        unsigned char* texRow = &fa->bitmap[ty * fa->totalBitmapWidth];
+
+        for(unsigned int i = 0; i < count; i++){
+            int tx = (int)(r->u + (((left + i + 0.5f) - r->x) * r->uScale));
+            if(tx < 0) tx = 0;
+            if(tx >= (int)fa->totalBitmapWidth) tx = fa->totalBitmapWidth - 1;
+            unsigned int a = (texRow[tx] * color.a) + 128;
+            coverage[i] = (a + (a >> 8)) >> 8;
+        }
+
+        unsigned char* dst = &fb->pixels[(((fb->height - 1 - y) * fb->width) + left) * fb->channels];
+        if(fb->channels == 1){
+            blendGrayRow(dst, coverage, gray, count);
+        }else{
+            blendRGBARow(dst, coverage, color, count);
+        }
+    }
+}
+
+static const unsigned int SOFTWARE_TILE_SIZE = 64;
+
+struct SoftwareRenderJob{
+    Framebuffer* fb;
+    FontAtlas* fa;
+    PixelColor color;
+    GlyphQuadRect* rects;
+    unsigned int tilesX;
+    unsigned int* binStarts;
+    unsigned int* binQuads;
+};
+
+static void renderSoftwareTile(void* data, unsigned int tile){
+    SoftwareRenderJob* job = (SoftwareRenderJob*)data;
+    int x0 = (tile % job->tilesX) * SOFTWARE_TILE_SIZE;
+    int y0 = (tile / job->tilesX) * SOFTWARE_TILE_SIZE;
+    int x1 = x0 + SOFTWARE_TILE_SIZE < job->fb->width ? x0 + SOFTWARE_TILE_SIZE : job->fb->width;
+    int y1 = y0 + SOFTWARE_TILE_SIZE < job->fb->height ? y0 + SOFTWARE_TILE_SIZE : job->fb->height;
+
+    unsigned char coverage[SOFTWARE_TILE_SIZE];
+    for(unsigned int i = job->binStarts[tile]; i < job->binStarts[tile + 1]; i++){
+        drawGlyphQuadClipped(job->fb, job->fa, &job->rects[job->binQuads[i]], job->color, x0, x1, y0, y1, coverage);
+    }
+}
+
+//bins quads into tiles and composites the tiles in parallel, quads keep their submission order within a tile
+void renderGlyphQuads(Framebuffer* fb, FontAtlas* fa, float* vertices, unsigned int totalVertices, PixelColor color, ThreadPool* pool){
+    unsigned int totalQuads = totalVertices / 6;
+    if(totalQuads == 0){
+        return;
+    }
+
+    unsigned int tilesX = (fb->width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    unsigned int tilesY = (fb->height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    unsigned int totalTiles = tilesX * tilesY;
+
+    GlyphQuadRect* rects = new GlyphQuadRect[totalQuads];
+    unsigned int* binStarts = new unsigned int[totalTiles + 1];
+    memset(binStarts, 0, sizeof(unsigned int) * (totalTiles + 1));
+
+    for(int pass = 0; pass < 2; pass++){
+        unsigned int* binQuads = 0;
+        unsigned int* binFill = 0;
+        if(pass == 1){
+            for(unsigned int i = 0; i < totalTiles; i++){
+                binStarts[i + 1] += binStarts[i];
+            }
+            binQuads = new unsigned int[binStarts[totalTiles]];
+            binFill = new unsigned int[totalTiles];
+            memcpy(binFill, binStarts, sizeof(unsigned int) * totalTiles);
+        }
+
+        for(unsigned int i = 0; i < totalQuads; i++){
+            GlyphQuadRect* r = &rects[i];
+            if(pass == 0){
+                *r = getGlyphQuadRect(&vertices[i * 24], fa);
+            }
+            int left = r->left > 0 ? r->left : 0;
+            int bottom = r->bottom > 0 ? r->bottom : 0;
+            int right = r->right < (int)fb->width ? r->right : fb->width;
+            int top = r->top < (int)fb->height ? r->top : fb->height;
+            if(left >= right || bottom >= top){
+                continue;
+            }
+            for(unsigned int ty = bottom / SOFTWARE_TILE_SIZE; ty <= (top - 1) / SOFTWARE_TILE_SIZE; ty++){
+                for(unsigned int tx = left / SOFTWARE_TILE_SIZE; tx <= (right - 1) / SOFTWARE_TILE_SIZE; tx++){
+                    unsigned int tile = (ty * tilesX) + tx;
+                    if(pass == 0){
+                        binStarts[tile + 1]++;
+                    }else{
+                        binQuads[binFill[tile]++] = i;
+                    }
+                }
+            }
+        }
+
+        if(pass == 1){
+            SoftwareRenderJob job;
+            job.fb = fb;
+            job.fa = fa;
+            job.color = color;
+            job.rects = rects;
+            job.tilesX = tilesX;
+            job.binStarts = binStarts;
+            job.binQuads = binQuads;
+            runParallel(pool, renderSoftwareTile, &job, totalTiles);
+
+            delete[] binQuads;
+            delete[] binFill;
+        }
+    }
+
+    delete[] binStarts;
+    delete[] rects;
+}
+
+bool writeFramebufferPGM(Framebuffer* fb, const char* fileName){
+    FILE* file = fopen(fileName, "wb");
+    if(!file){
+        return false;
+    }
+    fprintf(file, "P5\n%u %u\n255\n", fb->width, fb->height);
+    if(fb->channels == 1){
+        fwrite(fb->pixels, 1, fb->width * fb->height, file);
+    }else{
+        unsigned char* row = new unsigned char[fb->width];
+        for(unsigned int i = 0; i < fb->height; i++){
+            unsigned char* p = &fb->pixels[i * fb->width * 4];
+            for(unsigned int j = 0; j < fb->width; j++){
+                row[j] = ((p[j * 4] * 77) + (p[(j * 4) + 1] * 150) + (p[(j * 4) + 2] * 29)) >> 8;
+            }
+            fwrite(row, 1, fb->width, file);
+        }
+        delete[] row;
+    }
+    fclose(file);
+    return true;
+}
+
+bool writeFramebufferPPM(Framebuffer* fb, const char* fileName){
+    FILE* file = fopen(fileName, "wb");
+    if(!file){
+        return false;
+    }
+    fprintf(file, "P6\n%u %u\n255\n", fb->width, fb->height);
+    unsigned char* row = new unsigned char[fb->width * 3];
+    for(unsigned int i = 0; i < fb->height; i++){
+        unsigned char* p = &fb->pixels[i * fb->width * fb->channels];
+        for(unsigned int j = 0; j < fb->width; j++){
+            if(fb->channels == 1){
+                row[(j * 3) + 0] = p[j];
+                row[(j * 3) + 1] = p[j];
+                row[(j * 3) + 2] = p[j];
+            }else{
+                row[(j * 3) + 0] = p[(j * 4) + 0];
+                row[(j * 3) + 1] = p[(j * 4) + 1];
+                row[(j * 3) + 2] = p[(j * 4) + 2];
+            }
+        }
+        fwrite(row, 1, fb->width * 3, file);
+    }
+    delete[] row;
+    fclose(file);
+    return true;
+}
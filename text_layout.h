@@ -0,0 +1,548 @@
+#pragma once
+
+#include "font_atlas.h"
+#include "text_renderer.h"
+
+enum LineBreakClass{
+    LINE_BREAK_AL,
+    LINE_BREAK_BK,
+    LINE_BREAK_CR,
+    LINE_BREAK_LF,
+    LINE_BREAK_SP,
+    LINE_BREAK_BA,
+    LINE_BREAK_HY,
+    LINE_BREAK_SY,
+    LINE_BREAK_OP,
+    LINE_BREAK_CL,
+    LINE_BREAK_NU
+};
+
+struct LayoutLine{
+    //offsets are relative to the start of the owning paragraph
+    unsigned int start;
+    unsigned int end;
+    unsigned int next;
+    float width;
+};
+
+struct LayoutParagraph{
+    unsigned int start;
+    unsigned int length;
+    unsigned int breakLength;
+    float naturalWidth;
+    LayoutLine* lines;
+    unsigned int totalLines;
+    unsigned int lineCapacity;
+};
+
+struct TextLayout{
+    FontAtlas* fa;
+    const char* text;
+    unsigned int textLength;
+    float boxWidth;
+    float scale;
+    float ascent;
+    float descent;
+    float lineGap;
+    float lineHeight;
+    //highest and lowest ink of any glyph relative to the baseline, for culling whole lines
+    float inkTop;
+    float inkBottom;
+    //per byte value, other codepoints are looked up in the atlas as they come
+    float advances[256];
+    int glyphSlots[256];
+    LayoutParagraph* paragraphs;
+    unsigned int totalParagraphs;
+    unsigned int paragraphCapacity;
+    unsigned int totalLines;
+    unsigned int reflowedParagraphs;
+};
+
+//a reduced UAX #14 class table, characters outside ascii are all alphabetic
+LineBreakClass getLineBreakClass(unsigned int c){
+    switch(c){
+        case '\n': return LINE_BREAK_LF;
+        case '\r': return LINE_BREAK_CR;
+        case '\f':
+        case '\v': return LINE_BREAK_BK;
+        case ' ': return LINE_BREAK_SP;
+        case '\t':
+        case '|': return LINE_BREAK_BA;
+        case '-': return LINE_BREAK_HY;
+        case '/': return LINE_BREAK_SY;
+        case '(':
+        case '[':
+        case '{': return LINE_BREAK_OP;
+        case ')':
+        case ']':
+        case '}':
+        case ',':
+        case '.':
+        case ';':
+        case ':':
+        case '!':
+        case '?': return LINE_BREAK_CL;
+    }
+    if(c >= '0' && c <= '9'){
+        return LINE_BREAK_NU;
+    }
+    return LINE_BREAK_AL;
+}
+
+bool isHardLineBreak(unsigned int c){
+    LineBreakClass lbc = getLineBreakClass(c);
+    return lbc == LINE_BREAK_BK || lbc == LINE_BREAK_CR || lbc == LINE_BREAK_LF;
+}
+
+//returns true if a line may start at position i of s, where lineStart < i and i starts a utf-8
+//sequence. the bytes of multibyte sequences all class as alphabetic like the characters they encode
+bool isLineBreakOpportunity(const char* s, unsigned int lineStart, unsigned int i){
+    LineBreakClass cur = getLineBreakClass((unsigned char)s[i]);
+    LineBreakClass prev = getLineBreakClass((unsigned char)s[i - 1]);
+
+    if(cur == LINE_BREAK_SP || cur == LINE_BREAK_CL){
+        return false;
+    }
+
+    if(prev == LINE_BREAK_SP){
+        unsigned int j = i - 1;
+        while(j > lineStart && getLineBreakClass((unsigned char)s[j - 1]) == LINE_BREAK_SP){
+            j--;
+        }
+        if(j > lineStart && getLineBreakClass((unsigned char)s[j - 1]) == LINE_BREAK_OP){
+            return false;
+        }
+        return true;
+    }else if(prev == LINE_BREAK_BA){
+        return true;
+    }else if(prev == LINE_BREAK_HY || prev == LINE_BREAK_SY){
+        return cur != LINE_BREAK_NU;
+    }
+    return false;
+}
+
+void initTextLayout(TextLayout* tl, FontAtlas* fa, float scale){
+    tl->fa = fa;
+    tl->text = 0;
+    tl->textLength = 0;
+    tl->boxWidth = 0;
+    tl->scale = scale;
+    tl->ascent = fa->ascent * scale;
+    tl->descent = fa->descent * scale;
+    tl->lineGap = fa->lineGap * scale;
+    tl->lineHeight = (fa->ascent - fa->descent + fa->lineGap) * scale;
+    tl->paragraphs = 0;
+    tl->totalParagraphs = 0;
+    tl->paragraphCapacity = 0;
+    tl->totalLines = 0;
+    tl->reflowedParagraphs = 0;
+    tl->inkTop = 0;
+    tl->inkBottom = 0;
+
+    for(int i = 0; i < 256; i++){
+        int slot = findFontAtlasCharacter(fa, i);
+        tl->glyphSlots[i] = slot;
+        tl->advances[i] = slot >= 0 ? fa->xShifts[slot] * scale : 0;
+    }
+    //every glyph in the atlas, the text can hold characters past the cached ones
+    for(unsigned int i = 0; i < fa->totalCharacters; i++){
+        float top = (fa->heights[i] + fa->yShifts[i]) * scale;
+        float bottom = fa->yShifts[i] * scale;
+        tl->inkTop = top > tl->inkTop ? top : tl->inkTop;
+        tl->inkBottom = bottom < tl->inkBottom ? bottom : tl->inkBottom;
+    }
+}
+
+//decodes the character starting at s[*i], where s holds length bytes, and steps *i past it. slot
+//is -1 and the advance 0 when the atlas lacks the character
+static unsigned int nextLayoutCharacter(TextLayout* tl, const char* s, unsigned int length, unsigned int* i, int* slot, float* advance){
+    unsigned int c = (unsigned char)s[*i];
+    if(c < 0x80){
+        (*i)++;
+    }else{
+        const char* t = s + *i;
+        c = decodeUtf8(&t, s + length);
+        *i = t - s;
+    }
+    if(c < 256){
+        *slot = tl->glyphSlots[c];
+        *advance = tl->advances[c];
+    }else{
+        *slot = c <= 0xffff ? findFontAtlasCharacter(tl->fa, c) : -1;
+        *advance = *slot >= 0 ? tl->fa->xShifts[*slot] * tl->scale : 0;
+    }
+    return c;
+}
+
+static void addLayoutLine(LayoutParagraph* p, unsigned int start, unsigned int end, unsigned int next, float width){
+    if(p->totalLines == p->lineCapacity){
+        unsigned int newCapacity = p->lineCapacity ? p->lineCapacity * 2 : 4;
+        LayoutLine* newLines = new LayoutLine[newCapacity];
+        for(int i = 0; i < p->totalLines; i++){
+            newLines[i] = p->lines[i];
+        }
+        if(p->lines){
+            delete[] p->lines;
+        }
+        p->lines = newLines;
+        p->lineCapacity = newCapacity;
+    }
+
+    LayoutLine* l = &p->lines[p->totalLines++];
+    l->start = start;
+    l->end = end;
+    l->next = next;
+    l->width = width;
+}
+
+static void flowLayoutParagraph(TextLayout* tl, LayoutParagraph* p){
+    const char* s = tl->text + p->start;
+    tl->totalLines -= p->totalLines;
+    p->totalLines = 0;
+
+    unsigned int lineStart = 0;
+    unsigned int contentEnd = 0;
+    float width = 0;
+    float contentWidth = 0;
+    unsigned int breakPos = 0;
+    unsigned int breakEnd = 0;
+    float breakWidth = 0;
+
+    unsigned int i = 0;
+    while(i < p->length){
+        int slot;
+        float adv;
+        unsigned int next = i;
+        unsigned int c = nextLayoutCharacter(tl, s, p->length, &next, &slot, &adv);
+
+        if(i > lineStart && isLineBreakOpportunity(s, lineStart, i)){
+            breakPos = i;
+            breakEnd = contentEnd;
+            breakWidth = contentWidth;
+        }
+
+        if(getLineBreakClass(c) == LINE_BREAK_SP){
+            width += adv;
+            i = next;
+            continue;
+        }
+
+        if(width + adv > tl->boxWidth && contentEnd > lineStart){
+            if(breakPos > lineStart){
+                addLayoutLine(p, lineStart, breakEnd, breakPos, breakWidth);
+                lineStart = breakPos;
+                width = 0;
+                contentEnd = lineStart;
+                contentWidth = 0;
+                unsigned int j = lineStart;
+                while(j < i){
+                    int jSlot;
+                    float jAdv;
+                    unsigned int jc = nextLayoutCharacter(tl, s, p->length, &j, &jSlot, &jAdv);
+                    width += jAdv;
+                    if(getLineBreakClass(jc) != LINE_BREAK_SP){
+                        contentEnd = j;
+                        contentWidth = width;
+                    }
+                }
+            }else{
+                //no opportunity on this line, so break inside the word
+                addLayoutLine(p, lineStart, contentEnd, i, contentWidth);
+                lineStart = i;
+                width = 0;
+                contentEnd = i;
+                contentWidth = 0;
+            }
+        }
+
+        width += adv;
+        contentEnd = next;
+        contentWidth = width;
+        i = next;
+    }
+
+    addLayoutLine(p, lineStart, contentEnd, p->length, contentWidth);
+    tl->totalLines += p->totalLines;
+    tl->reflowedParagraphs++;
+}
+
+static void measureLayoutParagraph(TextLayout* tl, LayoutParagraph* p){
+    const char* s = tl->text + p->start;
+    float width = 0;
+    p->naturalWidth = 0;
+    unsigned int i = 0;
+    while(i < p->length){
+        int slot;
+        float adv;
+        unsigned int c = nextLayoutCharacter(tl, s, p->length, &i, &slot, &adv);
+        width += adv;
+        if(getLineBreakClass(c) != LINE_BREAK_SP){
+            p->naturalWidth = width;
+        }
+    }
+}
+
+//splits text[from, to) into paragraphs at hard breaks, writing them to out and returning the count
+static unsigned int splitLayoutParagraphs(TextLayout* tl, unsigned int from, unsigned int to, bool atEnd, LayoutParagraph* out){
+    unsigned int total = 0;
+    unsigned int start = from;
+    unsigned int i = from;
+    bool endsWithBreak = false;
+
+    while(i < to){
+        unsigned char c = tl->text[i];
+        if(isHardLineBreak(c)){
+            unsigned int breakLength = 1;
+            if(c == '\r' && i + 1 < to && tl->text[i + 1] == '\n'){
+                breakLength = 2;
+            }
+            if(out){
+                LayoutParagraph* p = &out[total];
+                p->start = start;
+                p->length = i - start;
+                p->breakLength = breakLength;
+                p->lines = 0;
+                p->totalLines = 0;
+                p->lineCapacity = 0;
+            }
+            total++;
+            i += breakLength;
+            start = i;
+            endsWithBreak = true;
+        }else{
+            i++;
+            endsWithBreak = false;
+        }
+    }
+
+    if(start < to || ((endsWithBreak || from == to) && atEnd)){
+        if(out){
+            LayoutParagraph* p = &out[total];
+            p->start = start;
+            p->length = to - start;
+            p->breakLength = 0;
+            p->lines = 0;
+            p->totalLines = 0;
+            p->lineCapacity = 0;
+        }
+        total++;
+    }
+
+    return total;
+}
+
+static void reserveLayoutParagraphs(TextLayout* tl, unsigned int total){
+    if(total <= tl->paragraphCapacity){
+        return;
+    }
+    unsigned int newCapacity = tl->paragraphCapacity ? tl->paragraphCapacity : 8;
+    while(newCapacity < total){
+        newCapacity *= 2;
+    }
+    LayoutParagraph* newParagraphs = new LayoutParagraph[newCapacity];
+    for(int i = 0; i < tl->totalParagraphs; i++){
+        newParagraphs[i] = tl->paragraphs[i];
+    }
+    if(tl->paragraphs){
+        delete[] tl->paragraphs;
+    }
+    tl->paragraphs = newParagraphs;
+    tl->paragraphCapacity = newCapacity;
+}
+
+void clearTextLayout(TextLayout* tl){
+    for(int i = 0; i < tl->totalParagraphs; i++){
+        if(tl->paragraphs[i].lines){
+            delete[] tl->paragraphs[i].lines;
+        }
+    }
+    if(tl->paragraphs){
+        delete[] tl->paragraphs;
+    }
+    tl->paragraphs = 0;
+    tl->totalParagraphs = 0;
+    tl->paragraphCapacity = 0;
+    tl->totalLines = 0;
+}
+
+void setTextLayoutText(TextLayout* tl, const char* text, unsigned int textLength, float boxWidth){
+    clearTextLayout(tl);
+    tl->text = text;
+    tl->textLength = textLength;
+    tl->boxWidth = boxWidth;
+    tl->reflowedParagraphs = 0;
+
+    unsigned int total = splitLayoutParagraphs(tl, 0, textLength, true, 0);
+    reserveLayoutParagraphs(tl, total);
+    tl->totalParagraphs = splitLayoutParagraphs(tl, 0, textLength, true, tl->paragraphs);
+    for(int i = 0; i < tl->totalParagraphs; i++){
+        measureLayoutParagraph(tl, &tl->paragraphs[i]);
+        flowLayoutParagraph(tl, &tl->paragraphs[i]);
+    }
+}
+
+//only paragraphs that wrapped before or no longer fit are flowed again
+void setTextLayoutWidth(TextLayout* tl, float boxWidth){
+    tl->boxWidth = boxWidth;
+    tl->reflowedParagraphs = 0;
+    for(int i = 0; i < tl->totalParagraphs; i++){
+        LayoutParagraph* p = &tl->paragraphs[i];
+        if(p->totalLines == 1 && p->naturalWidth <= boxWidth){
+            continue;
+        }
+        flowLayoutParagraph(tl, p);
+    }
+}
+
+//text is the full buffer after the edit, which replaced removedLength bytes at editStart with insertedLength bytes
+void replaceTextLayoutSpan(TextLayout* tl, const char* text, unsigned int textLength, unsigned int editStart, unsigned int removedLength, unsigned int insertedLength){
+    //nothing laid out yet to patch, the whole text is laid out instead
+    if(tl->totalParagraphs == 0){
+        setTextLayoutText(tl, text, textLength, tl->boxWidth);
+        return;
+    }
+    tl->text = text;
+    tl->textLength = textLength;
+    tl->reflowedParagraphs = 0;
+
+    unsigned int a = 0;
+    while(a < tl->totalParagraphs - 1 && editStart >= tl->paragraphs[a].start + tl->paragraphs[a].length + tl->paragraphs[a].breakLength){
+        a++;
+    }
+    //an edit at the start of a paragraph can join or split the break before it, e.g. a CR gaining an LF
+    if(a > 0 && editStart == tl->paragraphs[a].start){
+        a--;
+    }
+    unsigned int editEnd = editStart + removedLength;
+    unsigned int b = a;
+    while(b < tl->totalParagraphs - 1 && editEnd > tl->paragraphs[b].start + tl->paragraphs[b].length){
+        b++;
+    }
+
+    int delta = (int)insertedLength - (int)removedLength;
+    unsigned int from = tl->paragraphs[a].start;
+    unsigned int to = tl->paragraphs[b].start + tl->paragraphs[b].length + tl->paragraphs[b].breakLength + delta;
+
+    bool atEnd = b == tl->totalParagraphs - 1;
+    unsigned int totalNew = splitLayoutParagraphs(tl, from, to, atEnd, 0);
+    unsigned int totalOld = b - a + 1;
+    unsigned int newTotal = tl->totalParagraphs - totalOld + totalNew;
+
+    for(unsigned int i = a; i <= b; i++){
+        tl->totalLines -= tl->paragraphs[i].totalLines;
+        if(tl->paragraphs[i].lines){
+            delete[] tl->paragraphs[i].lines;
+        }
+    }
+
+    reserveLayoutParagraphs(tl, newTotal);
+    if(totalNew != totalOld){
+        if(totalNew > totalOld){
+            for(int i = tl->totalParagraphs - 1; i > (int)b; i--){
+                tl->paragraphs[i + totalNew - totalOld] = tl->paragraphs[i];
+            }
+        }else{
+            for(unsigned int i = b + 1; i < tl->totalParagraphs; i++){
+                tl->paragraphs[i + totalNew - totalOld] = tl->paragraphs[i];
+            }
+        }
+    }
+    for(unsigned int i = a + totalNew; i < newTotal; i++){
+        tl->paragraphs[i].start += delta;
+    }
+    tl->totalParagraphs = newTotal;
+
+    splitLayoutParagraphs(tl, from, to, atEnd, &tl->paragraphs[a]);
+    for(unsigned int i = a; i < a + totalNew; i++){
+        measureLayoutParagraph(tl, &tl->paragraphs[i]);
+        flowLayoutParagraph(tl, &tl->paragraphs[i]);
+    }
+}
+
+float getTextLayoutHeight(TextLayout* tl){
+    return tl->totalLines * tl->lineHeight;
+}
+
+//x and y are the top left corner of the layout box, with y increasing upwards like renderText
+int renderTextLayout(float* vecPtr, TextLayout* tl, float x, float y){
+    int ctr = 0;
+    float baseline = y - tl->ascent;
+    for(int i = 0; i < tl->totalParagraphs; i++){
+        LayoutParagraph* p = &tl->paragraphs[i];
+        const char* s = tl->text + p->start;
+        for(int j = 0; j < p->totalLines; j++){
+            LayoutLine* l = &p->lines[j];
+            float xMarker = x;
+            unsigned int k = l->start;
+            while(k < l->end){
+                int slot;
+                float adv;
+                unsigned int c = nextLayoutCharacter(tl, s, p->length, &k, &slot, &adv);
+                if(slot >= 0 && getLineBreakClass(c) != LINE_BREAK_SP){
+                    ctr += emitGlyphQuad(&vecPtr[ctr], tl->fa, slot, xMarker, baseline, tl->scale);
+                }
+                xMarker += adv;
+            }
+            baseline -= tl->lineHeight;
+        }
+    }
+    return ctr;
+}
+
+//renderTextLayout for a viewport. lines above clip are stepped over without reading their text,
+//a whole paragraph at a time, and drawing ends at the first line below it. each line stops at the
+//clip's right edge and only glyphs touching clip write vertices, trimmed to it when trim is set
+int renderClippedTextLayout(float* vecPtr, TextLayout* tl, float x, float y, ClipRect* clip, bool trim = false){
+    int ctr = 0;
+    float baseline = y - tl->ascent;
+    for(int i = 0; i < tl->totalParagraphs; i++){
+        LayoutParagraph* p = &tl->paragraphs[i];
+        const char* s = tl->text + p->start;
+        float lastBaseline = baseline;
+        for(int j = 1; j < p->totalLines; j++){
+            lastBaseline -= tl->lineHeight;
+        }
+        if(lastBaseline + tl->inkBottom >= clip->top){
+            baseline = lastBaseline - (p->totalLines ? tl->lineHeight : 0);
+            continue;
+        }
+        for(int j = 0; j < p->totalLines; j++){
+            if(baseline + tl->inkTop <= clip->bottom){
+                return ctr;
+            }
+            if(baseline + tl->inkBottom < clip->top){
+                LayoutLine* l = &p->lines[j];
+                float xMarker = x;
+                unsigned int k = l->start;
+                while(k < l->end && xMarker < clip->right){
+                    int slot;
+                    float adv;
+                    unsigned int c = nextLayoutCharacter(tl, s, p->length, &k, &slot, &adv);
+                    if(slot >= 0 && getLineBreakClass(c) != LINE_BREAK_SP){
+                        ctr += emitClippedGlyphQuad(&vecPtr[ctr], tl->fa, slot, xMarker, baseline, tl->scale, clip, trim);
+                    }
+                    xMarker += adv;
+                }
+            }
+            baseline -= tl->lineHeight;
+        }
+    }
+    return ctr;
+}
+
+//renderTextLayout into the context's buffer after the vertices already there, returns the vertices
+//added. a layout only reads its atlas and text while drawing, so threads can draw one layout, or
+//lay out and draw their own, into separate contexts at once. reflowing needs the layout to itself
+unsigned int appendTextLayout(TextRenderContext* ctx, TextLayout* tl, float x, float y){
+    float* vecPtr = reserveTextRenderVertices(ctx, tl->textLength * 6);
+    unsigned int added = renderTextLayout(vecPtr, tl, x, y) / 4;
+    ctx->totalVertices += added;
+    return added;
+}
+
+unsigned int appendClippedTextLayout(TextRenderContext* ctx, TextLayout* tl, float x, float y, ClipRect* clip, bool trim = false){
+    float* vecPtr = reserveTextRenderVertices(ctx, tl->textLength * 6);
+    unsigned int added = renderClippedTextLayout(vecPtr, tl, x, y, clip, trim) / 4;
+    ctx->totalVertices += added;
+    return added;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "font_atlas.h"
+#include "text_renderer.h"
+
+//sizes text from the atlas metrics alone, without generating quads. the advance and ink bounds
+//follow renderText, so a box sized from them fits what is drawn: pens advance by the glyph
+//advances, whole pixels at a time unless the atlas has subpixel phases, and a glyph's ink is its
+//quad, the glyf bounds rasterized into the atlas. with subpixel phases the ink is placed at the
+//fractional pen, within a pixel of the variant renderText picks. line breaks, which renderText
+//doesn't draw, start a new line one lineHeight down like renderTextLayout. characters the atlas
+//lacks are skipped the same way renderText skips them
+
+struct TextMeasure{
+    FontAtlas* fa;
+    float scale;
+    float lineHeight;
+    //per byte value, other codepoints are looked up in the atlas as they come
+    int slots[256];
+    float advances[256];
+    float inkWidths[256];
+    float inkBottoms[256];
+    float inkTops[256];
+};
+
+//y increases upwards from the first baseline, ink is all 0 for text without any
+struct TextExtents{
+    //pen travel of the longest line
+    float advance;
+    float inkLeft;
+    float inkBottom;
+    float inkRight;
+    float inkTop;
+    unsigned int lines;
+};
+
+void initTextMeasure(TextMeasure* tm, FontAtlas* fa, float scale){
+    tm->fa = fa;
+    tm->scale = scale;
+    tm->lineHeight = (fa->ascent - fa->descent + fa->lineGap) * scale;
+    for(int i = 0; i < 256; i++){
+        int slot = findFontAtlasCharacter(fa, i);
+        tm->slots[i] = slot;
+        tm->advances[i] = slot >= 0 ? fa->xShifts[slot] * scale : 0;
+        tm->inkWidths[i] = slot >= 0 && i != ' ' ? fa->widths[slot] * scale : 0;
+        tm->inkBottoms[i] = slot >= 0 ? fa->yShifts[slot] * scale : 0;
+        tm->inkTops[i] = slot >= 0 ? (fa->heights[slot] + fa->yShifts[slot]) * scale : 0;
+    }
+}
+
+//advance, ink width and vertical ink of one codepoint, false if the atlas doesn't have it
+static bool getTextMeasureGlyph(TextMeasure* tm, unsigned int c, float* advance, float* inkWidth, float* inkBottom, float* inkTop){
+    if(c < 256){
+        if(tm->slots[c] < 0){
+            return false;
+        }
+        *advance = tm->advances[c];
+        *inkWidth = tm->inkWidths[c];
+        *inkBottom = tm->inkBottoms[c];
+        *inkTop = tm->inkTops[c];
+        return true;
+    }
+    int slot = c <= 0xffff ? findFontAtlasCharacter(tm->fa, c) : -1;
+    if(slot < 0){
+        return false;
+    }
+    FontAtlas* fa = tm->fa;
+    *advance = fa->xShifts[slot] * tm->scale;
+    *inkWidth = fa->widths[slot] * tm->scale;
+    *inkBottom = fa->yShifts[slot] * tm->scale;
+    *inkTop = (fa->heights[slot] + fa->yShifts[slot]) * tm->scale;
+    return true;
+}
+
+//the first length bytes of text
+TextExtents measureTextLength(TextMeasure* tm, const char* text, unsigned int length){
+    TextExtents e = {0, 0, 0, 0, 0, 1};
+    bool wholePixels = tm->fa->subpixelPhases <= 1;
+    bool hasInk = false;
+    float baseline = 0;
+    float pen = 0;
+    const char* t = text;
+    const char* end = text + length;
+    while(t < end){
+        unsigned int c = (unsigned char)*t;
+        if(c == '\n' || c == '\r'){
+            t += c == '\r' && t + 1 < end && t[1] == '\n' ? 2 : 1;
+            e.advance = pen > e.advance ? pen : e.advance;
+            pen = 0;
+            baseline -= tm->lineHeight;
+            e.lines++;
+            continue;
+        }
+        if(c < 0x80){
+            t++;
+        }else{
+            c = decodeUtf8(&t, end);
+        }
+        float advance, inkWidth, inkBottom, inkTop;
+        if(!getTextMeasureGlyph(tm, c, &advance, &inkWidth, &inkBottom, &inkTop)){
+            continue;
+        }
+        if(inkWidth > 0){
+            float left = pen;
+            float right = pen + inkWidth;
+            float bottom = baseline + inkBottom;
+            float top = baseline + inkTop;
+            if(!hasInk){
+                e.inkLeft = left;
+                e.inkRight = right;
+                e.inkBottom = bottom;
+                e.inkTop = top;
+                hasInk = true;
+            }else{
+                e.inkLeft = left < e.inkLeft ? left : e.inkLeft;
+                e.inkRight = right > e.inkRight ? right : e.inkRight;
+                e.inkBottom = bottom < e.inkBottom ? bottom : e.inkBottom;
+                e.inkTop = top > e.inkTop ? top : e.inkTop;
+            }
+        }
+        //renderText keeps an integer pen unless it places glyphs at subpixel positions
+        pen = wholePixels ? (float)(int)(pen + advance) : pen + advance;
+    }
+    e.advance = pen > e.advance ? pen : e.advance;
+    return e;
+}
+
+TextExtents measureText(TextMeasure* tm, const char* text){
+    return measureTextLength(tm, text, strlen(text));
+}
+
+//only the pen travel of a single line, the cheapest measure for fitting labels
+float measureTextAdvance(TextMeasure* tm, const char* text){
+    bool wholePixels = tm->fa->subpixelPhases <= 1;
+    float pen = 0;
+    const char* t = text;
+    while(*t != '\0'){
+        unsigned int c = (unsigned char)*t;
+        float advance;
+        if(c < 0x80){
+            t++;
+            if(tm->slots[c] < 0){
+                continue;
+            }
+            advance = tm->advances[c];
+        }else{
+            float inkWidth, inkBottom, inkTop;
+            c = decodeUtf8(&t);
+            if(!getTextMeasureGlyph(tm, c, &advance, &inkWidth, &inkBottom, &inkTop)){
+                continue;
+            }
+        }
+        pen = wholePixels ? (float)(int)(pen + advance) : pen + advance;
+    }
+    return pen;
+}
+
+//measures many strings in one call, extents[i] is for texts[i]
+void measureTexts(TextMeasure* tm, const char** texts, unsigned int totalTexts, TextExtents* extents){
+    for(unsigned int i = 0; i < totalTexts; i++){
+        extents[i] = measureText(tm, texts[i]);
+    }
+}
+
+void measureTextAdvances(TextMeasure* tm, const char** texts, unsigned int totalTexts, float* advances){
+    for(unsigned int i = 0; i < totalTexts; i++){
+        advances[i] = measureTextAdvance(tm, texts[i]);
+    }
+}
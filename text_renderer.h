@@ -0,0 +1,339 @@
+#pragma once
+
+#include <math.h>
+#include <string.h>
+
+#include "font_atlas.h"
+#include "atlas_allocator.h"
+
+//vertices written by renderText and renderClippedText, for single threaded callers that draw one
+//buffer. every other renderer only returns what it wrote, and TextRenderContext keeps its own count
+int vertexCount = 0;
+
+//reads one codepoint and moves past it, malformed sequences read as U+FFFD one byte at a time.
+//a sequence cut off by end, or by the terminator when end is 0, is malformed too
+unsigned int decodeUtf8(const char** text, const char* end = 0){
+    const unsigned char* t = (const unsigned char*)*text;
+    unsigned int c = t[0];
+    unsigned int length = 1;
+    unsigned int min = 0;
+    if(c >= 0xf0 && c < 0xf8){
+        length = 4;
+        c &= 0x07;
+        min = 0x10000;
+    }else if(c >= 0xe0){
+        length = c < 0xf0 ? 3 : 0;
+        c &= 0x0f;
+        min = 0x800;
+    }else if(c >= 0xc0){
+        length = 2;
+        c &= 0x1f;
+        min = 0x80;
+    }else if(c >= 0x80){
+        length = 0;
+    }
+    for(unsigned int i = 1; i < length; i++){
+        if((end && (const char*)t + i >= end) || (t[i] & 0xc0) != 0x80){
+            length = 0;
+            break;
+        }
+        c = (c << 6) | (t[i] & 0x3f);
+    }
+    if(length == 0 || c < min || c > 0x10ffff){
+        *text += 1;
+        return 0xfffd;
+    }
+    *text += length;
+    return c;
+}
+
+int findFontAtlasGlyphPhase(FontAtlas* fa, unsigned short characterCode, unsigned int phase){
+    for(int i = 0; i < fa->totalCharacters; i++){
+        if(characterCode == fa->characterCodes[i] && (!fa->phases || fa->phases[i] == phase)){
+            return i;
+        }
+    }
+    return -1;
+}
+
+int findFontAtlasCharacter(FontAtlas* fa, unsigned short characterCode){
+    return findFontAtlasGlyphPhase(fa, characterCode, 0);
+}
+
+//everything one thread needs to turn text into quads: the vertices it appended, in a buffer that
+//grows as text is added, and the glyph slots of the atlas it last drew from. contexts share
+//nothing, so threads each holding their own can lay out and render at the same time.
+//
+//thread safety. font data is only ever read, and the parser keeps nothing between calls, so any
+//number of threads may parse and rasterize the same font. an atlas may be drawn from by any number
+//of threads as long as none of them changes it: building, adding glyphs, growing mips and clearing
+//need it to themselves, and so does a fallback chain, which memoizes its lookups. the one place
+//rendering writes to an atlas is adding a missing subpixel variant, which contexts only do when
+//addMissingGlyphs is set. it starts off, so contexts draw the nearest built variant instead, and
+//a thread that has the atlas to itself sets it to rasterize lazy phases as text needs them
+struct TextRenderContext{
+    float* vertices;
+    unsigned int totalVertices;
+    unsigned int vertexCapacity;
+    AtlasAllocator* allocator;
+    bool addMissingGlyphs;
+    //slots of the single byte characters in cachedAtlas, refreshed when the atlas changes
+    FontAtlas* cachedAtlas;
+    unsigned short* cachedCharacterCodes;
+    unsigned int cachedTotalCharacters;
+    int glyphSlots[256];
+};
+
+//the buffer comes from allocator, or the heap when it is 0
+void initTextRenderContext(TextRenderContext* ctx, AtlasAllocator* allocator = 0){
+    ctx->vertices = 0;
+    ctx->totalVertices = 0;
+    ctx->vertexCapacity = 0;
+    ctx->allocator = allocator;
+    ctx->addMissingGlyphs = false;
+    ctx->cachedAtlas = 0;
+    ctx->cachedCharacterCodes = 0;
+    ctx->cachedTotalCharacters = 0;
+}
+
+void freeTextRenderContext(TextRenderContext* ctx){
+    releaseAtlasMemory(ctx->allocator, ctx->vertices);
+    ctx->vertices = 0;
+    ctx->totalVertices = 0;
+    ctx->vertexCapacity = 0;
+    ctx->cachedAtlas = 0;
+}
+
+//starts a new batch, the buffer is kept
+void resetTextRenderContext(TextRenderContext* ctx){
+    ctx->totalVertices = 0;
+}
+
+//room for vertices more after the ones already appended, returns where they go
+float* reserveTextRenderVertices(TextRenderContext* ctx, unsigned int vertices){
+    unsigned int needed = ctx->totalVertices + vertices;
+    if(needed > ctx->vertexCapacity){
+        unsigned int capacity = ctx->vertexCapacity ? ctx->vertexCapacity : 1536;
+        while(capacity < needed){
+            capacity *= 2;
+        }
+        float* grown = allocateAtlasArray<float>(ctx->allocator, capacity * 4);
+        if(ctx->vertices){
+            memcpy(grown, ctx->vertices, sizeof(float) * 4 * ctx->totalVertices);
+        }
+        releaseAtlasMemory(ctx->allocator, ctx->vertices);
+        ctx->vertices = grown;
+        ctx->vertexCapacity = capacity;
+    }
+    return &ctx->vertices[ctx->totalVertices * 4];
+}
+
+//atlas entry for c, through the context's slots when it has them
+static int findTextRenderGlyph(TextRenderContext* ctx, FontAtlas* fa, unsigned int c){
+    if(!ctx || c >= 256){
+        return c <= 0xffff ? findFontAtlasCharacter(fa, c) : -1;
+    }
+    //a rebuilt or copied atlas has new arrays, one that gained glyphs a new count
+    if(ctx->cachedAtlas != fa || ctx->cachedCharacterCodes != fa->characterCodes || ctx->cachedTotalCharacters != fa->totalCharacters){
+        for(int i = 0; i < 256; i++){
+            ctx->glyphSlots[i] = findFontAtlasCharacter(fa, i);
+        }
+        ctx->cachedAtlas = fa;
+        ctx->cachedCharacterCodes = fa->characterCodes;
+        ctx->cachedTotalCharacters = fa->totalCharacters;
+    }
+    return ctx->glyphSlots[c];
+}
+
+//viewport in the units of the vertices, with y increasing upwards like the quads
+struct ClipRect{
+    float left;
+    float bottom;
+    float right;
+    float top;
+};
+
+static int writeGlyphQuad(float* vecPtr, float left, float bottom, float right, float top, float tleft, float tbottom, float tright, float ttop){
+    int ctr = 0;
+
+    vecPtr[ctr++] = left; vecPtr[ctr++] = bottom;
+    vecPtr[ctr++] = tleft; vecPtr[ctr++] = tbottom;
+
+    vecPtr[ctr++] = left; vecPtr[ctr++] = top;
+    vecPtr[ctr++] = tleft; vecPtr[ctr++] = ttop;
+
+    vecPtr[ctr++] = right; vecPtr[ctr++] = top;
+    vecPtr[ctr++] = tright; vecPtr[ctr++] = ttop;
+
+    vecPtr[ctr++] = right; vecPtr[ctr++] = top;
+    vecPtr[ctr++] = tright; vecPtr[ctr++] = ttop;
+
+    vecPtr[ctr++] = right; vecPtr[ctr++] = bottom;
+    vecPtr[ctr++] = tright; vecPtr[ctr++] = tbottom;
+
+    vecPtr[ctr++] = left; vecPtr[ctr++] = bottom;
+    vecPtr[ctr++] = tleft; vecPtr[ctr++] = tbottom;
+
+    return ctr;
+}
+
+//writes the two triangles for atlas entry i with its left edge at x and baseline at y
+int emitGlyphQuad(float* vecPtr, FontAtlas* fa, int i, float x, float y, float scale){
+    float left = x;
+    float right = x + ((float)fa->widths[i] * scale);
+    float bottom = y + (fa->yShifts[i] * scale);
+    float top = y + ((fa->heights[i] + fa->yShifts[i]) * scale);
+    float tleft = (float)fa->xOffsets[i] / (float)fa->totalBitmapWidth;
+    float tright = (float)(fa->xOffsets[i] + fa->widths[i]) / (float)fa->totalBitmapWidth;
+    float tbottom = (float)fa->yOffsets[i] / (float)fa->totalBitmapHeight;
+    float ttop = (float)(fa->yOffsets[i] + fa->heights[i]) / (float)fa->totalBitmapHeight;
+    return writeGlyphQuad(vecPtr, left, bottom, right, top, tleft, tbottom, tright, ttop);
+}
+
+//true when the quad emitGlyphQuad would write lies wholly outside clip
+bool isGlyphQuadOutside(FontAtlas* fa, int i, float x, float y, float scale, ClipRect* clip){
+    float right = x + ((float)fa->widths[i] * scale);
+    float bottom = y + (fa->yShifts[i] * scale);
+    float top = y + ((fa->heights[i] + fa->yShifts[i]) * scale);
+    return right <= clip->left || x >= clip->right || top <= clip->bottom || bottom >= clip->top;
+}
+
+//like emitGlyphQuad but writes nothing for a quad outside clip. trim cuts quads crossing its edges
+//to the rectangle and moves their uvs along, otherwise they are kept whole for a scissor to cut
+int emitClippedGlyphQuad(float* vecPtr, FontAtlas* fa, int i, float x, float y, float scale, ClipRect* clip, bool trim){
+    if(isGlyphQuadOutside(fa, i, x, y, scale, clip)){
+        return 0;
+    }
+    float left = x;
+    float right = x + ((float)fa->widths[i] * scale);
+    float bottom = y + (fa->yShifts[i] * scale);
+    float top = y + ((fa->heights[i] + fa->yShifts[i]) * scale);
+    float tleft = (float)fa->xOffsets[i] / (float)fa->totalBitmapWidth;
+    float tright = (float)(fa->xOffsets[i] + fa->widths[i]) / (float)fa->totalBitmapWidth;
+    float tbottom = (float)fa->yOffsets[i] / (float)fa->totalBitmapHeight;
+    float ttop = (float)(fa->yOffsets[i] + fa->heights[i]) / (float)fa->totalBitmapHeight;
+    if(trim){
+        float du = (tright - tleft) / (right - left);
+        float dv = (ttop - tbottom) / (top - bottom);
+        if(left < clip->left){
+            tleft += (clip->left - left) * du;
+            left = clip->left;
+        }
+        if(right > clip->right){
+            tright -= (right - clip->right) * du;
+            right = clip->right;
+        }
+        if(bottom < clip->bottom){
+            tbottom += (clip->bottom - bottom) * dv;
+            bottom = clip->bottom;
+        }
+        if(top > clip->top){
+            ttop -= (top - clip->top) * dv;
+            top = clip->top;
+        }
+    }
+    return writeGlyphQuad(vecPtr, left, bottom, right, top, tleft, tbottom, tright, ttop);
+}
+
+static int emitTextGlyph(float* vecPtr, FontAtlas* fa, int i, float x, float y, float scale, ClipRect* clip, bool trim){
+    if(clip){
+        return emitClippedGlyphQuad(vecPtr, fa, i, x, y, scale, clip, trim);
+    }
+    return emitGlyphQuad(vecPtr, fa, i, x, y, scale);
+}
+
+//keeps a fractional pen and draws the glyph variant rasterized nearest to it.
+//missing variants are added in a first pass, since growing the atlas changes the uvs of every quad.
+//with a clip only the glyphs inside it are drawn or get variants, and the text ends at its right edge
+static int renderSubpixelText(float* vecPtr, FontAtlas* fa, const char* text, float x, float y, float scale, ClipRect* clip, bool trim, TextRenderContext* ctx){
+    int ctr = 0;
+    for(int pass = 0; pass < 2; pass++){
+        float pen = x / scale;
+        const char* t = text;
+        while(*t != '\0'){
+            if(clip && floorf(pen) * scale >= clip->right){
+                break;
+            }
+            unsigned int c = decodeUtf8(&t);
+            int base = findTextRenderGlyph(ctx, fa, c);
+            if(base < 0){
+                continue;
+            }
+            if(c != ' '){
+                float left = floorf(pen);
+                unsigned int phase = (unsigned int)(((pen - left) * fa->subpixelPhases) + 0.5f);
+                if(phase == fa->subpixelPhases){
+                    phase = 0;
+                    left += 1;
+                }
+
+                int i = phase ? findFontAtlasGlyphPhase(fa, c, phase) : base;
+                if(pass == 0){
+                    if(i < 0 && (!ctx || ctx->addMissingGlyphs) && (!clip || !isGlyphQuadOutside(fa, base, left * scale, y, scale, clip))){
+                        addSubpixelGlyphToFontAtlas(fa, c, phase);
+                    }
+                }else{
+                    if(i < 0){
+                        i = base;
+                        left = floorf(pen + 0.5f);
+                    }
+                    ctr += emitTextGlyph(&vecPtr[ctr], fa, i, left * scale, y, scale, clip, trim);
+                }
+            }
+            pen += fa->xShifts[base];
+        }
+    }
+    return ctr;
+}
+
+static int renderTextRun(float* vecPtr, FontAtlas* fa, const char* text, int x, int y, float scale, ClipRect* clip, bool trim, TextRenderContext* ctx){
+    if(fa->subpixelPhases > 1){
+        return renderSubpixelText(vecPtr, fa, text, x, y, scale, clip, trim, ctx);
+    }
+
+    int ctr = 0;
+    int xMarker = x;
+    while(*text != '\0'){
+        //left to right, so nothing after the pen passes the right edge can be inside
+        if(clip && xMarker >= clip->right){
+            break;
+        }
+        unsigned int c = decodeUtf8(&text);
+        int i = findTextRenderGlyph(ctx, fa, c);
+        if(i >= 0){
+            if(c != ' '){
+                ctr += emitTextGlyph(&vecPtr[ctr], fa, i, xMarker, y, scale, clip, trim);
+            }
+            xMarker += (fa->xShifts[i] * scale);
+        }
+    }
+    return ctr;
+}
+
+void renderText(float* vecPtr, FontAtlas* fa, const char* text, int x, int y, float scale){
+    vertexCount += renderTextRun(vecPtr, fa, text, x, y, scale, 0, false, 0) / 4;
+}
+
+//renderText for a viewport. glyphs outside clip write no vertices and the text stops at the
+//clip's right edge. returns the floats written
+int renderClippedText(float* vecPtr, FontAtlas* fa, const char* text, int x, int y, float scale, ClipRect* clip, bool trim = false){
+    int ctr = renderTextRun(vecPtr, fa, text, x, y, scale, clip, trim, 0);
+    vertexCount += ctr / 4;
+    return ctr;
+}
+
+//renderText into the context's buffer after the vertices already there, returns the vertices added.
+//every glyph takes at least one byte of text, which bounds what a run can write
+unsigned int appendText(TextRenderContext* ctx, FontAtlas* fa, const char* text, int x, int y, float scale){
+    float* vecPtr = reserveTextRenderVertices(ctx, strlen(text) * 6);
+    unsigned int added = renderTextRun(vecPtr, fa, text, x, y, scale, 0, false, ctx) / 4;
+    ctx->totalVertices += added;
+    return added;
+}
+
+unsigned int appendClippedText(TextRenderContext* ctx, FontAtlas* fa, const char* text, int x, int y, float scale, ClipRect* clip, bool trim = false){
+    float* vecPtr = reserveTextRenderVertices(ctx, strlen(text) * 6);
+    unsigned int added = renderTextRun(vecPtr, fa, text, x, y, scale, clip, trim, ctx) / 4;
+    ctx->totalVertices += added;
+    return added;
+}
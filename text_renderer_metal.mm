@@ -5,6 +5,8 @@
 #include "graphics_math.h"
 #include "font_atlas.cpp"
 #include "truetype_parser.h"
+#include "text_renderer.h"
+#include "async_atlas.h"
 
 #include <stdlib.h>
 #include <math.h>
@@ -29,67 +31,12 @@ vertex VertOutData vertexShader(uint vertexID [[vertex_id]], constant float2 *ve
 }\n\
 \
 fragment float4 fragmentShader(VertOutData in [[stage_in]], texture2d<half> colorTexture[[texture(0)]]){\n\
-    constexpr sampler textureSampler (mag_filter::nearest, min_filter::nearest);\n\
+    constexpr sampler textureSampler (mag_filter::nearest, min_filter::linear, mip_filter::linear);\n\
     const half4 colorSample = colorTexture.sample(textureSampler, in.textureCoordinate);\n\
     return float4(1 - colorSample.r, 1 - colorSample.r, 1 - colorSample.r, colorSample.r);\n\
 }\
 ";
 
-int vertexCount = 0;
-
-void renderText(float* vecPtr, FontAtlas* fa, const char* text, int x, int y, float scale){
-    int ctr = 0;
-    int xMarker = x;
-    while(*text != '\0'){
-        char c = *text;
-        for(int i = 0; i < fa->totalCharacters; i++){
-            if(c == fa->characterCodes[i]){
-                if(c == ' '){
-                    xMarker += (fa->xShifts[i] * scale);
-                    break;
-                }
-
-                float left = xMarker;
-                float right = (float)xMarker + ((float)fa->widths[i] * scale);
-                float bottom = y + (fa->yShifts[i] * scale);
-                float top = y + ((fa->heights[i] + fa->yShifts[i]) * scale);
-                float tleft = (float)fa->xOffsets[i] / (float)fa->totalBitmapWidth;
-                float tright = (float)(fa->xOffsets[i] + fa->widths[i]) / (float)fa->totalBitmapWidth;
-                float tbottom = (float)fa->yOffsets[i] / (float)fa->totalBitmapHeight;
-                float ttop = (float)(fa->yOffsets[i] + fa->heights[i]) / (float)fa->totalBitmapHeight;
-
-                vecPtr[ctr++] = left; vecPtr[ctr++] = bottom;
-                vecPtr[ctr++] = tleft; vecPtr[ctr++] = tbottom;
-                vertexCount++;
-
-                vecPtr[ctr++] = left; vecPtr[ctr++] = top;
-                vecPtr[ctr++] = tleft; vecPtr[ctr++] = ttop;
-                vertexCount++;
-
-                vecPtr[ctr++] = right; vecPtr[ctr++] = top;
-                vecPtr[ctr++] = tright; vecPtr[ctr++] = ttop;
-                vertexCount++;
-
-                vecPtr[ctr++] = right; vecPtr[ctr++] = top;
-                vecPtr[ctr++] = tright; vecPtr[ctr++] = ttop;
-                vertexCount++;
-
-                vecPtr[ctr++] = right; vecPtr[ctr++] = bottom;
-                vecPtr[ctr++] = tright; vecPtr[ctr++] = tbottom;
-                vertexCount++;
-
-                vecPtr[ctr++] = left; vecPtr[ctr++] = bottom;
-                vecPtr[ctr++] = tleft; vecPtr[ctr++] = tbottom;
-                vertexCount++;
-
-                xMarker += (fa->xShifts[i] * scale);
-                break;
-            }
-        }
-        text ++;
-    }
-}
-
 int main(int argc, char** argv){
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     [NSApp sharedApplication];
@@ -102,12 +49,14 @@ int main(int argc, char** argv){
     for(int i = 0; i < numChars; i++){
         charCodes[i] = (unsigned short)(i + 32);
     }
+    //the window opens right away and text appears as its glyphs finish rasterizing
+    const char* displayText = "T3$t to icuL@r";
+    AsyncFontAtlas asyncAtlas;
+    startAsyncFontAtlas(&asyncAtlas, fontData, numChars, charCodes);
+    queueAsyncFontAtlasText(&asyncAtlas, displayText);
     FontAtlas fa;
-    buildFontAtlas(&fa, fontData, numChars, charCodes);
-
-    unsigned char* bitmap = fa.bitmap;
-    unsigned int glyphWidth = fa.totalBitmapWidth; 
-    unsigned int glyphHeight = fa.totalBitmapHeight;
+    memset(&fa, 0, sizeof(FontAtlas));
+    unsigned int atlasVersion = 0;
     
     NSUInteger windowStyle = NSWindowStyleMaskTitled        | 
                              NSWindowStyleMaskClosable      | 
@@ -199,26 +148,18 @@ int main(int argc, char** argv){
     id<MTLBuffer> vertBuffer = [device newBufferWithLength:64000
                                         options: MTLResourceStorageModeShared];
     float* vpvp = (float*)vertBuffer.contents;
-
-    renderText(vpvp, &fa, "T3$t to icuL@r", 10, 100, 1);
+    unsigned int maxVertices = vertBuffer.length / (4 * sizeof(float));
+    unsigned int drawVertices = 0;
+    TextRenderContext textContext;
+    initTextRenderContext(&textContext);
 
     id<MTLBuffer> uniBuffer = [device newBufferWithBytes: &mvp.m[0][0]
                                         length: sizeof(float) * 16
                                         options: MTLResourceStorageModeShared];
 
     MTLTextureDescriptor *textureDescriptor = [[MTLTextureDescriptor alloc] init];
-    textureDescriptor.width = glyphWidth;
-    textureDescriptor.height = glyphHeight;
     textureDescriptor.pixelFormat = MTLPixelFormatR8Unorm;
-    id<MTLTexture> texture = [device newTextureWithDescriptor: textureDescriptor];
-    MTLRegion region = {
-        {0, 0, 0},
-        {glyphWidth, glyphHeight, 1}
-    };
-    [texture replaceRegion:region
-               mipmapLevel:0
-               withBytes:bitmap
-               bytesPerRow:glyphWidth];
+    id<MTLTexture> texture = nil;
 
 
     width = view.bounds.size.width;
@@ -269,6 +210,44 @@ int main(int argc, char** argv){
             }
         } while (ev);
 
+        if(updateAsyncFontAtlasSnapshot(&asyncAtlas, &fa, &atlasVersion) && fa.totalBitmapHeight > 0){
+            resetTextRenderContext(&textContext);
+            appendText(&textContext, &fa, displayText, 10, 100, 1);
+            drawVertices = textContext.totalVertices < maxVertices ? textContext.totalVertices : maxVertices;
+            memcpy(vpvp, textContext.vertices, drawVertices * 4 * sizeof(float));
+
+            if(!texture || texture.width != fa.totalBitmapWidth || texture.height != fa.totalBitmapHeight ||
+               texture.mipmapLevelCount != fa.totalMipLevels){
+                textureDescriptor.width = fa.totalBitmapWidth;
+                textureDescriptor.height = fa.totalBitmapHeight;
+                textureDescriptor.mipmapLevelCount = fa.totalMipLevels;
+                texture = [device newTextureWithDescriptor: textureDescriptor];
+                markFontAtlasDirty(&fa);
+            }
+            //only the texels changed since the last snapshot are sent
+            AtlasRegion* dirtyRegions;
+            unsigned int totalDirtyRegions = getFontAtlasDirtyRegions(&fa, &dirtyRegions);
+            for(unsigned int i = 0; i < totalDirtyRegions; i++){
+                for(unsigned int level = 0; level < fa.totalMipLevels; level++){
+                    AtlasRegion r = getFontAtlasLevelRegion(&fa, dirtyRegions[i], level);
+                    if(r.width == 0 || r.height == 0){
+                        continue;
+                    }
+                    unsigned int rowPitch;
+                    unsigned char* bytes = getFontAtlasRegionBytes(&fa, r, level, &rowPitch);
+                    MTLRegion region = {
+                        {r.x, r.y, 0},
+                        {r.width, r.height, 1}
+                    };
+                    [texture replaceRegion:region
+                               mipmapLevel:level
+                               withBytes:bytes
+                               bytesPerRow:rowPitch];
+                }
+            }
+            clearFontAtlasDirtyRegions(&fa);
+        }
+
         // // Finalize rendering here and submit the command buffer to the GPU
         commandBuffer = [commandQueue commandBuffer];
         MTLRenderPassDescriptor *renderPassDescriptor = view.currentRenderPassDescriptor;
@@ -291,9 +270,11 @@ int main(int argc, char** argv){
             [renderEncoder setFragmentTexture:texture
                                 atIndex:0];
 
-            [renderEncoder drawPrimitives:MTLPrimitiveTypeTriangle
-                        vertexStart:0
-                        vertexCount:vertexCount];
+            if(texture && drawVertices > 0){
+                [renderEncoder drawPrimitives:MTLPrimitiveTypeTriangle
+                            vertexStart:0
+                            vertexCount:drawVertices];
+            }
             [renderEncoder endEncoding];
             [commandBuffer presentDrawable:view.currentDrawable];
         }
@@ -301,6 +282,9 @@ int main(int argc, char** argv){
         [view draw];
     }
 
+    destroyAsyncFontAtlas(&asyncAtlas);
+    freeTextRenderContext(&textContext);
+    clearFontAtlas(&fa);
     [pool release];
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,536 @@
+#pragma once
+
+#include <string.h>
+
+#include "truetype_tables.h"
+#include "font_atlas.h"
+#include "text_renderer.h"
+
+//minimal opentype shaping. codepoints are mapped through the cmap, then the single and ligature
+//substitutions of the enabled GSUB features run in lookup list order. contextual, multiple and
+//alternate lookups, lookup flags and positioning are not read, so scripts that need joining
+//analysis still want a full shaper. fonts whose script has no liga feature, like the windows core
+//fonts that only map the U+FB00 presentation forms, get their f ligatures from the cmap instead.
+//shaped runs are memoized, drawing text that was shaped before costs a hash and a compare
+
+static const unsigned int GSUB_LOOKUP_SINGLE = 1;
+static const unsigned int GSUB_LOOKUP_LIGATURE = 4;
+static const unsigned int GSUB_LOOKUP_EXTENSION = 7;
+
+//what every shaper turns on for horizontal text
+static const unsigned int DEFAULT_SHAPER_FEATURES[] = {
+    makeTableTag('c', 'c', 'm', 'p'),
+    makeTableTag('l', 'o', 'c', 'l'),
+    makeTableTag('r', 'l', 'i', 'g'),
+    makeTableTag('l', 'i', 'g', 'a'),
+    makeTableTag('c', 'l', 'i', 'g')
+};
+
+struct TextShaper{
+    const unsigned char* fontData;
+    FontTables tables;
+    //lookup tables of the enabled features, in the order they are applied
+    const unsigned char** lookups;
+    unsigned int totalLookups;
+    //glyphs of f, i, l and of the ff, fi, fl, ffi, ffl presentation forms, all 0 unless they are used
+    unsigned short fGlyph;
+    unsigned short iGlyph;
+    unsigned short lGlyph;
+    unsigned short presentationLigatures[5];
+};
+
+struct ShapedRun{
+    unsigned short* glyphs;
+    //byte offset into the text of the first character behind each glyph
+    unsigned int* clusters;
+    unsigned int totalGlyphs;
+};
+
+//index of glyph in a coverage table, or -1
+static int getGsubCoverageIndex(const unsigned char* coverage, unsigned short glyph){
+    unsigned short format = readBigEndian<unsigned short>(coverage);
+    unsigned int count = readBigEndian<unsigned short>(coverage + 2);
+    unsigned int low = 0;
+    unsigned int high = count;
+    if(format == 1){
+        while(low < high){
+            unsigned int mid = (low + high) / 2;
+            unsigned short g = readBigEndian<unsigned short>(coverage + 4 + (mid * 2));
+            if(g == glyph){
+                return mid;
+            }else if(g < glyph){
+                low = mid + 1;
+            }else{
+                high = mid;
+            }
+        }
+    }else if(format == 2){
+        while(low < high){
+            unsigned int mid = (low + high) / 2;
+            const unsigned char* range = coverage + 4 + (mid * 6);
+            unsigned short start = readBigEndian<unsigned short>(range);
+            unsigned short end = readBigEndian<unsigned short>(range + 2);
+            if(glyph < start){
+                high = mid;
+            }else if(glyph > end){
+                low = mid + 1;
+            }else{
+                return readBigEndian<unsigned short>(range + 4) + (glyph - start);
+            }
+        }
+    }
+    return -1;
+}
+
+static unsigned short getGsubLookupType(const unsigned char* lookup){
+    return readBigEndian<unsigned short>(lookup);
+}
+
+//subtable k of a lookup, looking through extension subtables to the one they wrap
+static const unsigned char* getGsubSubtable(const unsigned char* lookup, unsigned int k, unsigned short* type){
+    const unsigned char* subtable = lookup + readBigEndian<unsigned short>(lookup + 6 + (k * 2));
+    *type = getGsubLookupType(lookup);
+    if(*type == GSUB_LOOKUP_EXTENSION){
+        *type = readBigEndian<unsigned short>(subtable + 2);
+        subtable += readBigEndian<unsigned int>(subtable + 4);
+    }
+    return subtable;
+}
+
+static bool applyGsubSingle(const unsigned char* subtable, unsigned short* glyph){
+    unsigned short format = readBigEndian<unsigned short>(subtable);
+    int index = getGsubCoverageIndex(subtable + readBigEndian<unsigned short>(subtable + 2), *glyph);
+    if(index < 0){
+        return false;
+    }
+    if(format == 1){
+        *glyph = (unsigned short)(*glyph + readBigEndian<short>(subtable + 4));
+        return true;
+    }else if(format == 2){
+        *glyph = readBigEndian<unsigned short>(subtable + 6 + (index * 2));
+        return true;
+    }
+    return false;
+}
+
+//joins the glyphs from i when they spell one of the ligatures starting with glyphs[i], the first
+//ligature that matches wins. returns the number of glyphs removed after i
+static unsigned int applyGsubLigature(const unsigned char* subtable, unsigned short* glyphs, unsigned int i, unsigned int totalGlyphs){
+    int index = getGsubCoverageIndex(subtable + readBigEndian<unsigned short>(subtable + 2), glyphs[i]);
+    if(index < 0 || index >= readBigEndian<unsigned short>(subtable + 4)){
+        return 0;
+    }
+    const unsigned char* ligatureSet = subtable + readBigEndian<unsigned short>(subtable + 6 + (index * 2));
+    unsigned int totalLigatures = readBigEndian<unsigned short>(ligatureSet);
+    for(unsigned int l = 0; l < totalLigatures; l++){
+        const unsigned char* ligature = ligatureSet + readBigEndian<unsigned short>(ligatureSet + 2 + (l * 2));
+        unsigned int components = readBigEndian<unsigned short>(ligature + 2);
+        if(components == 0 || i + components > totalGlyphs){
+            continue;
+        }
+        bool match = true;
+        for(unsigned int c = 1; c < components && match; c++){
+            match = glyphs[i + c] == readBigEndian<unsigned short>(ligature + 4 + ((c - 1) * 2));
+        }
+        if(match){
+            glyphs[i] = readBigEndian<unsigned short>(ligature);
+            return components - 1;
+        }
+    }
+    return 0;
+}
+
+//runs one lookup over the whole run, its first subtable that applies at a glyph is the one used
+static unsigned int applyGsubLookup(const unsigned char* lookup, unsigned short* glyphs, unsigned int* clusters, unsigned int totalGlyphs){
+    unsigned int totalSubtables = readBigEndian<unsigned short>(lookup + 4);
+    for(unsigned int i = 0; i < totalGlyphs; i++){
+        for(unsigned int k = 0; k < totalSubtables; k++){
+            unsigned short type;
+            const unsigned char* subtable = getGsubSubtable(lookup, k, &type);
+            if(type == GSUB_LOOKUP_SINGLE){
+                if(applyGsubSingle(subtable, &glyphs[i])){
+                    break;
+                }
+            }else if(type == GSUB_LOOKUP_LIGATURE){
+                unsigned int removed = applyGsubLigature(subtable, glyphs, i, totalGlyphs);
+                if(removed){
+                    for(unsigned int j = i + 1; j + removed < totalGlyphs; j++){
+                        glyphs[j] = glyphs[j + removed];
+                        clusters[j] = clusters[j + removed];
+                    }
+                    totalGlyphs -= removed;
+                    break;
+                }
+            }
+        }
+    }
+    return totalGlyphs;
+}
+
+//script table for the tag, DFLT when the font has none for it and 0 when neither is there
+static const unsigned char* findGsubScript(const unsigned char* scriptList, unsigned int script){
+    unsigned int total = readBigEndian<unsigned short>(scriptList);
+    const unsigned char* fallback = 0;
+    for(unsigned int i = 0; i < total; i++){
+        const unsigned char* record = scriptList + 2 + (i * 6);
+        unsigned int tag = readBigEndian<unsigned int>(record);
+        if(tag == script){
+            return scriptList + readBigEndian<unsigned short>(record + 4);
+        }
+        if(tag == makeTableTag('D', 'F', 'L', 'T')){
+            fallback = scriptList + readBigEndian<unsigned short>(record + 4);
+        }
+    }
+    return fallback;
+}
+
+static void enableGsubFeature(const unsigned char* featureList, unsigned int featureIndex, bool* enabled, unsigned int totalLookups){
+    if(featureIndex >= readBigEndian<unsigned short>(featureList)){
+        return;
+    }
+    const unsigned char* feature = featureList + readBigEndian<unsigned short>(featureList + 2 + (featureIndex * 6) + 4);
+    unsigned int count = readBigEndian<unsigned short>(feature + 2);
+    for(unsigned int i = 0; i < count; i++){
+        unsigned int lookup = readBigEndian<unsigned short>(feature + 4 + (i * 2));
+        if(lookup < totalLookups){
+            enabled[lookup] = true;
+        }
+    }
+}
+
+static void setPresentationLigatures(TextShaper* ts, bool enabled){
+    ts->fGlyph = enabled ? getGlyphIndexFromTables(&ts->tables, 'f') : 0;
+    ts->iGlyph = enabled ? getGlyphIndexFromTables(&ts->tables, 'i') : 0;
+    ts->lGlyph = enabled ? getGlyphIndexFromTables(&ts->tables, 'l') : 0;
+    for(unsigned int i = 0; i < 5; i++){
+        ts->presentationLigatures[i] = enabled ? getGlyphIndexFromTables(&ts->tables, 0xfb00 + i) : 0;
+    }
+}
+
+//longest first, a ligature the font doesn't map leaves its letters alone
+static unsigned int applyPresentationLigatures(TextShaper* ts, unsigned short* glyphs, unsigned int* clusters, unsigned int totalGlyphs){
+    if(!ts->fGlyph){
+        return totalGlyphs;
+    }
+    unsigned int total = 0;
+    for(unsigned int i = 0; i < totalGlyphs; i++){
+        unsigned short g = glyphs[i];
+        unsigned int used = 1;
+        if(g == ts->fGlyph && i + 1 < totalGlyphs){
+            unsigned short next = glyphs[i + 1];
+            unsigned short third = i + 2 < totalGlyphs ? glyphs[i + 2] : 0;
+            unsigned short* forms = ts->presentationLigatures;
+            if(next == ts->fGlyph && third == ts->iGlyph && forms[3]){
+                g = forms[3];
+                used = 3;
+            }else if(next == ts->fGlyph && third == ts->lGlyph && forms[4]){
+                g = forms[4];
+                used = 3;
+            }else if(next == ts->fGlyph && forms[0]){
+                g = forms[0];
+                used = 2;
+            }else if(next == ts->iGlyph && forms[1]){
+                g = forms[1];
+                used = 2;
+            }else if(next == ts->lGlyph && forms[2]){
+                g = forms[2];
+                used = 2;
+            }
+        }
+        glyphs[total] = g;
+        clusters[total++] = clusters[i];
+        i += used - 1;
+    }
+    return total;
+}
+
+//features 0 turns on DEFAULT_SHAPER_FEATURES. the script's default language system is used, DFLT
+//when the font has nothing for the script
+void initTextShaper(TextShaper* ts, const unsigned char* fontData, unsigned int script = makeTableTag('l', 'a', 't', 'n'), const unsigned int* features = 0, unsigned int totalFeatures = 0){
+    if(!features){
+        features = DEFAULT_SHAPER_FEATURES;
+        totalFeatures = sizeof(DEFAULT_SHAPER_FEATURES) / sizeof(DEFAULT_SHAPER_FEATURES[0]);
+    }
+    ts->fontData = fontData;
+    ts->lookups = 0;
+    ts->totalLookups = 0;
+    initFontTables(&ts->tables, fontData);
+    bool ligatures = false;
+    for(unsigned int f = 0; f < totalFeatures; f++){
+        ligatures |= features[f] == makeTableTag('l', 'i', 'g', 'a');
+    }
+    setPresentationLigatures(ts, ligatures);
+
+    GsubView gsub = getTableView<GsubView>(fontData);
+    if(!gsub.data){
+        return;
+    }
+    const unsigned char* scriptTable = findGsubScript(gsub.scriptList(), script);
+    unsigned short langSysOffset = scriptTable ? readBigEndian<unsigned short>(scriptTable) : 0;
+    if(!langSysOffset){
+        return;
+    }
+    const unsigned char* langSys = scriptTable + langSysOffset;
+    const unsigned char* featureList = gsub.featureList();
+    const unsigned char* lookupList = gsub.lookupList();
+    unsigned int totalLookups = readBigEndian<unsigned short>(lookupList);
+
+    bool* enabled = new bool[totalLookups + 1];
+    memset(enabled, 0, totalLookups + 1);
+    unsigned short required = readBigEndian<unsigned short>(langSys + 2);
+    if(required != 0xffff){
+        enableGsubFeature(featureList, required, enabled, totalLookups);
+    }
+    unsigned int totalFeatureIndices = readBigEndian<unsigned short>(langSys + 4);
+    for(unsigned int i = 0; i < totalFeatureIndices; i++){
+        unsigned short featureIndex = readBigEndian<unsigned short>(langSys + 6 + (i * 2));
+        unsigned int tag = readBigEndian<unsigned int>(featureList + 2 + (featureIndex * 6));
+        if(tag == makeTableTag('l', 'i', 'g', 'a')){
+            setPresentationLigatures(ts, false);
+        }
+        for(unsigned int f = 0; f < totalFeatures; f++){
+            if(features[f] == tag){
+                enableGsubFeature(featureList, featureIndex, enabled, totalLookups);
+                break;
+            }
+        }
+    }
+
+    ts->lookups = new const unsigned char*[totalLookups + 1];
+    for(unsigned int i = 0; i < totalLookups; i++){
+        if(!enabled[i]){
+            continue;
+        }
+        const unsigned char* lookup = lookupList + readBigEndian<unsigned short>(lookupList + 2 + (i * 2));
+        unsigned short type = getGsubLookupType(lookup);
+        if(type == GSUB_LOOKUP_EXTENSION && readBigEndian<unsigned short>(lookup + 4) > 0){
+            getGsubSubtable(lookup, 0, &type);
+        }
+        if(type == GSUB_LOOKUP_SINGLE || type == GSUB_LOOKUP_LIGATURE){
+            ts->lookups[ts->totalLookups++] = lookup;
+        }
+    }
+    delete[] enabled;
+}
+
+void freeTextShaper(TextShaper* ts){
+    freeFontTables(&ts->tables);
+    if(ts->lookups) delete[] ts->lookups;
+    ts->lookups = 0;
+    ts->totalLookups = 0;
+}
+
+//glyphs and clusters need room for one entry per byte of text. returns the number of glyphs
+unsigned int shapeText(TextShaper* ts, const char* text, unsigned int textLength, unsigned short* glyphs, unsigned int* clusters){
+    unsigned int totalGlyphs = 0;
+    const char* t = text;
+    const char* end = text + textLength;
+    while(t < end){
+        clusters[totalGlyphs] = t - text;
+        unsigned int c = decodeUtf8(&t, end);
+        glyphs[totalGlyphs++] = c <= 0xffff ? getGlyphIndexFromTables(&ts->tables, c) : 0;
+    }
+    totalGlyphs = applyPresentationLigatures(ts, glyphs, clusters, totalGlyphs);
+    for(unsigned int i = 0; i < ts->totalLookups; i++){
+        totalGlyphs = applyGsubLookup(ts->lookups[i], glyphs, clusters, totalGlyphs);
+    }
+    return totalGlyphs;
+}
+
+struct ShapedRunCacheEntry{
+    TextShaper* shaper;
+    unsigned int hash;
+    char* text;
+    unsigned int textLength;
+    ShapedRun run;
+    unsigned long lastUse;
+    //next entry in the same bucket, -1 ends the chain
+    int next;
+};
+
+//runs already shaped, keyed by shaper and text. once it holds capacity runs or maxBytes of
+//them the least recently used ones are dropped
+struct ShapedRunCache{
+    ShapedRunCacheEntry* entries;
+    int* buckets;
+    unsigned int totalBuckets;
+    unsigned int totalEntries;
+    unsigned int capacity;
+    unsigned long totalBytes;
+    unsigned long maxBytes;
+    unsigned long clock;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+void initShapedRunCache(ShapedRunCache* cache, unsigned int capacity, unsigned long maxBytes){
+    cache->capacity = capacity ? capacity : 1;
+    cache->totalBuckets = 16;
+    while(cache->totalBuckets < cache->capacity * 2){
+        cache->totalBuckets *= 2;
+    }
+    cache->entries = new ShapedRunCacheEntry[cache->capacity];
+    cache->buckets = new int[cache->totalBuckets];
+    for(unsigned int i = 0; i < cache->totalBuckets; i++){
+        cache->buckets[i] = -1;
+    }
+    cache->totalEntries = 0;
+    cache->totalBytes = 0;
+    cache->maxBytes = maxBytes;
+    cache->clock = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+static unsigned long getShapedRunEntryBytes(ShapedRunCacheEntry* e){
+    return e->textLength + (e->run.totalGlyphs * (sizeof(unsigned short) + sizeof(unsigned int)));
+}
+
+static unsigned int getShapedRunHash(TextShaper* ts, const char* text, unsigned int textLength){
+    unsigned int hash = 2166136261u ^ (unsigned int)(unsigned long)ts;
+    for(unsigned int i = 0; i < textLength; i++){
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+//takes entry i out of its chain and fills its place with the last entry
+static void removeShapedRunCacheEntry(ShapedRunCache* cache, unsigned int i){
+    ShapedRunCacheEntry* e = &cache->entries[i];
+    int* link = &cache->buckets[e->hash & (cache->totalBuckets - 1)];
+    while(*link != (int)i){
+        link = &cache->entries[*link].next;
+    }
+    *link = e->next;
+    cache->totalBytes -= getShapedRunEntryBytes(e);
+    delete[] e->text;
+    delete[] e->run.glyphs;
+    delete[] e->run.clusters;
+
+    unsigned int last = --cache->totalEntries;
+    if(i != last){
+        link = &cache->buckets[cache->entries[last].hash & (cache->totalBuckets - 1)];
+        while(*link != (int)last){
+            link = &cache->entries[*link].next;
+        }
+        *link = i;
+        cache->entries[i] = cache->entries[last];
+    }
+}
+
+static void evictShapedRunCacheEntry(ShapedRunCache* cache){
+    unsigned int oldest = 0;
+    for(unsigned int i = 1; i < cache->totalEntries; i++){
+        if(cache->entries[i].lastUse < cache->entries[oldest].lastUse){
+            oldest = i;
+        }
+    }
+    removeShapedRunCacheEntry(cache, oldest);
+}
+
+//the shaped run is owned by the cache and stays valid until the next call for a run it doesn't hold
+ShapedRun* getShapedRun(ShapedRunCache* cache, TextShaper* ts, const char* text, unsigned int textLength){
+    unsigned int hash = getShapedRunHash(ts, text, textLength);
+    unsigned int bucket = hash & (cache->totalBuckets - 1);
+    for(int i = cache->buckets[bucket]; i >= 0; i = cache->entries[i].next){
+        ShapedRunCacheEntry* e = &cache->entries[i];
+        if(e->hash == hash && e->shaper == ts && e->textLength == textLength && memcmp(e->text, text, textLength) == 0){
+            e->lastUse = ++cache->clock;
+            cache->hits++;
+            return &e->run;
+        }
+    }
+    cache->misses++;
+
+    unsigned short* glyphs = new unsigned short[textLength + 1];
+    unsigned int* clusters = new unsigned int[textLength + 1];
+    unsigned int totalGlyphs = shapeText(ts, text, textLength, glyphs, clusters);
+    unsigned long bytes = textLength + (totalGlyphs * (sizeof(unsigned short) + sizeof(unsigned int)));
+    while(cache->totalEntries && (cache->totalEntries == cache->capacity || cache->totalBytes + bytes > cache->maxBytes)){
+        evictShapedRunCacheEntry(cache);
+    }
+
+    ShapedRunCacheEntry* e = &cache->entries[cache->totalEntries];
+    e->shaper = ts;
+    e->hash = hash;
+    e->text = new char[textLength + 1];
+    memcpy(e->text, text, textLength);
+    e->textLength = textLength;
+    e->run.glyphs = glyphs;
+    e->run.clusters = clusters;
+    e->run.totalGlyphs = totalGlyphs;
+    e->lastUse = ++cache->clock;
+    e->next = cache->buckets[bucket];
+    cache->buckets[bucket] = cache->totalEntries++;
+    cache->totalBytes += bytes;
+    return &e->run;
+}
+
+//drops every run, needed before a shaper in the cache is freed or reused
+void clearShapedRunCache(ShapedRunCache* cache){
+    while(cache->totalEntries){
+        removeShapedRunCacheEntry(cache, cache->totalEntries - 1);
+    }
+}
+
+void freeShapedRunCache(ShapedRunCache* cache){
+    clearShapedRunCache(cache);
+    delete[] cache->entries;
+    delete[] cache->buckets;
+    cache->entries = 0;
+    cache->buckets = 0;
+}
+
+//draws a run from an atlas built with glyphIndices for the shaper's font, on the same fractional
+//pen as renderSubpixelText. glyphs the atlas lacks are added in a first pass, glyphs without an
+//outline only move the pen. returns the number of floats written
+int renderShapedRun(float* vecPtr, FontAtlas* fa, TextShaper* ts, ShapedRun* run, float x, float y, float scale){
+    int ctr = 0;
+    for(int pass = 0; pass < 2; pass++){
+        float pen = x / scale;
+        for(unsigned int g = 0; g < run->totalGlyphs; g++){
+            unsigned short glyph = run->glyphs[g];
+            unsigned int length;
+            if(!getGlyphDataFromTables(&ts->tables, glyph, &length)){
+                pen += (float)ts->tables.hmtx.advance(glyph) / (float)fa->divisions;
+                continue;
+            }
+            int base = findFontAtlasCharacter(fa, glyph);
+            if(base < 0 && pass == 0){
+                base = addSubpixelGlyphToFontAtlas(fa, glyph, 0);
+            }
+            //an atlas without font data can't add it, the pen still moves so both passes agree
+            if(base < 0){
+                pen += (float)ts->tables.hmtx.advance(glyph) / (float)fa->divisions;
+                continue;
+            }
+
+            float left = floorf(pen);
+            unsigned int phase = (unsigned int)(((pen - left) * fa->subpixelPhases) + 0.5f);
+            if(phase == fa->subpixelPhases){
+                phase = 0;
+                left += 1;
+            }
+            int i = phase ? findFontAtlasGlyphPhase(fa, glyph, phase) : base;
+            if(pass == 0){
+                if(i < 0){
+                    addSubpixelGlyphToFontAtlas(fa, glyph, phase);
+                }
+            }else{
+                if(i < 0){
+                    i = base;
+                    left = floorf(pen + 0.5f);
+                }
+                ctr += emitGlyphQuad(&vecPtr[ctr], fa, i, left * scale, y, scale);
+            }
+            pen += fa->xShifts[base];
+        }
+    }
+    return ctr;
+}
+
+//shapes through the cache and draws, so text that doesn't change is only shaped once
+int renderShapedText(float* vecPtr, FontAtlas* fa, ShapedRunCache* cache, TextShaper* ts, const char* text, float x, float y, float scale){
+    ShapedRun* run = getShapedRun(cache, ts, text, strlen(text));
+    return renderShapedRun(vecPtr, fa, ts, run, x, y, scale);
+}
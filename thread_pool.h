@@ -0,0 +1,126 @@
+#pragma once
+
+#include <pthread.h>
+
+typedef void (*ParallelTask)(void* data, unsigned int index);
+
+struct ThreadPool{
+    pthread_t* threads;
+    unsigned int totalThreads;
+    pthread_mutex_t mutex;
+    pthread_mutex_t runMutex;
+    pthread_cond_t workCond;
+    pthread_cond_t doneCond;
+    ParallelTask task;
+    void* taskData;
+    unsigned int nextIndex;
+    unsigned int totalIndices;
+    unsigned int remainingIndices;
+    unsigned int generation;
+    bool shuttingDown;
+};
+
+//claims indices of the current job until none are left, returns with the mutex held
+static void drainThreadPoolJob(ThreadPool* pool){
+    while(pool->nextIndex < pool->totalIndices){
+        unsigned int index = pool->nextIndex++;
+        pthread_mutex_unlock(&pool->mutex);
+        pool->task(pool->taskData, index);
+        pthread_mutex_lock(&pool->mutex);
+        pool->remainingIndices--;
+        if(pool->remainingIndices == 0){
+            pthread_cond_broadcast(&pool->doneCond);
+        }
+    }
+}
+
+static void* threadPoolWorker(void* arg){
+    ThreadPool* pool = (ThreadPool*)arg;
+    unsigned int seenGeneration = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while(true){
+        while(!pool->shuttingDown && pool->generation == seenGeneration){
+            pthread_cond_wait(&pool->workCond, &pool->mutex);
+        }
+        if(pool->shuttingDown){
+            break;
+        }
+        seenGeneration = pool->generation;
+        drainThreadPoolJob(pool);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+//totalThreads counts the calling thread, so a pool of 1 spawns no workers
+void initThreadPool(ThreadPool* pool, unsigned int totalThreads){
+    pool->totalThreads = totalThreads > 1 ? totalThreads - 1 : 0;
+    pool->task = 0;
+    pool->taskData = 0;
+    pool->nextIndex = 0;
+    pool->totalIndices = 0;
+    pool->remainingIndices = 0;
+    pool->generation = 0;
+    pool->shuttingDown = false;
+    pthread_mutex_init(&pool->mutex, 0);
+    pthread_mutex_init(&pool->runMutex, 0);
+    pthread_cond_init(&pool->workCond, 0);
+    pthread_cond_init(&pool->doneCond, 0);
+
+    pool->threads = pool->totalThreads ? new pthread_t[pool->totalThreads] : 0;
+    for(int i = 0; i < pool->totalThreads; i++){
+        pthread_create(&pool->threads[i], 0, threadPoolWorker, pool);
+    }
+}
+
+void destroyThreadPool(ThreadPool* pool){
+    pthread_mutex_lock(&pool->mutex);
+    pool->shuttingDown = true;
+    pthread_cond_broadcast(&pool->workCond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(int i = 0; i < pool->totalThreads; i++){
+        pthread_join(pool->threads[i], 0);
+    }
+    if(pool->threads){
+        delete[] pool->threads;
+        pool->threads = 0;
+    }
+    pool->totalThreads = 0;
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_mutex_destroy(&pool->runMutex);
+    pthread_cond_destroy(&pool->workCond);
+    pthread_cond_destroy(&pool->doneCond);
+}
+
+//runs task for every index in [0, count) and returns once all of them finished.
+//with no pool, or when the pool is already busy (e.g. a nested call from inside a task), it runs serially
+void runParallel(ThreadPool* pool, ParallelTask task, void* data, unsigned int count){
+    if(!pool || pool->totalThreads == 0 || count < 2 || pthread_mutex_trylock(&pool->runMutex) != 0){
+        for(unsigned int i = 0; i < count; i++){
+            task(data, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->taskData = data;
+    pool->nextIndex = 0;
+    pool->totalIndices = count;
+    pool->remainingIndices = count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->workCond);
+
+    drainThreadPoolJob(pool);
+    while(pool->remainingIndices > 0){
+        pthread_cond_wait(&pool->doneCond, &pool->mutex);
+    }
+    pool->task = 0;
+    pool->taskData = 0;
+    pthread_mutex_unlock(&pool->mutex);
+
+    pthread_mutex_unlock(&pool->runMutex);
+}
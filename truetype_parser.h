@@ -1,124 +1,15 @@
 #pragma once
 
 #include <stdio.h>
+#include <string.h>
 
-#define Fixed unsigned int
-#define SWAP16(V) V >> 8 | V << 8
-#define SWAP32(V) ((V >> 24) & 0xff) | ((V << 8) & 0xff0000) | ((V >> 8) & 0xff00) | ((V << 24) & 0xff000000)
-#define SWAP64(V) ((V >> 56) & 0xff) | ((V << 56) & 0xff00000000000000) | \
-                  ((V >> 40) & 0xff00) | ((V < 40) & 0xff000000000000) | \
-                  ((V >> 24) & 0xff0000) | ((V < 24) & 0xff000000) | \
-                  ((V >> 8) & 0xff000000) | ( (V < 8) & 0xff0000)
-
-#define strToInt(str) (str[0] << 24 | str[1] << 16 | str[2] << 8 | str[3])
-
-#pragma pack(push, 1)
-struct OffsetSubtable{
-    unsigned int scalarType;
-    unsigned short numTables;
-    unsigned short searchRange;
-    unsigned short entrySelector;
-    unsigned short rangeShift;
-};
-
-struct Table{
-    unsigned int tag;
-    unsigned int checkSum;
-    unsigned int offset;
-    unsigned int length;
-};
-
-struct TableDirectory{
-    unsigned short numTables;
-    Table* tables;
-};
+#include "atlas_stats.h"
+#include "atlas_allocator.h"
+#include "thread_pool.h"
+#include "truetype_tables.h"
 
-struct HeadTable{
-    Fixed version;
-    Fixed fontRevision;
-    unsigned int checkSumAdjustment;
-    unsigned int magicNumber;
-    unsigned short flags;
-    unsigned short unitsPerEm;
-    long created;
-    long modified;
-    short xMin;
-    short yMin;
-    short xMax;
-    short yMax;
-    unsigned short macStyle; 
-    unsigned short lowestRecPPEM;
-    short fontDirectionHint;
-    short indexToLocFont;
-    short glyphDataFormat;
-};
-
-struct CmapIndex{
-    unsigned short version;
-    unsigned short numberSubtables;
-    unsigned short platformID;
-    unsigned short platformSpecificID;
-    unsigned int offset;
-};
-
-struct CmapSubtable{
-    unsigned short format;
-    unsigned short length;
-    unsigned short language;
-    unsigned short segCountX2;
-    unsigned short searchRange;
-    unsigned short entrySelector;
-    unsigned short rangeShift;
-};
-
-struct Cmap{
-    CmapIndex cmapIndex;
-    CmapSubtable subtable;
-};
-
-struct HheaTable{
-    Fixed version;
-    short ascent;
-    short descent;
-    short lineGap;
-    unsigned short advanceWidthMax;
-    short minLeftSideBearing;
-    short minRightSideBearing;
-    short xMaxExtent;
-    short caretSlopeRise;
-    short caretSlopeRun;
-    short caretOffset;
-    unsigned long reserved;
-    short metricDataFormat;
-    unsigned short numOfLongHorMetrics;
-};
-
-struct MaxpTable{
-    unsigned int version;
-    unsigned short numGlyphs;
-    unsigned short maxPoints;
-    unsigned short maxContours;
-    unsigned short maxComponentPoints;
-    unsigned short maxComponentContours;
-    unsigned short maxZones;
-    unsigned short maxTwilightPoints;
-    unsigned short maxStorage;
-    unsigned short maxFunctionDefs;
-    unsigned short maxInstructionDefs;
-    unsigned short maxStackElements;
-    unsigned short maxSizeOfInstructions;
-    unsigned short maxComponentElements;
-    unsigned short maxComponentDepth;
-};
-
-struct FileGlyph {
-    short numberOfContours;
-    short xMin;
-    short yMin;
-    short xMax;
-    short yMax;
-};
-#pragma pack(pop)
+//the parser only reads the font data and keeps no state between calls, so threads may share a
+//font freely. what a call allocates is its own, through the allocator it was given
 
 struct GlyphPoint {
     short x;
@@ -155,37 +46,38 @@ struct vecLine{
     vector2f p2;
 };
 
+//lines grow by doubling, the memory comes from allocator or the heap when it is 0
 struct LineGroup{
     unsigned int totalLines;
+    unsigned int capacity;
     vecLine* lines;
+    AtlasAllocator* allocator;
 
-    LineGroup(){
+    LineGroup(AtlasAllocator* allocator = 0){
         totalLines = 0;
+        capacity = 0;
         lines = 0;
+        this->allocator = allocator;
     }
 
     void addLine(vecLine l){
-        vecLine* newLines = new vecLine[totalLines + 1];
-        
-        for(int i = 0; i < totalLines; i++){
-            newLines[i] = lines[i];
-        }
-        newLines[totalLines] = l;
-
-        if(lines){
-            delete[] lines;
-            lines = 0;
+        if(totalLines == capacity){
+            unsigned int newCapacity = capacity ? capacity * 2 : 64;
+            vecLine* newLines = allocateAtlasArray<vecLine>(allocator, newCapacity);
+            for(int i = 0; i < totalLines; i++){
+                newLines[i] = lines[i];
+            }
+            releaseAtlasMemory(allocator, lines);
+            lines = newLines;
+            capacity = newCapacity;
         }
-
-        lines = newLines;
-        totalLines++;
+        lines[totalLines++] = l;
     }
 
     void clear(){
-        if(lines){
-            delete[] lines;
-            lines = 0;
-        }
+        releaseAtlasMemory(allocator, lines);
+        lines = 0;
+        capacity = 0;
         totalLines = 0;
     }
 };
@@ -245,140 +137,156 @@ void printGlyphShapeData(GlyphShape shape){
     }
 }
 
+bool isFontCollection(unsigned char* fileData){
+    return isFontCollectionData(fileData);
+}
+
+unsigned int getTotalFontFaces(unsigned char* fileData){
+    return getFontCollectionSize(fileData);
+}
+
+//byte offset of a face's table directory, table offsets inside it stay relative to the whole file
+unsigned int getFontFaceDirectoryOffset(unsigned char* fileData, unsigned int faceIndex){
+    return (unsigned int)(getSfntDirectory(fileData, faceIndex).data - fileData);
+}
+
 unsigned char* getPointerToTableData(unsigned char* fileData, const char* table){
-    OffsetSubtable os = *(OffsetSubtable*)fileData;
-    os.numTables = SWAP16(os.numTables);
-    
-    unsigned int val = strToInt(table);
-    val = SWAP32(val);
-
-    for(int i = 0; i < os.numTables; i++){
-        Table* t = (Table*)&fileData[sizeof(OffsetSubtable) + (i * sizeof(Table))];
-        if((strToInt(table)) == (SWAP32(t->tag))){
-            unsigned int offset = SWAP32(t->offset);
-            return &fileData[offset];
-        }
-    }
-    return 0;
+    unsigned int tag = makeTableTag(table[0], table[1], table[2], table[3]);
+    return (unsigned char*)getSfntDirectory(fileData, 0).find(tag).data;
 }
 
-unsigned int getGlyphIndex(unsigned char* fileData, unsigned short characterCode){
-    CmapIndex* ci = (CmapIndex*)getPointerToTableData(fileData, "cmap");
-    unsigned int offset = SWAP32(ci->offset);
-
-    CmapSubtable* cs = (CmapSubtable*)((unsigned char*)ci + offset);
-    unsigned short format = SWAP16(cs->format);
-    unsigned int glyphIndex = -1;
-    if(format == 4){
-        unsigned short segCount = SWAP16(cs->segCountX2);
-        segCount /= 2;
-
-        unsigned short* endCode = (unsigned short*)((unsigned short*)(ci) + sizeof(CmapSubtable) + 7);
-        unsigned short* startCode = (unsigned short*)((unsigned short*)(ci) + sizeof(CmapSubtable) + 7 + segCount + 1);
-        unsigned short* idDelta = (unsigned short*)((unsigned short*)(ci) + sizeof(CmapSubtable) + 7 + segCount + 1 + segCount);
-        unsigned short* idRangeOffset = (unsigned short*)((unsigned short*)(ci) + sizeof(CmapSubtable) + 7 + segCount + 1 + (segCount * 2));
-        unsigned short* glyphIndexArray = (unsigned short*)((unsigned short*)(ci) + sizeof(CmapSubtable) + 7 + segCount + 1 + (segCount * 3));
-
-        for(int i = 0; i < segCount; i++){
-            unsigned short ec = *endCode;
-            unsigned short sc = *startCode;
-            unsigned short id = *idDelta;
-            unsigned short ro = *idRangeOffset;
-
-            ec = SWAP16(ec);
-            sc = SWAP16(sc);
-            id = SWAP16(id);
-            ro = SWAP16(ro);
-
-            if(ec >= characterCode){
-                if(ro != 0){
-                    unsigned short* addr = &idRangeOffset[i];
-                    addr += ro;
-                    addr += 2 * (characterCode - sc);
-                    unsigned short val = SWAP16(*addr);
-                    if(val == 0){
-                        glyphIndex = 0;
-                    }else {
-                        glyphIndex = (val + id) % 65536;
-                    }
-                }else{
-                    glyphIndex = (characterCode + id) % 65536;
-                }
+//returns font data the rest of the parser can read for any face of a collection. the first face
+//and plain fonts are used in place, other faces get their own directory and tables copied into
+//a new buffer with the offsets rebased. returns 0 for a face index that doesn't exist
+unsigned char* loadFontFace(unsigned char* fileData, unsigned int faceIndex){
+    if(faceIndex >= getTotalFontFaces(fileData)){
+        return 0;
+    }
+    if(faceIndex == 0){
+        return fileData;
+    }
 
-                break;
-            }
+    SfntDirectoryView directory = getSfntDirectory(fileData, faceIndex);
+    unsigned short numTables = directory.numTables();
+    unsigned int headerSize = 12 + (numTables * 16);
+    unsigned int totalSize = headerSize;
+    for(int i = 0; i < numTables; i++){
+        totalSize += (directory.length(i) + 3) & ~3u;
+    }
 
-            endCode++;
-            startCode++;
-            idDelta++;
-            idRangeOffset++;
-        }
-    }else{
-        //TODO: Handle other formats besides 4
+    unsigned char* faceData = new unsigned char[totalSize];
+    memset(faceData, 0, totalSize);
+    memcpy(faceData, directory.data, headerSize);
+    unsigned int offset = headerSize;
+    for(int i = 0; i < numTables; i++){
+        unsigned int length = directory.length(i);
+        memcpy(faceData + offset, fileData + directory.offset(i), length);
+        unsigned char* record = faceData + 12 + (i * 16) + 8;
+        record[0] = (unsigned char)(offset >> 24);
+        record[1] = (unsigned char)(offset >> 16);
+        record[2] = (unsigned char)(offset >> 8);
+        record[3] = (unsigned char)offset;
+        offset += (length + 3) & ~3u;
     }
+    return faceData;
+}
 
-    return glyphIndex;
+void freeFontFace(unsigned char* fileData, unsigned char* faceData){
+    if(faceData && faceData != fileData){
+        delete[] faceData;
+    }
 }
 
-unsigned char* getPointerToGlyphData(unsigned char* fileData, unsigned short characterCode){
-    HeadTable* ht = (HeadTable*)getPointerToTableData(fileData, "head");
-    unsigned short fontFormat = SWAP16(ht->indexToLocFont);
-    unsigned int glyphIndex = getGlyphIndex(fileData, characterCode);
-    
-    if(fontFormat == 0){
-        unsigned short* loca = (unsigned short*)getPointerToTableData(fileData, "loca");
-        loca += glyphIndex;
-        unsigned short glf = SWAP16(*loca) / 2;
-        //TODO: check and finish this
-    }else if(fontFormat == 1){
-        unsigned int* loca = (unsigned int*)getPointerToTableData(fileData, "loca");
-        loca += glyphIndex;
-        unsigned int glf = SWAP32(*loca);
-        unsigned char* glyf = getPointerToTableData(fileData, "glyf");
-        glyf += glf;
-        
-        return glyf;
+//0, the missing glyph, for characters the font doesn't map
+unsigned int getGlyphIndex(unsigned char* fileData, unsigned short characterCode){
+    CmapFormat4View cmap = getTableView<CmapView>(fileData).unicodeSubtable();
+    if(!cmap.data || cmap.format() != 4){
+        //TODO: Handle other formats besides 4
+        return 0;
     }
-    
 
-    return getPointerToTableData(fileData, "glyf");
+    BigEndianArray<unsigned short> endCodes = cmap.endCodes();
+    unsigned int low = 0;
+    unsigned int high = endCodes.count;
+    while(low < high){
+        unsigned int mid = (low + high) / 2;
+        if(endCodes[mid] < characterCode){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+    if(low == endCodes.count){
+        return 0;
+    }
+
+    unsigned short sc = cmap.startCodes()[low];
+    unsigned short id = cmap.idDeltas()[low];
+    unsigned short ro = cmap.idRangeOffsets()[low];
+    if(sc > characterCode){
+        return 0;
+    }
+    if(ro == 0){
+        return (unsigned short)(characterCode + id);
+    }
+    unsigned short val = cmap.rangeGlyph(low, ro, characterCode, sc);
+    return val ? (unsigned short)(val + id) : 0;
 }
 
-void getGlyphShape(unsigned char* fileData, unsigned short characterCode, GlyphShape* shape){
-    unsigned char* glyfData = getPointerToGlyphData(fileData, characterCode);
-    FileGlyph *g = (FileGlyph*)glyfData;
-    FileGlyph gg;
-    gg.numberOfContours = (unsigned short)SWAP16(g->numberOfContours);
-    gg.xMin = (unsigned short)SWAP16(g->xMin);
-    gg.yMin = (unsigned short)SWAP16(g->yMin);
-    gg.xMax = (unsigned short)SWAP16(g->xMax);
-    gg.yMax = (unsigned short)SWAP16(g->yMax);
+//0 for glyphs without an outline, like the space
+unsigned char* getPointerToGlyphDataFromIndex(unsigned char* fileData, unsigned int glyphIndex){
+    LocaView loca = getTableView<LocaView>(fileData);
+    GlyfView glyf = getTableView<GlyfView>(fileData);
+    unsigned int offset = loca[glyphIndex];
+    if(loca[glyphIndex + 1] == offset){
+        return 0;
+    }
+    return (unsigned char*)glyf.glyph(offset);
+}
 
-    shape->numContours = gg.numberOfContours;
-    shape->xMin = gg.xMin;
-    shape->xMax = gg.xMax;
-    shape->yMin = gg.yMin;
-    shape->yMax = gg.yMax;
+unsigned char* getPointerToGlyphData(unsigned char* fileData, unsigned short characterCode){
+    return getPointerToGlyphDataFromIndex(fileData, getGlyphIndex(fileData, characterCode));
+}
 
-    if(gg.numberOfContours < 0){
+//the contour and point arrays come from allocator, free them with freeGlyphShape
+void getGlyphShapeFromIndex(unsigned char* fileData, unsigned int glyphIndex, GlyphShape* shape, AtlasAllocator* allocator = 0){
+    shape->totalPoints = 0;
+    shape->contourEndPoints = 0;
+    shape->points = 0;
+    unsigned char* glyfData = getPointerToGlyphDataFromIndex(fileData, glyphIndex);
+    if(!glyfData){
+        shape->numContours = 0;
+        shape->xMin = shape->xMax = shape->yMin = shape->yMax = 0;
+        return;
+    }
+    GlyphHeaderView g;
+    g.data = glyfData;
+    short numberOfContours = g.numberOfContours();
+
+    shape->numContours = numberOfContours;
+    shape->xMin = g.xMin();
+    shape->xMax = g.xMax();
+    shape->yMin = g.yMin();
+    shape->yMax = g.yMax();
+
+    //a glyph without contours has no points either
+    if(numberOfContours <= 0){
         //TODO: handle complex glyphs
         return; 
     }
 
-    unsigned short* contourEndPoints = (unsigned short*)(glyfData + sizeof(FileGlyph));
-    shape->contourEndPoints = new unsigned short[gg.numberOfContours];
-    for(int i = 0; i < gg.numberOfContours; i++){
-        unsigned short ep = SWAP16(*contourEndPoints);
-        shape->contourEndPoints[i] = ep;
-        contourEndPoints++;
+    BigEndianArray<unsigned short> contourEndPoints = g.endPtsOfContours();
+    shape->contourEndPoints = allocateAtlasArray<unsigned short>(allocator, numberOfContours);
+    for(int i = 0; i < numberOfContours; i++){
+        shape->contourEndPoints[i] = contourEndPoints[i];
     }
 
-    unsigned short instLn = SWAP16(*contourEndPoints);
-    contourEndPoints++;
-    unsigned char* inst = (unsigned char*)(contourEndPoints) + instLn;
+    const unsigned char* instructions = glyfData + 10 + (numberOfContours * 2);
+    unsigned short instLn = readBigEndian<unsigned short>(instructions);
+    const unsigned char* inst = instructions + 2 + instLn;
 
-    int totalPoints = shape->contourEndPoints[gg.numberOfContours - 1] + 1;
-    unsigned char *flags = new unsigned char[totalPoints];
+    int totalPoints = shape->contourEndPoints[numberOfContours - 1] + 1;
+    unsigned char *flags = allocateAtlasArray<unsigned char>(allocator, totalPoints);
     int totalFlags = 0;
     while(totalFlags < totalPoints){
         flags[totalFlags] = *inst;
@@ -395,7 +303,7 @@ void getGlyphShape(unsigned char* fileData, unsigned short characterCode, GlyphS
         }
     }
 
-    short *xPositions = new short[totalPoints];
+    short *xPositions = allocateAtlasArray<short>(allocator, totalPoints);
     for(int i = 0; i < totalPoints; i++){
         unsigned char flag = flags[i];
         short prevX = i == 0 ? 0 : xPositions[i - 1];
@@ -412,14 +320,14 @@ void getGlyphShape(unsigned char* fileData, unsigned short characterCode, GlyphS
             if(flag & 0x10){
                 xPositions[i] = prevX;
             }else {
-                short v = SWAP16(*(unsigned short*)inst);
+                short v = readBigEndian<short>(inst);
                 xPositions[i] = prevX + v;
                 inst += 2;
             }
         }
     }
 
-    short *yPositions = new short[totalPoints];
+    short *yPositions = allocateAtlasArray<short>(allocator, totalPoints);
     for(int i = 0; i < totalPoints; i++){
         unsigned char flag = flags[i];
         short prevY = i == 0 ? 0 : yPositions[i - 1];
@@ -436,14 +344,14 @@ void getGlyphShape(unsigned char* fileData, unsigned short characterCode, GlyphS
             if(flag & 0x20){
                 yPositions[i] = prevY;
             }else {
-                short v = SWAP16(*(unsigned short*)inst);
+                short v = readBigEndian<short>(inst);
                 yPositions[i] = prevY + v;
                 inst += 2;
             }
         }
     }
 
-    GlyphPoint* points = new GlyphPoint[totalPoints];
+    GlyphPoint* points = allocateAtlasArray<GlyphPoint>(allocator, totalPoints);
 
     for(int i = 0; i < totalPoints; i++){
         unsigned char flag = flags[i];
@@ -459,8 +367,22 @@ void getGlyphShape(unsigned char* fileData, unsigned short characterCode, GlyphS
     shape->totalPoints = totalPoints;
     shape->points = points;
 
-    delete[] xPositions;
-    delete[] yPositions;
+    releaseAtlasMemory(allocator, flags);
+    releaseAtlasMemory(allocator, xPositions);
+    releaseAtlasMemory(allocator, yPositions);
+}
+
+void getGlyphShape(unsigned char* fileData, unsigned short characterCode, GlyphShape* shape, AtlasAllocator* allocator = 0){
+    getGlyphShapeFromIndex(fileData, getGlyphIndex(fileData, characterCode), shape, allocator);
+}
+
+//allocator must be the one the shape was decoded with
+void freeGlyphShape(GlyphShape* shape, AtlasAllocator* allocator = 0){
+    releaseAtlasMemory(allocator, shape->contourEndPoints);
+    releaseAtlasMemory(allocator, shape->points);
+    shape->contourEndPoints = 0;
+    shape->points = 0;
+    shape->totalPoints = 0;
 }
 
 void getLinesFromCurve(float x1, float y1, float x2, float y2, float ox, float oy, float interval, LineGroup& lg){
@@ -480,7 +402,11 @@ void getLinesFromCurve(float x1, float y1, float x2, float y2, float ox, float o
     }
 }
 
+//composite glyphs aren't parsed yet and come back without contours, they flatten to no lines
 void getGlyphLines(GlyphShape g, LineGroup& lg){
+    if((short)g.numContours <= 0){
+        return;
+    }
     for(int i = 0; i < g.numContours; i++){
         int start = i == 0 ? 0 : g.contourEndPoints[i - 1] + 1;
         int end = g.contourEndPoints[i] + 1;
@@ -510,22 +436,27 @@ void getGlyphLines(GlyphShape g, LineGroup& lg){
     }
 }
 
+unsigned short getGlyphAdvanceFromIndex(unsigned char* fileData, unsigned int glyphIndex){
+    return getTableView<HmtxView>(fileData).advance(glyphIndex);
+}
+
 unsigned short getGlyphAdvance(unsigned char* fileData, unsigned short characterCode){
-    HheaTable* hhea = (HheaTable*)getPointerToTableData(fileData, "hhea");
-    unsigned short numOfLongHorMetrics = SWAP16(hhea->numOfLongHorMetrics);
-    unsigned short* hmtx = (unsigned short*)getPointerToTableData(fileData, "hmtx");
-    MaxpTable* mp = (MaxpTable*)getPointerToTableData(fileData, "maxp");
-    unsigned short numGlyphs = SWAP16(mp->numGlyphs);
-    unsigned short adv = 0;
+    return getGlyphAdvanceFromIndex(fileData, getGlyphIndex(fileData, characterCode));
+}
 
-    if(numOfLongHorMetrics == numGlyphs){
-        unsigned int indx = getGlyphIndex(fileData, characterCode);
-        adv = SWAP16(hmtx[indx * 2]); 
-    }else{
-        //TODO: This may not be correct
-        adv = SWAP16(hmtx[0]); 
-    }
-    return adv;
+unsigned short getTotalGlyphs(unsigned char* fileData){
+    return getTableView<MaxpView>(fileData).numGlyphs();
+}
+
+unsigned short getUnitsPerEm(unsigned char* fileData){
+    return getTableView<HeadView>(fileData).unitsPerEm();
+}
+
+void getFontVerticalMetrics(unsigned char* fileData, short* ascent, short* descent, short* lineGap){
+    HheaView hhea = getTableView<HheaView>(fileData);
+    *ascent = hhea.ascent();
+    *descent = hhea.descent();
+    *lineGap = hhea.lineGap();
 }
 
 bool isPixelInside(float x, float y, LineGroup lg){
@@ -566,76 +497,281 @@ bool isPixelInside(float x, float y, LineGroup lg){
     return false;
 }
 
-unsigned char* getBitmapFromCharCode(unsigned char* fileData, unsigned short characterCode, unsigned int* width, unsigned int* height){
-    GlyphShape gs;
-    getGlyphShape(fileData, characterCode, &gs);
-    LineGroup lg;
-    getGlyphLines(gs, lg);
+//edge length in font units of the tiles a large glyph is split into when a pool is given
+static const unsigned int GLYPH_TILE_UNITS = 64;
+
+//one pixel of a reduced bitmap, its samples are added to samples. coverage samples every font unit
+//row of the pixel. the thresholded bitmaps the atlases are built from only ever sampled the bottom
+//row, and keep doing so to stay the same
+static unsigned char getReducedPixel(GlyphShape* gs, LineGroup& lg, int i, int j, unsigned int divisions, float xOffset, bool coverage, unsigned long* samples){
+    unsigned int pixTotal = 0;
+    unsigned int pixSamples = 0;
+    float k = (i * divisions * 0.9999) + gs->yMin;
+    float kLimit = ((i + 1) * divisions * 0.9999) + gs->yMin;
+    float lStart = (j * divisions * 0.9999) + gs->xMin - xOffset;
+    float l = lStart;
+    float lLimit = ((j + 1) * divisions * 0.9999) + gs->xMin - xOffset;
+
+    while(k < kLimit){
+        if(coverage){
+            l = lStart;
+        }
+        while(l < lLimit){
+            if(!isPixelInside((int)l, (int)k, lg)){
+                pixTotal += 255;
+            }
+            pixSamples++;
+            l++;
+        }
+        k++;
+    }
+    *samples += pixSamples;
+    if(coverage){
+        return pixSamples ? 255 - (pixTotal / pixSamples) : 0;
+    }else if(pixTotal / divisions < 255){
+        return 255;
+    }
+    return 0;
+}
 
-    *width = gs.xMax - gs.xMin;
-    *height = gs.yMax - gs.yMin;
+struct GlyphTileJob{
+    GlyphShape* gs;
+    unsigned char* bitmap;
+    unsigned int width;
+    unsigned int height;
+    //0 samples once per font unit like getBitmapFromCharCode
+    unsigned int divisions;
+    float xOffset;
+    bool coverage;
+    unsigned int tileWidth;
+    unsigned int tileHeight;
+    unsigned int tilesX;
+    //lines of tile t are binLines[binStarts[t]] up to binLines[binStarts[t + 1]]
+    unsigned int* binStarts;
+    vecLine* binLines;
+    unsigned long* tileSamples;
+};
 
-    unsigned char* bitmap = new unsigned char[*width * *height];
-    int ctr = 0;
-    for(int i = gs.yMin; i < gs.yMax; i++){
-        for(int j = gs.xMin; j < gs.xMax; j++){
-            if(isPixelInside(j, i, lg)){
-                bitmap[ctr++] = 255;
+//fills the pixels [x0, x1) x [y0, y1) of the job's bitmap and returns the samples taken
+static unsigned long rasterizeGlyphRect(GlyphTileJob* job, LineGroup& lg, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1){
+    unsigned long samples = 0;
+    for(unsigned int i = y0; i < y1; i++){
+        unsigned char* row = &job->bitmap[i * job->width];
+        for(unsigned int j = x0; j < x1; j++){
+            if(job->divisions){
+                row[j] = getReducedPixel(job->gs, lg, i, j, job->divisions, job->xOffset, job->coverage, &samples);
             }else{
-                bitmap[ctr++] = 0;
+                row[j] = isPixelInside(job->gs->xMin + (int)j, job->gs->yMin + (int)i, lg) ? 255 : 0;
+                samples++;
             }
         }
     }
-
-    return bitmap;
+    return samples;
 }
 
-unsigned char* getReducedBitmapFromCharCode(unsigned char* fileData, unsigned short characterCode, unsigned int* width, unsigned int* height, float* horzBng, float* vertBng, unsigned int divisions){
-    GlyphShape gs;
-    getGlyphShape(fileData, characterCode, &gs);
-    LineGroup lg;
-    getGlyphLines(gs, lg);
+static void rasterizeGlyphTile(void* data, unsigned int tile){
+    GlyphTileJob* job = (GlyphTileJob*)data;
+    unsigned int x0 = (tile % job->tilesX) * job->tileWidth;
+    unsigned int y0 = (tile / job->tilesX) * job->tileHeight;
+    unsigned int x1 = x0 + job->tileWidth < job->width ? x0 + job->tileWidth : job->width;
+    unsigned int y1 = y0 + job->tileHeight < job->height ? y0 + job->tileHeight : job->height;
+
+    //a view of the tile's bin, never cleared
+    LineGroup tileLines;
+    tileLines.lines = &job->binLines[job->binStarts[tile]];
+    tileLines.totalLines = job->binStarts[tile + 1] - job->binStarts[tile];
+    job->tileSamples[tile] = rasterizeGlyphRect(job, tileLines, x0, y0, x1, y1);
+}
 
-    *horzBng = (float)getGlyphAdvance(fileData, characterCode) / (float)divisions;
-    *vertBng = (float)gs.yMin / (float)divisions;
+//glyphs spanning more than one tile are split into tiles rasterized across pool. every tile only
+//gets the lines isPixelInside could count for one of its samples: lines wholly above or below
+//the tile's sample rows, or right of its last sample column, never change a winding number in it.
+//the samples and the order they are tested in are the same as rasterizing the glyph whole, so the
+//bitmap is identical with any pool or none
+static unsigned long rasterizeGlyphTiles(GlyphTileJob* job, LineGroup& lg, ThreadPool* pool, AtlasAllocator* allocator){
+    job->tileWidth = job->divisions ? GLYPH_TILE_UNITS / job->divisions : GLYPH_TILE_UNITS;
+    job->tileWidth = job->tileWidth ? job->tileWidth : 1;
+    job->tileHeight = job->tileWidth;
+    job->tilesX = (job->width + job->tileWidth - 1) / job->tileWidth;
+    unsigned int tilesY = (job->height + job->tileHeight - 1) / job->tileHeight;
+    unsigned int totalTiles = job->tilesX * tilesY;
+    if(!pool || pool->totalThreads == 0 || totalTiles < 2){
+        return rasterizeGlyphRect(job, lg, 0, 0, job->width, job->height);
+    }
 
-    unsigned int gWidth = gs.xMax - gs.xMin;
-    unsigned int gHeight = gs.yMax - gs.yMin;
-    *width = (gWidth / divisions) + 1;
-    *height = (gHeight / divisions) + 1;
+    //lowest and highest sample row of every tile row and the last sample column of every tile
+    //column, in font units. one unit of slack covers the rounding of the reduced sample positions
+    int* rowLows = allocateAtlasArray<int>(allocator, tilesY);
+    int* rowHighs = allocateAtlasArray<int>(allocator, tilesY);
+    int* columnHighs = allocateAtlasArray<int>(allocator, job->tilesX);
+    GlyphShape* gs = job->gs;
+    for(unsigned int i = 0; i < tilesY; i++){
+        unsigned int y0 = i * job->tileHeight;
+        unsigned int y1 = y0 + job->tileHeight < job->height ? y0 + job->tileHeight : job->height;
+        if(job->divisions){
+            float k0 = (y0 * job->divisions * 0.9999) + gs->yMin;
+            float k1 = (y1 * job->divisions * 0.9999) + gs->yMin;
+            rowLows[i] = (int)k0 - 1;
+            rowHighs[i] = (int)k1 + 1;
+        }else{
+            rowLows[i] = gs->yMin + (int)y0;
+            rowHighs[i] = gs->yMin + (int)y1 - 1;
+        }
+    }
+    for(unsigned int i = 0; i < job->tilesX; i++){
+        unsigned int x1 = (i + 1) * job->tileWidth < job->width ? (i + 1) * job->tileWidth : job->width;
+        if(job->divisions){
+            float l1 = (x1 * job->divisions * 0.9999) + gs->xMin - job->xOffset;
+            columnHighs[i] = (int)l1 + 1;
+        }else{
+            columnHighs[i] = gs->xMin + (int)x1 - 1;
+        }
+    }
 
-    unsigned char* bitmap = new unsigned char[*width * *height];
-    unsigned int ctr = 0;
-    for(int i = 0; i < *height; i++){
-        for(int j = 0; j < *width; j++){
-            unsigned int pixTotal = 0;
-            float k = (i * divisions * 0.9999) + gs.yMin;
-            float kLimit = ((i + 1) * divisions * 0.9999) + gs.yMin;
-            float l = (j * divisions * 0.9999) + gs.xMin;
-            float lLimit = ((j + 1) * divisions * 0.9999) + gs.xMin;
-
-            while(k < kLimit){
-                while(l < lLimit){
-                    if(!isPixelInside((int)l, (int)k, lg)){
-                        pixTotal += 255;
+    job->binStarts = allocateAtlasArray<unsigned int>(allocator, totalTiles + 1);
+    memset(job->binStarts, 0, sizeof(unsigned int) * (totalTiles + 1));
+    job->binLines = 0;
+    unsigned int* binFill = 0;
+    for(int pass = 0; pass < 2; pass++){
+        if(pass == 1){
+            for(unsigned int i = 0; i < totalTiles; i++){
+                job->binStarts[i + 1] += job->binStarts[i];
+            }
+            job->binLines = allocateAtlasArray<vecLine>(allocator, job->binStarts[totalTiles]);
+            binFill = allocateAtlasArray<unsigned int>(allocator, totalTiles);
+            memcpy(binFill, job->binStarts, sizeof(unsigned int) * totalTiles);
+        }
+        for(unsigned int i = 0; i < lg.totalLines; i++){
+            vecLine l = lg.lines[i];
+            float lowY = l.p1.y < l.p2.y ? l.p1.y : l.p2.y;
+            float highY = l.p1.y > l.p2.y ? l.p1.y : l.p2.y;
+            float lowX = l.p1.x < l.p2.x ? l.p1.x : l.p2.x;
+            for(unsigned int ty = 0; ty < tilesY; ty++){
+                if(highY < rowLows[ty] || lowY > rowHighs[ty]){
+                    continue;
+                }
+                for(unsigned int tx = 0; tx < job->tilesX; tx++){
+                    if(lowX > columnHighs[tx]){
+                        continue;
+                    }
+                    unsigned int tile = (ty * job->tilesX) + tx;
+                    if(pass == 0){
+                        job->binStarts[tile + 1]++;
+                    }else{
+                        job->binLines[binFill[tile]++] = l;
                     }
-                    l++;
                 }
-                k++;
             }
-            if(pixTotal / divisions < 255){
-                bitmap[ctr++] = 255;
-            }else{
-                bitmap[ctr++] = 0;
-            } 
         }
     }
+
+    job->tileSamples = allocateAtlasArray<unsigned long>(allocator, totalTiles);
+    runParallel(pool, rasterizeGlyphTile, job, totalTiles);
+    unsigned long samples = 0;
+    for(unsigned int i = 0; i < totalTiles; i++){
+        samples += job->tileSamples[i];
+    }
+
+    releaseAtlasMemory(allocator, job->tileSamples);
+    releaseAtlasMemory(allocator, binFill);
+    releaseAtlasMemory(allocator, job->binLines);
+    releaseAtlasMemory(allocator, job->binStarts);
+    releaseAtlasMemory(allocator, columnHighs);
+    releaseAtlasMemory(allocator, rowHighs);
+    releaseAtlasMemory(allocator, rowLows);
+    return samples;
+}
+
+//pool splits large glyphs into tiles rasterized in parallel, the bitmap is the same without it
+unsigned char* getBitmapFromCharCode(unsigned char* fileData, unsigned short characterCode, unsigned int* width, unsigned int* height, AtlasBuildStats* stats = 0, AtlasAllocator* allocator = 0, ThreadPool* pool = 0){
+    ATLAS_STATS_START(glyphStart);
+    GlyphShape gs;
+    getGlyphShape(fileData, characterCode, &gs, allocator);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_PARSE, glyphStart, characterCode);
+    ATLAS_STATS_START(flattenStart);
+    LineGroup lg(allocator);
+    getGlyphLines(gs, lg);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_FLATTEN, flattenStart, characterCode);
+
+    *width = gs.xMax - gs.xMin;
+    *height = gs.yMax - gs.yMin;
+
+    ATLAS_STATS_START(rasterStart);
+    unsigned char* bitmap = allocateAtlasArray<unsigned char>(allocator, *width * *height);
+    GlyphTileJob job;
+    job.gs = &gs;
+    job.bitmap = bitmap;
+    job.width = *width;
+    job.height = *height;
+    job.divisions = 0;
+    job.xOffset = 0;
+    job.coverage = false;
+    rasterizeGlyphTiles(&job, lg, pool, allocator);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_RASTERIZE, rasterStart, characterCode);
+    ATLAS_STATS_GLYPH(stats, characterCode, lg.totalLines, *width * *height, *width * *height,
+                      (*width * *height) + (lg.totalLines * sizeof(vecLine)) + (gs.totalPoints * sizeof(GlyphPoint)), glyphStart);
+    lg.clear();
+    freeGlyphShape(&gs, allocator);
     return bitmap;
 }
 
-void freeBitmapMemory(unsigned char* mem){
-    if(mem){
-        delete[] mem;
-        mem = 0;
+//rasterizes an already flattened outline, one pixel per divisions font units.
+//xOffset moves the outline right in font units, used for subpixel positioned variants.
+//coverage keeps the fraction of samples inside instead of thresholding it. pool splits large
+//glyphs into tiles rasterized in parallel
+unsigned char* getReducedBitmapFromLines(GlyphShape* gs, LineGroup& lg, unsigned int* width, unsigned int* height, unsigned int divisions, float xOffset, bool coverage, unsigned long* totalSamples, AtlasAllocator* allocator = 0, ThreadPool* pool = 0){
+    unsigned int gWidth = gs->xMax - gs->xMin + (unsigned int)xOffset;
+    unsigned int gHeight = gs->yMax - gs->yMin;
+    *width = (gWidth / divisions) + 1;
+    *height = (gHeight / divisions) + 1;
+
+    unsigned char* bitmap = allocateAtlasArray<unsigned char>(allocator, *width * *height);
+    GlyphTileJob job;
+    job.gs = gs;
+    job.bitmap = bitmap;
+    job.width = *width;
+    job.height = *height;
+    job.divisions = divisions;
+    job.xOffset = xOffset;
+    job.coverage = coverage;
+    unsigned long samples = rasterizeGlyphTiles(&job, lg, pool, allocator);
+    if(totalSamples){
+        *totalSamples += samples;
     }
+    return bitmap;
+}
+
+//traceCode is the character the stats record the glyph under. the bitmap and everything decoded
+//on the way come from allocator, free the bitmap with freeBitmapMemory and the same allocator
+//a pool rasterizes a large glyph in tiles across its threads, for poster sized single glyphs
+unsigned char* getReducedBitmapFromIndex(unsigned char* fileData, unsigned int glyphIndex, unsigned int* width, unsigned int* height, float* horzBng, float* vertBng, unsigned int divisions, float xOffset = 0, AtlasBuildStats* stats = 0, unsigned int traceCode = 0, AtlasAllocator* allocator = 0, ThreadPool* pool = 0){
+    ATLAS_STATS_START(glyphStart);
+    GlyphShape gs;
+    getGlyphShapeFromIndex(fileData, glyphIndex, &gs, allocator);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_PARSE, glyphStart, traceCode);
+    ATLAS_STATS_START(flattenStart);
+    LineGroup lg(allocator);
+    getGlyphLines(gs, lg);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_FLATTEN, flattenStart, traceCode);
+
+    *horzBng = (float)getGlyphAdvanceFromIndex(fileData, glyphIndex) / (float)divisions;
+    *vertBng = (float)gs.yMin / (float)divisions;
+
+    ATLAS_STATS_START(rasterStart);
+    unsigned long samples = 0;
+    unsigned char* bitmap = getReducedBitmapFromLines(&gs, lg, width, height, divisions, xOffset, false, &samples, allocator, pool);
+    ATLAS_STATS_STAGE(stats, ATLAS_STAGE_RASTERIZE, rasterStart, traceCode);
+    ATLAS_STATS_GLYPH(stats, traceCode, lg.totalLines, *width * *height, samples,
+                      (*width * *height) + (lg.totalLines * sizeof(vecLine)) + (gs.totalPoints * sizeof(GlyphPoint)), glyphStart);
+    lg.clear();
+    freeGlyphShape(&gs, allocator);
+    return bitmap;
+}
+
+unsigned char* getReducedBitmapFromCharCode(unsigned char* fileData, unsigned short characterCode, unsigned int* width, unsigned int* height, float* horzBng, float* vertBng, unsigned int divisions, float xOffset = 0, AtlasBuildStats* stats = 0, AtlasAllocator* allocator = 0, ThreadPool* pool = 0){
+    return getReducedBitmapFromIndex(fileData, getGlyphIndex(fileData, characterCode), width, height, horzBng, vertBng, divisions, xOffset, stats, characterCode, allocator, pool);
+}
+
+void freeBitmapMemory(unsigned char* mem, AtlasAllocator* allocator = 0){
+    releaseAtlasMemory(allocator, mem);
 }
\ No newline at end of file
@@ -0,0 +1,415 @@
+#pragma once
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//zero copy views over the big endian sfnt tables. a view is a pointer to the start of its table
+//and every accessor decodes the field it reads, so nothing is swapped or copied up front and no
+//unaligned multi byte loads are made. arrays that are walked over and over, like loca and the
+//cmap segments, can be decoded once in bulk with the swap helpers at the bottom
+
+constexpr unsigned int makeTableTag(char a, char b, char c, char d){
+    return ((unsigned int)(unsigned char)a << 24) | ((unsigned int)(unsigned char)b << 16) |
+           ((unsigned int)(unsigned char)c << 8) | (unsigned int)(unsigned char)d;
+}
+
+constexpr unsigned int TAG_TTCF = makeTableTag('t', 't', 'c', 'f');
+constexpr unsigned int TAG_HEAD = makeTableTag('h', 'e', 'a', 'd');
+constexpr unsigned int TAG_HHEA = makeTableTag('h', 'h', 'e', 'a');
+constexpr unsigned int TAG_MAXP = makeTableTag('m', 'a', 'x', 'p');
+constexpr unsigned int TAG_CMAP = makeTableTag('c', 'm', 'a', 'p');
+constexpr unsigned int TAG_LOCA = makeTableTag('l', 'o', 'c', 'a');
+constexpr unsigned int TAG_GLYF = makeTableTag('g', 'l', 'y', 'f');
+constexpr unsigned int TAG_HMTX = makeTableTag('h', 'm', 't', 'x');
+constexpr unsigned int TAG_GSUB = makeTableTag('G', 'S', 'U', 'B');
+
+template<typename T> inline T readBigEndian(const unsigned char* p);
+
+template<> inline unsigned char readBigEndian<unsigned char>(const unsigned char* p){
+    return p[0];
+}
+
+template<> inline unsigned short readBigEndian<unsigned short>(const unsigned char* p){
+    return (unsigned short)((p[0] << 8) | p[1]);
+}
+
+template<> inline short readBigEndian<short>(const unsigned char* p){
+    return (short)readBigEndian<unsigned short>(p);
+}
+
+template<> inline unsigned int readBigEndian<unsigned int>(const unsigned char* p){
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | (unsigned int)p[3];
+}
+
+template<> inline int readBigEndian<int>(const unsigned char* p){
+    return (int)readBigEndian<unsigned int>(p);
+}
+
+template<> inline unsigned long readBigEndian<unsigned long>(const unsigned char* p){
+    return ((unsigned long)readBigEndian<unsigned int>(p) << 32) | readBigEndian<unsigned int>(p + 4);
+}
+
+template<> inline long readBigEndian<long>(const unsigned char* p){
+    return (long)readBigEndian<unsigned long>(p);
+}
+
+//a run of big endian values of type T
+template<typename T> struct BigEndianArray{
+    const unsigned char* data;
+    unsigned int count;
+
+    T operator[](unsigned int i) const{
+        return readBigEndian<T>(data + (i * sizeof(T)));
+    }
+};
+
+template<typename T> BigEndianArray<T> makeBigEndianArray(const unsigned char* data, unsigned int count){
+    BigEndianArray<T> a;
+    a.data = data;
+    a.count = count;
+    return a;
+}
+
+struct SfntTable{
+    const unsigned char* data;
+    unsigned int length;
+};
+
+//table directory of one face, collections keep table offsets relative to the whole file
+struct SfntDirectoryView{
+    const unsigned char* file;
+    const unsigned char* data;
+
+    unsigned int scalarType() const{ return readBigEndian<unsigned int>(data); }
+    unsigned short numTables() const{ return readBigEndian<unsigned short>(data + 4); }
+    unsigned int tag(unsigned int i) const{ return readBigEndian<unsigned int>(data + 12 + (i * 16)); }
+    unsigned int offset(unsigned int i) const{ return readBigEndian<unsigned int>(data + 12 + (i * 16) + 8); }
+    unsigned int length(unsigned int i) const{ return readBigEndian<unsigned int>(data + 12 + (i * 16) + 12); }
+
+    SfntTable find(unsigned int tableTag) const{
+        SfntTable t = {0, 0};
+        unsigned short total = numTables();
+        for(unsigned int i = 0; i < total; i++){
+            if(tag(i) == tableTag){
+                t.data = file + offset(i);
+                t.length = length(i);
+                break;
+            }
+        }
+        return t;
+    }
+};
+
+inline bool isFontCollectionData(const unsigned char* fileData){
+    return readBigEndian<unsigned int>(fileData) == TAG_TTCF;
+}
+
+inline unsigned int getFontCollectionSize(const unsigned char* fileData){
+    return isFontCollectionData(fileData) ? readBigEndian<unsigned int>(fileData + 8) : 1;
+}
+
+inline SfntDirectoryView getSfntDirectory(const unsigned char* fileData, unsigned int faceIndex){
+    SfntDirectoryView d;
+    d.file = fileData;
+    d.data = isFontCollectionData(fileData) ? fileData + readBigEndian<unsigned int>(fileData + 12 + (faceIndex * 4)) : fileData;
+    return d;
+}
+
+struct HeadView{
+    static constexpr unsigned int TAG = TAG_HEAD;
+    const unsigned char* data;
+
+    unsigned short unitsPerEm() const{ return readBigEndian<unsigned short>(data + 18); }
+    short xMin() const{ return readBigEndian<short>(data + 36); }
+    short yMin() const{ return readBigEndian<short>(data + 38); }
+    short xMax() const{ return readBigEndian<short>(data + 40); }
+    short yMax() const{ return readBigEndian<short>(data + 42); }
+    short indexToLocFormat() const{ return readBigEndian<short>(data + 50); }
+};
+
+struct HheaView{
+    static constexpr unsigned int TAG = TAG_HHEA;
+    const unsigned char* data;
+
+    short ascent() const{ return readBigEndian<short>(data + 4); }
+    short descent() const{ return readBigEndian<short>(data + 6); }
+    short lineGap() const{ return readBigEndian<short>(data + 8); }
+    unsigned short advanceWidthMax() const{ return readBigEndian<unsigned short>(data + 10); }
+    unsigned short numOfLongHorMetrics() const{ return readBigEndian<unsigned short>(data + 34); }
+};
+
+struct MaxpView{
+    static constexpr unsigned int TAG = TAG_MAXP;
+    const unsigned char* data;
+
+    unsigned short numGlyphs() const{ return readBigEndian<unsigned short>(data + 4); }
+};
+
+//segment mapping to delta values, the only cmap subtable format the parser reads
+struct CmapFormat4View{
+    const unsigned char* data;
+
+    unsigned short format() const{ return readBigEndian<unsigned short>(data); }
+    unsigned short segCount() const{ return readBigEndian<unsigned short>(data + 6) / 2; }
+    BigEndianArray<unsigned short> endCodes() const{ return makeBigEndianArray<unsigned short>(data + 14, segCount()); }
+    BigEndianArray<unsigned short> startCodes() const{ return makeBigEndianArray<unsigned short>(data + 16 + (segCount() * 2), segCount()); }
+    BigEndianArray<unsigned short> idDeltas() const{ return makeBigEndianArray<unsigned short>(data + 16 + (segCount() * 4), segCount()); }
+    BigEndianArray<unsigned short> idRangeOffsets() const{ return makeBigEndianArray<unsigned short>(data + 16 + (segCount() * 6), segCount()); }
+
+    //idRangeOffset counts bytes from its own slot in the array
+    unsigned short rangeGlyph(unsigned int segment, unsigned short rangeOffset, unsigned short characterCode, unsigned short startCode) const{
+        const unsigned char* slot = data + 16 + (segCount() * 6) + (segment * 2);
+        return readBigEndian<unsigned short>(slot + rangeOffset + ((characterCode - startCode) * 2));
+    }
+};
+
+struct CmapView{
+    static constexpr unsigned int TAG = TAG_CMAP;
+    const unsigned char* data;
+
+    unsigned short numTables() const{ return readBigEndian<unsigned short>(data + 2); }
+    unsigned short platformID(unsigned int i) const{ return readBigEndian<unsigned short>(data + 4 + (i * 8)); }
+    unsigned short encodingID(unsigned int i) const{ return readBigEndian<unsigned short>(data + 4 + (i * 8) + 2); }
+    const unsigned char* subtable(unsigned int i) const{ return data + readBigEndian<unsigned int>(data + 4 + (i * 8) + 4); }
+
+    //first unicode or windows unicode encoding stored as format 4, the first encoding otherwise
+    CmapFormat4View unicodeSubtable() const{
+        CmapFormat4View v;
+        v.data = numTables() ? subtable(0) : 0;
+        unsigned short total = numTables();
+        for(unsigned int i = 0; i < total; i++){
+            unsigned short platform = platformID(i);
+            if((platform == 0 || (platform == 3 && encodingID(i) == 1)) && readBigEndian<unsigned short>(subtable(i)) == 4){
+                v.data = subtable(i);
+                break;
+            }
+        }
+        return v;
+    }
+};
+
+struct LocaView{
+    static constexpr unsigned int TAG = TAG_LOCA;
+    const unsigned char* data;
+    short indexToLocFormat;
+
+    //offset of a glyph into glyf, short offsets are stored halved
+    unsigned int operator[](unsigned int glyphIndex) const{
+        if(indexToLocFormat == 0){
+            return (unsigned int)readBigEndian<unsigned short>(data + (glyphIndex * 2)) * 2;
+        }
+        return readBigEndian<unsigned int>(data + (glyphIndex * 4));
+    }
+};
+
+struct GlyfView{
+    static constexpr unsigned int TAG = TAG_GLYF;
+    const unsigned char* data;
+
+    const unsigned char* glyph(unsigned int offset) const{ return data + offset; }
+};
+
+//glyph header, followed by the contour end points of a simple glyph
+struct GlyphHeaderView{
+    const unsigned char* data;
+
+    short numberOfContours() const{ return readBigEndian<short>(data); }
+    short xMin() const{ return readBigEndian<short>(data + 2); }
+    short yMin() const{ return readBigEndian<short>(data + 4); }
+    short xMax() const{ return readBigEndian<short>(data + 6); }
+    short yMax() const{ return readBigEndian<short>(data + 8); }
+    BigEndianArray<unsigned short> endPtsOfContours() const{ return makeBigEndianArray<unsigned short>(data + 10, numberOfContours() > 0 ? numberOfContours() : 0); }
+};
+
+struct HmtxView{
+    static constexpr unsigned int TAG = TAG_HMTX;
+    const unsigned char* data;
+    unsigned short numOfLongHorMetrics;
+
+    //glyphs past the long metrics share the last advance
+    unsigned short advance(unsigned int glyphIndex) const{
+        if(numOfLongHorMetrics == 0){
+            return 0;
+        }
+        unsigned int i = glyphIndex < numOfLongHorMetrics ? glyphIndex : numOfLongHorMetrics - 1;
+        return readBigEndian<unsigned short>(data + (i * 4));
+    }
+};
+
+//glyph substitution, the script, feature and lookup lists are walked by text_shaper.h
+struct GsubView{
+    static constexpr unsigned int TAG = TAG_GSUB;
+    const unsigned char* data;
+
+    const unsigned char* scriptList() const{ return data + readBigEndian<unsigned short>(data + 4); }
+    const unsigned char* featureList() const{ return data + readBigEndian<unsigned short>(data + 6); }
+    const unsigned char* lookupList() const{ return data + readBigEndian<unsigned short>(data + 8); }
+};
+
+template<typename View> View getTableView(const unsigned char* fileData, unsigned int faceIndex = 0){
+    View v;
+    v.data = getSfntDirectory(fileData, faceIndex).find(View::TAG).data;
+    return v;
+}
+
+template<> inline LocaView getTableView<LocaView>(const unsigned char* fileData, unsigned int faceIndex){
+    LocaView v;
+    v.data = getSfntDirectory(fileData, faceIndex).find(LocaView::TAG).data;
+    v.indexToLocFormat = getTableView<HeadView>(fileData, faceIndex).indexToLocFormat();
+    return v;
+}
+
+template<> inline HmtxView getTableView<HmtxView>(const unsigned char* fileData, unsigned int faceIndex){
+    HmtxView v;
+    v.data = getSfntDirectory(fileData, faceIndex).find(HmtxView::TAG).data;
+    v.numOfLongHorMetrics = getTableView<HheaView>(fileData, faceIndex).numOfLongHorMetrics();
+    return v;
+}
+
+//bulk decoders, dst doesn't need any alignment
+void swapBigEndian16(const unsigned char* src, unsigned short* dst, unsigned int count){
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    for(; i + 8 <= count; i += 8){
+        __m128i v = _mm_loadu_si128((__m128i*)(src + (i * 2)));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+    }
+#endif
+    for(; i < count; i++){
+        dst[i] = readBigEndian<unsigned short>(src + (i * 2));
+    }
+}
+
+void swapBigEndian32(const unsigned char* src, unsigned int* dst, unsigned int count){
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    for(; i + 4 <= count; i += 4){
+        __m128i v = _mm_loadu_si128((__m128i*)(src + (i * 4)));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+    }
+#endif
+    for(; i < count; i++){
+        dst[i] = readBigEndian<unsigned int>(src + (i * 4));
+    }
+}
+
+//short loca offsets are widened and doubled in the same pass
+void decodeShortLocaOffsets(const unsigned char* src, unsigned int* dst, unsigned int count){
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for(; i + 8 <= count; i += 8){
+        __m128i v = _mm_loadu_si128((__m128i*)(src + (i * 2)));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        __m128i lo = _mm_slli_epi32(_mm_unpacklo_epi16(v, zero), 1);
+        __m128i hi = _mm_slli_epi32(_mm_unpackhi_epi16(v, zero), 1);
+        _mm_storeu_si128((__m128i*)(dst + i), lo);
+        _mm_storeu_si128((__m128i*)(dst + i + 4), hi);
+    }
+#endif
+    for(; i < count; i++){
+        dst[i] = (unsigned int)readBigEndian<unsigned short>(src + (i * 2)) * 2;
+    }
+}
+
+//views of one face plus its loca offsets and cmap segments decoded to native order, for code
+//that maps lots of characters or glyphs and would otherwise re-decode the same entries
+struct FontTables{
+    const unsigned char* fileData;
+    HeadView head;
+    HheaView hhea;
+    MaxpView maxp;
+    CmapFormat4View cmap;
+    GlyfView glyf;
+    HmtxView hmtx;
+    unsigned short numGlyphs;
+    unsigned short segCount;
+    unsigned int* locaOffsets;
+    unsigned short* endCodes;
+    unsigned short* startCodes;
+    unsigned short* idDeltas;
+    unsigned short* idRangeOffsets;
+};
+
+void initFontTables(FontTables* ft, const unsigned char* fileData, unsigned int faceIndex = 0){
+    ft->fileData = fileData;
+    ft->head = getTableView<HeadView>(fileData, faceIndex);
+    ft->hhea = getTableView<HheaView>(fileData, faceIndex);
+    ft->maxp = getTableView<MaxpView>(fileData, faceIndex);
+    ft->cmap = getTableView<CmapView>(fileData, faceIndex).unicodeSubtable();
+    ft->glyf = getTableView<GlyfView>(fileData, faceIndex);
+    ft->hmtx = getTableView<HmtxView>(fileData, faceIndex);
+    ft->numGlyphs = ft->maxp.numGlyphs();
+
+    LocaView loca = getTableView<LocaView>(fileData, faceIndex);
+    ft->locaOffsets = new unsigned int[ft->numGlyphs + 1];
+    if(loca.indexToLocFormat == 0){
+        decodeShortLocaOffsets(loca.data, ft->locaOffsets, ft->numGlyphs + 1);
+    }else{
+        swapBigEndian32(loca.data, ft->locaOffsets, ft->numGlyphs + 1);
+    }
+
+    ft->segCount = ft->cmap.format() == 4 ? ft->cmap.segCount() : 0;
+    ft->endCodes = new unsigned short[ft->segCount * 4];
+    ft->startCodes = ft->endCodes + ft->segCount;
+    ft->idDeltas = ft->startCodes + ft->segCount;
+    ft->idRangeOffsets = ft->idDeltas + ft->segCount;
+    if(ft->segCount){
+        swapBigEndian16(ft->cmap.endCodes().data, ft->endCodes, ft->segCount);
+        swapBigEndian16(ft->cmap.startCodes().data, ft->startCodes, ft->segCount);
+        swapBigEndian16(ft->cmap.idDeltas().data, ft->idDeltas, ft->segCount);
+        swapBigEndian16(ft->cmap.idRangeOffsets().data, ft->idRangeOffsets, ft->segCount);
+    }
+}
+
+void freeFontTables(FontTables* ft){
+    if(ft->locaOffsets) delete[] ft->locaOffsets;
+    if(ft->endCodes) delete[] ft->endCodes;
+    ft->locaOffsets = 0;
+    ft->endCodes = 0;
+    ft->startCodes = 0;
+    ft->idDeltas = 0;
+    ft->idRangeOffsets = 0;
+    ft->segCount = 0;
+}
+
+//binary search for the first segment ending at or after the character, 0 when it isn't mapped
+unsigned int getGlyphIndexFromTables(FontTables* ft, unsigned short characterCode){
+    unsigned int low = 0;
+    unsigned int high = ft->segCount;
+    while(low < high){
+        unsigned int mid = (low + high) / 2;
+        if(ft->endCodes[mid] < characterCode){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+    if(low == ft->segCount || ft->startCodes[low] > characterCode){
+        return 0;
+    }
+    unsigned short delta = ft->idDeltas[low];
+    unsigned short rangeOffset = ft->idRangeOffsets[low];
+    if(rangeOffset == 0){
+        return (unsigned short)(characterCode + delta);
+    }
+    unsigned short glyph = ft->cmap.rangeGlyph(low, rangeOffset, characterCode, ft->startCodes[low]);
+    return glyph ? (unsigned short)(glyph + delta) : 0;
+}
+
+//0 for glyphs without an outline, such as the space
+const unsigned char* getGlyphDataFromTables(FontTables* ft, unsigned int glyphIndex, unsigned int* length){
+    if(glyphIndex >= ft->numGlyphs){
+        *length = 0;
+        return 0;
+    }
+    unsigned int start = ft->locaOffsets[glyphIndex];
+    *length = ft->locaOffsets[glyphIndex + 1] - start;
+    return *length ? ft->glyf.glyph(start) : 0;
+}